@@ -0,0 +1,122 @@
+/**
+ * File: arena.h
+ * -------------
+ * Exports a monotonic Arena and an STL-compatible ArenaAllocator that
+ * carves memory out of one.  Allocation is a pointer bump, deallocation
+ * is a no-op, and reset rewinds the arena in constant time while keeping
+ * every block it has acquired, so an arena that's reset after each unit
+ * of work stops touching the global heap once it reaches its high-water mark.
+ *
+ * Arenas are not thread-safe; the expected usage is one per worker thread.
+ */
+
+#ifndef _arena_
+#define _arena_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <vector>
+#include <utility>
+
+class Arena {
+ public:
+  static const size_t kDefaultBlockSize = 64 << 10;
+
+/**
+ * Constructs an empty arena.  No memory is acquired until the first allocation.
+ */
+  Arena(size_t blockSize = kDefaultBlockSize): blockSize(blockSize), current(0), cursor(NULL), end(NULL) {}
+
+/**
+ * Returns every block the arena acquired to the heap.
+ */
+  ~Arena() {
+    for (const std::pair<char *, size_t>& block: blocks) free(block.first);
+  }
+
+/**
+ * Returns a pointer to at least the requested number of bytes, aligned as
+ * specified.  The memory remains valid until the next reset.
+ */
+  void *allocate(size_t bytes, size_t alignment = alignof(std::max_align_t)) {
+    char *aligned = align(cursor, alignment);
+    if (cursor == NULL || aligned + bytes > end) {
+      nextBlock(bytes + alignment);
+      aligned = align(cursor, alignment);
+    }
+    cursor = aligned + bytes;
+    return aligned;
+  }
+
+/**
+ * Rewinds the arena to its first block, implicitly releasing everything
+ * allocated since the last reset.
+ */
+  void reset() {
+    current = 0;
+    cursor = blocks.empty() ? NULL : blocks[0].first;
+    end = blocks.empty() ? NULL : blocks[0].first + blocks[0].second;
+  }
+
+ private:
+  size_t blockSize;
+  std::vector<std::pair<char *, size_t>> blocks;
+  size_t current;
+  char *cursor;
+  char *end;
+
+  static char *align(char *ptr, size_t alignment) {
+    return reinterpret_cast<char *>((reinterpret_cast<uintptr_t>(ptr) + alignment - 1) & ~(alignment - 1));
+  }
+
+  // Advances to the next retained block big enough for the request, or
+  // acquires a new one if none of them is.
+  void nextBlock(size_t bytes) {
+    size_t next = cursor == NULL ? 0 : current + 1;
+    while (next < blocks.size() && blocks[next].second < bytes) next++;
+    if (next == blocks.size()) {
+      size_t size = bytes > blockSize ? bytes : blockSize;
+      char *block = static_cast<char *>(malloc(size));
+      if (block == NULL) throw std::bad_alloc();
+      blocks.push_back(std::make_pair(block, size));
+    }
+    current = next;
+    cursor = blocks[next].first;
+    end = blocks[next].first + blocks[next].second;
+  }
+
+  Arena(const Arena& original) = delete;
+  Arena& operator=(const Arena& rhs) = delete;
+};
+
+/**
+ * Class: ArenaAllocator
+ * ---------------------
+ * Minimal C++11 allocator that forwards to an Arena, so standard
+ * containers can be arena-backed.
+ */
+template <typename T>
+class ArenaAllocator {
+ public:
+  typedef T value_type;
+
+  ArenaAllocator(Arena *arena): arena(arena) {}
+  template <typename U> ArenaAllocator(const ArenaAllocator<U>& other): arena(other.arena) {}
+
+  T *allocate(size_t n) { return static_cast<T *>(arena->allocate(n * sizeof(T), alignof(T))); }
+  void deallocate(T *, size_t) {}
+
+  template <typename U> bool operator==(const ArenaAllocator<U>& rhs) const { return arena == rhs.arena; }
+  template <typename U> bool operator!=(const ArenaAllocator<U>& rhs) const { return arena != rhs.arena; }
+
+ private:
+  Arena *arena;
+  template <typename U> friend class ArenaAllocator;
+};
+
+template <typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+#endif
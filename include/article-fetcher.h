@@ -0,0 +1,124 @@
+/**
+ * File: article-fetcher.h
+ * -----------------------
+ * Exports the ArticleFetcher class, which wraps HTMLDocument::parse in
+ * per-attempt deadlines, retries with capped exponential backoff, optional
+ * hedged requests, and a deadline for the crawl as a whole.
+ *
+ * HTMLDocument's networking lives in a prebuilt library that can't be told
+ * to give up, so when an attempt has a deadline it runs on a thread of its
+ * own while the caller waits on a condition variable.  An attempt that runs
+ * past its deadline is abandoned: the caller moves on (to a retry, or to
+ * failing the article), and the thread finishes in the background and
+ * discards its document.  A hedge is a second attempt at the same URL,
+ * launched once the first has taken longer than the 95th percentile of
+ * recent successful downloads from the same server; whichever finishes
+ * first wins.
+ *
+ * Attempts on threads of their own are bounded in two ways.  No more than
+ * kMaxAttemptsPerServer of them (abandoned ones included) may be running
+ * against any one server; past that, an attempt isn't started at all, and
+ * the fetch backs off as though it had timed out.  And each one holds the
+ * caller's ConcurrencyPermit until its thread actually finishes, so an
+ * abandoned attempt still counts against the download limit for as long
+ * as it holds a connection.  The destructor waits for every attempt to
+ * finish, so none is still inside the library when the process exits.
+ *
+ * With no attempt timeout, no crawl deadline and hedging off (the default),
+ * attempts run on the calling thread, just as a bare HTMLDocument::parse
+ * would.
+ */
+
+#pragma once
+#include <cstddef>
+#include <string>
+#include <memory>
+#include <chrono>
+#include "html-document.h"
+#include "concurrency-controller.h"
+
+/**
+ * Type: FetchPolicy
+ * -----------------
+ * Attempt timeouts and backoffs are in seconds; 0 means no timeout.  Only
+ * attempts that time out (or that a busy server has no room for) are
+ * retried: the library doesn't say why an attempt failed outright, and a
+ * dead link or unparseable page fails the same way every time.
+ */
+struct FetchPolicy {
+  double attemptTimeout = 0;
+  size_t maxRetries = 2;
+  double initialBackoff = 0.25;
+  double maxBackoff = 4;
+  bool hedge = false;
+};
+
+/**
+ * Type: FetchStats
+ * ----------------
+ * Counts accumulated across every fetch.
+ */
+struct FetchStats {
+  size_t numRetries;
+  size_t numTimeouts;     // attempts abandoned at their deadline
+  size_t numRefused;      // attempts not started because their server already had too many running
+  size_t numHedges;
+  size_t numHedgeWins;    // hedges that finished before the attempt they hedged
+  size_t numPastDeadline; // articles dropped because the crawl deadline had passed
+};
+
+class ArticleFetcher {
+ public:
+  enum Outcome { kSucceeded, kFailed, kPastDeadline };
+  typedef std::chrono::steady_clock::time_point time_point;
+
+  static const size_t kMaxAttemptsPerServer = 4;
+
+  ArticleFetcher(const FetchPolicy& policy);
+
+/**
+ * Waits for every attempt still running in the background.
+ */
+  ~ArticleFetcher();
+
+/**
+ * Method: setDeadline
+ * -------------------
+ * Sets the moment after which no attempt may start or keep running.  There
+ * is no deadline unless one is set.
+ */
+  void setDeadline(time_point deadline) { this->deadline = deadline; }
+  bool isPastDeadline() const { return std::chrono::steady_clock::now() >= deadline; }
+
+/**
+ * Method: fetch
+ * -------------
+ * Downloads and parses the article at the URL, retrying as the policy
+ * allows.  On success, document is left pointing to the parsed document.
+ * Every attempt made on a thread of its own shares ownership of the permit
+ * (if one is supplied), so it's only released once they've all finished.
+ * Safe to call from any number of threads.
+ */
+  Outcome fetch(const std::string& url, std::shared_ptr<HTMLDocument>& document,
+                const std::shared_ptr<ConcurrencyPermit>& permit = nullptr);
+
+  FetchStats getStats() const;
+
+ private:
+  struct Shared;           // latencies and counts, shared with attempts that outlive their fetch
+  struct Attempts;         // the attempts in flight for one try at a URL
+
+  FetchPolicy policy;
+  time_point deadline;
+  std::shared_ptr<Shared> shared;
+
+  enum Attempt { kAttemptSucceeded, kAttemptFailed, kAttemptTimedOut };
+  Attempt tryOnce(const std::string& url, const std::string& server, std::shared_ptr<HTMLDocument>& document,
+                  const std::shared_ptr<ConcurrencyPermit>& permit);
+  static bool launch(const std::shared_ptr<Attempts>& attempts, const std::shared_ptr<Shared>& shared,
+                     const std::shared_ptr<ConcurrencyPermit>& permit, const std::string& url,
+                     const std::string& server, int which);
+
+  ArticleFetcher(const ArticleFetcher& original) = delete;
+  ArticleFetcher& operator=(const ArticleFetcher& rhs) = delete;
+};
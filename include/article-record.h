@@ -0,0 +1,58 @@
+/**
+ * File: article-record.h
+ * ----------------------
+ * Exports the binary encoding shared by everything that writes analyzed
+ * articles to disk: the crawl checkpoint and the raw map's spill runs.
+ *
+ * An article record is the article's URL and title followed by its token
+ * bag (the number of distinct tokens, then each token and its count), with
+ * every length and count a varint.  Records carry no framing of their own;
+ * each file format wraps them in whatever header it needs.
+ */
+
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "article.h"
+#include "token-bag.h"
+#include "word-tokenizer.h"
+
+/**
+ * Functions: appendUint32, readUint32
+ * -----------------------------------
+ * Write and read a fixed-width, little-endian 32-bit integer.
+ */
+void appendUint32(std::string& out, uint32_t value);
+uint32_t readUint32(const char *data);
+
+/**
+ * Functions: appendVarint, readVarint, appendString, readString
+ * -------------------------------------------------------------
+ * Write and read a varint, or a varint-prefixed string.  The readers
+ * advance data past what they read, and return false (leaving the value
+ * unspecified) if it runs past end.  readString's view points into the
+ * buffer being read.
+ */
+void appendVarint(std::string& out, uint64_t value);
+bool readVarint(const char *& data, const char *end, uint64_t& value);
+void appendString(std::string& out, token_view str);
+bool readString(const char *& data, const char *end, token_view& str);
+
+/**
+ * Function: appendArticleRecord
+ * -----------------------------
+ * Appends the encoding of the article and its token bag to out.
+ */
+void appendArticleRecord(std::string& out, const Article& article, const TokenBag& bag);
+
+/**
+ * Function: readArticleRecord
+ * ---------------------------
+ * Decodes one article record starting at data, advancing data past it.
+ * Returns false if the record is truncated or malformed.  scratch is only
+ * working space, passed in so that reading many records doesn't allocate
+ * for each one.
+ */
+bool readArticleRecord(const char *& data, const char *end, Article& article, TokenBag& bag,
+                       std::vector<token_view>& scratch);
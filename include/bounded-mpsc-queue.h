@@ -0,0 +1,183 @@
+/**
+ * File: bounded-mpsc-queue.h
+ * --------------------------
+ * Exports BoundedMpscQueue, a fixed-capacity queue with any number of
+ * producers and a single consumer, after Vyukov's bounded MPMC queue.  A
+ * producer claims a slot with a CAS and fills it in place; nothing on the
+ * producer side takes a lock unless the consumer is asleep.  Slots are
+ * reused, so an element type that holds strings stops allocating once each
+ * slot's strings have grown to fit.
+ *
+ * The consumer never polls: when there's nothing to pop it parks on a
+ * condition variable, and the producer that makes the queue non-empty again
+ * wakes it.  The consumer can also report how much of what it has popped is
+ * fully dealt with (written out, say), which anyone can wait for.
+ */
+
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <condition_variable>
+
+template <typename T>
+class BoundedMpscQueue {
+ public:
+/**
+ * Constructs an empty queue with the given capacity, which must be a power of two.
+ */
+  BoundedMpscQueue(size_t capacity):
+    capacity(capacity), slots(new Slot[capacity]), pushPosition(0), popPosition(0), numDone(0),
+    sleeping(false), closed(false) {
+    for (size_t i = 0; i < capacity; i++) slots[i].sequence = i;
+  }
+
+/**
+ * Method: push
+ * ------------
+ * Claims the next slot and calls fill on the element in it.  If the queue
+ * is full, either waits for the consumer to make room or, unless
+ * waitForRoom is set, returns false without calling fill.
+ */
+  template <typename Fill>
+  bool push(bool waitForRoom, const Fill& fill) {
+    size_t position = pushPosition.load(std::memory_order_relaxed);
+    Slot *slot;
+    while (true) {
+      slot = &slots[position & (capacity - 1)];
+      size_t sequence = slot->sequence.load(std::memory_order_acquire);
+      if (sequence == position) {
+        if (pushPosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) break;
+      } else if (sequence < position) {
+        // The queue has wrapped around onto an element the consumer hasn't popped yet
+        if (!waitForRoom) return false;
+        std::this_thread::yield();
+        position = pushPosition.load(std::memory_order_relaxed);
+      } else {
+        position = pushPosition.load(std::memory_order_relaxed);
+      }
+    }
+    fill(slot->element);
+    // Publishing and then checking for a sleeping consumer are both
+    // sequentially consistent, as is the consumer's announcing that it's
+    // about to sleep and then checking for elements, so either it sees this
+    // element or we see that it's asleep and wake it
+    slot->sequence.store(position + 1);
+    if (sleeping.load()) {
+      std::lock_guard<std::mutex> lg(lock);
+      nonEmpty.notify_one();
+    }
+    return true;
+  }
+
+/**
+ * Method: pop
+ * -----------
+ * Consumer only.  Calls consume on up to maxCount elements, in the order
+ * they were pushed, handing each slot back as soon as consume returns.
+ * Returns how many there were.
+ */
+  template <typename Consume>
+  size_t pop(size_t maxCount, const Consume& consume) {
+    size_t count = 0;
+    while (count < maxCount && isReady()) {
+      Slot& slot = slots[popPosition & (capacity - 1)];
+      consume(slot.element);
+      slot.sequence.store(popPosition + capacity, std::memory_order_release);
+      popPosition++;
+      count++;
+    }
+    return count;
+  }
+
+/**
+ * Method: wait
+ * ------------
+ * Consumer only.  Blocks until there's something to pop, or the queue is
+ * closed.  Returns false once the queue is closed and empty.
+ */
+  bool wait() {
+    return waitUntil(std::chrono::steady_clock::time_point::max());
+  }
+
+/**
+ * Method: waitUntil
+ * -----------------
+ * Like wait, but also gives up at the supplied deadline.  Returns false if
+ * there's still nothing to pop.
+ */
+  bool waitUntil(std::chrono::steady_clock::time_point deadline) {
+    std::unique_lock<std::mutex> ul(lock);
+    sleeping.store(true);
+    while (!isReady() && !closed) {
+      if (deadline == std::chrono::steady_clock::time_point::max()) {
+        nonEmpty.wait(ul);
+      } else if (nonEmpty.wait_until(ul, deadline) == std::cv_status::timeout) {
+        break;
+      }
+    }
+    sleeping.store(false, std::memory_order_relaxed);
+    return isReady();
+  }
+
+/**
+ * Method: close
+ * -------------
+ * Wakes the consumer for good: from now on, wait returns as soon as the
+ * queue is empty.
+ */
+  void close() {
+    std::lock_guard<std::mutex> lg(lock);
+    closed = true;
+    nonEmpty.notify_one();
+  }
+
+/**
+ * Method: markDone
+ * ----------------
+ * Consumer only.  Reports that everything popped so far has been dealt with.
+ */
+  void markDone() {
+    std::lock_guard<std::mutex> lg(lock);
+    numDone = popPosition;
+    done.notify_all();
+  }
+
+/**
+ * Method: waitUntilDone
+ * ---------------------
+ * Returns once everything pushed before the call has been popped and marked done.
+ */
+  void waitUntilDone() {
+    size_t target = pushPosition.load();
+    std::unique_lock<std::mutex> ul(lock);
+    done.wait(ul, [this, target] { return numDone >= target; });
+  }
+
+ private:
+  struct Slot {
+    std::atomic<size_t> sequence; // == position + 1 once filled, position + capacity once popped
+    T element;
+  };
+
+  const size_t capacity;
+  std::unique_ptr<Slot[]> slots;
+  std::atomic<size_t> pushPosition;
+  size_t popPosition;               // only ever touched by the consumer...
+  size_t numDone;                   // ...and this only under lock
+  std::atomic<bool> sleeping;       // set while the consumer is (about to be) parked on nonEmpty
+  bool closed;
+  std::mutex lock;
+  std::condition_variable nonEmpty;
+  std::condition_variable done;
+
+  bool isReady() const {
+    return slots[popPosition & (capacity - 1)].sequence.load() == popPosition + 1;
+  }
+
+  BoundedMpscQueue(const BoundedMpscQueue& original) = delete;
+  BoundedMpscQueue& operator=(const BoundedMpscQueue& rhs) = delete;
+};
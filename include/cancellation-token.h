@@ -0,0 +1,28 @@
+/**
+ * File: cancellation-token.h
+ * --------------------------
+ * Exports the CancellationToken class, a handle on a shared "cancelled"
+ * flag.  Copies of a token share the flag, so a group of tasks scheduled
+ * with copies of one token is cancelled all at once by cancelling any of
+ * them.  A ThreadPool drops queued thunks whose token has been cancelled
+ * without running them, and a running thunk can poll its token at points
+ * where it's safe to give up early.
+ *
+ * cancel is a single lock-free store, so it may be called from a signal
+ * handler.
+ */
+
+#pragma once
+#include <atomic>
+#include <memory>
+
+class CancellationToken {
+ public:
+  CancellationToken(): cancelled(std::make_shared<std::atomic<bool>>(false)) {}
+
+  void cancel() const { cancelled->store(true); }
+  bool isCancelled() const { return cancelled->load(); }
+
+ private:
+  std::shared_ptr<std::atomic<bool>> cancelled;
+};
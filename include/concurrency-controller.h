@@ -0,0 +1,118 @@
+/**
+ * File: concurrency-controller.h
+ * ------------------------------
+ * Exports a ConcurrencyController, which caps how many downloads may be in
+ * flight at once and moves that cap at runtime, AIMD style, according to
+ * how the upstreams are coping.
+ *
+ * Completions are judged in windows of roughly one limit's worth.  A window
+ * is congested when too many of its downloads failed, or when its mean
+ * latency has climbed well past the best window mean seen so far.  (If
+ * latency stays that high even at the lower bound, the upstream itself has
+ * slowed down, and that window's mean becomes the new best.)  A
+ * congested window multiplies the limit by kBackoff.  Otherwise, if the
+ * limit was actually reached during the window, the limit grows: it doubles
+ * per window until the first congestion (slow start) and grows by one per
+ * window after that.  The limit always stays between the bounds supplied
+ * to the constructor.
+ */
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <condition_variable>
+
+/**
+ * Type: ConcurrencyStats
+ * ----------------------
+ * What the controller settled on, and the range it moved through on the way.
+ */
+struct ConcurrencyStats {
+  size_t finalLimit;
+  size_t lowestLimit;
+  size_t highestLimit;
+  size_t numIncreases;
+  size_t numDecreases;
+  double meanLatency; // in seconds, over successful downloads
+};
+
+class ConcurrencyController {
+ public:
+  static constexpr double kBackoff = 0.7;
+  static constexpr double kLatencyTolerance = 2.0; // congested once latency is this multiple of the best seen
+  static constexpr double kMaxFailureFraction = 0.25;
+
+/**
+ * Constructor: ConcurrencyController
+ * ----------------------------------
+ * Constructs a controller whose limit starts at minLimit and stays within
+ * [minLimit, maxLimit].  With minLimit == maxLimit, the limit is fixed.
+ */
+  ConcurrencyController(size_t minLimit, size_t maxLimit);
+
+/**
+ * Methods: acquire, release
+ * -------------------------
+ * acquire blocks until fewer than limit downloads are in flight, and then
+ * counts the caller's; release reports how the caller's download went and
+ * how long it took.
+ */
+  void acquire();
+  void release(double latency, bool succeeded);
+
+  size_t getLimit() const;
+  ConcurrencyStats getStats() const;
+
+ private:
+  const size_t minLimit;
+  const size_t maxLimit;
+  double limit;
+  size_t inFlight;
+  bool slowStart;
+
+  double totalLatency;
+  size_t numSucceeded;
+
+  size_t windowCompletions;
+  size_t windowFailures;
+  double windowLatency;   // summed over the window's successes
+  bool windowSaturated;   // whether anyone had to wait, or filled the last slot, during this window
+
+  double bestLatency;     // lowest window mean so far, or 0 if there hasn't been one
+
+  size_t lowestLimit;
+  size_t highestLimit;
+  size_t numIncreases;
+  size_t numDecreases;
+
+  mutable std::mutex m;
+  std::condition_variable cv;
+
+  void endWindow();
+
+  ConcurrencyController(const ConcurrencyController& original) = delete;
+  ConcurrencyController& operator=(const ConcurrencyController& rhs) = delete;
+};
+
+/**
+ * Class: ConcurrencyPermit
+ * ------------------------
+ * Holds one of a ConcurrencyController's slots for the lifetime of the
+ * permit and times it.  The download is taken to have failed unless
+ * markSucceeded is called before the permit goes away.
+ */
+class ConcurrencyPermit {
+ public:
+  explicit ConcurrencyPermit(ConcurrencyController& controller);
+  ~ConcurrencyPermit();
+  void markSucceeded() { succeeded = true; }
+
+ private:
+  ConcurrencyController& controller;
+  uint64_t start;
+  bool succeeded;
+
+  ConcurrencyPermit(const ConcurrencyPermit& original) = delete;
+  ConcurrencyPermit& operator=(const ConcurrencyPermit& rhs) = delete;
+};
@@ -0,0 +1,100 @@
+/**
+ * File: crawl-checkpoint.h
+ * ------------------------
+ * Exports the CrawlCheckpoint class, an append-only log of every article a
+ * crawl has finished analyzing, so that a crawl that crashes or is killed
+ * partway through can be resumed without downloading those articles again.
+ *
+ * The log starts with an eight-byte magic number, followed by one record per
+ * article:
+ *
+ *   <payload length: 4 bytes> <low 32 bits of the payload's hash64: 4 bytes> <payload>
+ *
+ * where the payload is the article's URL and title and then its token bag
+ * (the number of distinct tokens, then each token and its count), with every
+ * length and count a varint.  Integers in the header are little-endian.  A
+ * crash can leave a torn record at the end; loading stops at the first
+ * record that's short or fails its checksum, and the log is truncated there
+ * before anything more is appended.  A log whose magic number doesn't
+ * match (one written in an older format, say) isn't resumed at all.
+ *
+ * Download workers mustn't wait on each other to checkpoint, so each record
+ * is encoded by the worker itself into a slot of a BoundedMpscQueue (as
+ * NewsAggregatorLog's messages are), and a background thread appends the
+ * records in batches and fsyncs at most every quarter of a second, sleeping
+ * while there's nothing to append or sync.
+ * Records are never dropped: if the queue fills, workers wait for the writer
+ * to catch up.  If the log can't be written, though, checkpointing stops
+ * for good, so nothing is ever appended after a torn record; the log still
+ * resumes up to the last complete one.
+ */
+
+#pragma once
+#include <cstddef>
+#include <string>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <functional>
+#include "article.h"
+#include "token-bag.h"
+#include "bounded-mpsc-queue.h"
+
+class CrawlCheckpoint {
+ public:
+  CrawlCheckpoint(const std::string& filename);
+
+/**
+ * Appends everything still queued, fsyncs, and closes the log.
+ */
+  ~CrawlCheckpoint();
+
+/**
+ * Method: open
+ * ------------
+ * When resuming, reads the log back first, passing each complete record to
+ * handler (which may move the bag away) in the order it was written, and
+ * then opens the log to append to it; otherwise, starts a new log,
+ * replacing any old one.  A missing log
+ * resumes as an empty one.  Returns false if the log can't be read or
+ * written, or isn't a checkpoint log at all.
+ */
+  bool open(bool resume, const std::function<void(const Article&, TokenBag&)>& handler);
+
+/**
+ * Method: recordArticle
+ * ---------------------
+ * Queues a record of the article and its token bag.  Safe to call from any
+ * number of threads, which never wait on each other (a thread only takes a
+ * lock to wake the writer).
+ */
+  void recordArticle(const Article& article, const TokenBag& bag);
+
+  size_t getNumResumed() const { return numResumed; }
+  size_t getNumRecorded() const { return numWritten; }
+
+/**
+ * Method: getWriteError
+ * ---------------------
+ * Returns the errno of the write or sync that stopped checkpointing, or 0
+ * if the log is still being written.
+ */
+  int getWriteError() const { return writeError; }
+
+ private:
+  static const size_t kQueueCapacity = 1024; // must be a power of two
+
+  std::string filename;
+  int fd;
+  size_t numResumed;
+  BoundedMpscQueue<std::string> queue; // records are encoded in place, so a reused slot doesn't allocate
+  std::atomic<size_t> numWritten;
+  std::atomic<int> writeError;
+  std::thread writer;
+
+  bool load(const std::function<void(const Article&, TokenBag&)>& handler, size_t& validLength);
+  void runWriter();
+
+  CrawlCheckpoint(const CrawlCheckpoint& original) = delete;
+  CrawlCheckpoint& operator=(const CrawlCheckpoint& rhs) = delete;
+};
@@ -0,0 +1,100 @@
+/**
+ * File: crawl-corpus.h
+ * --------------------
+ * Exports the CrawlCorpus class, which captures what a crawl downloaded so
+ * the crawl can be replayed later without touching the network.
+ *
+ * A corpus is a directory of content-addressed objects plus a manifest.
+ * Each manifest line is "<hash>\t<url>": the hash names the object holding
+ * what the URL parsed to, or is "-" if the download failed.  Objects are
+ * sequences of NUL-terminated fields: (url, title) pairs for feed lists and
+ * feeds, and tokens for articles.  Identical content (the same story served
+ * under two URLs, say) is stored once.
+ *
+ * RSSFeedList, RSSFeed and HTMLDocument keep their raw bodies to themselves,
+ * so a corpus holds what each document parsed to rather than its markup.
+ * Replays still exercise everything from token analysis onward.
+ *
+ * When replaying, objects are mapped into memory rather than read, and the
+ * token views handed back point straight into the mappings, which stay in
+ * place for the lifetime of the CrawlCorpus.
+ */
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <fstream>
+#include <unordered_map>
+#include "article.h"
+#include "arena.h"
+#include "word-tokenizer.h"
+
+class CrawlCorpus {
+ public:
+  enum Mode { kRecord, kReplay };
+
+  CrawlCorpus(const std::string& directory, Mode mode): directory(directory), mode(mode), numEntries(0) {}
+  ~CrawlCorpus();
+
+/**
+ * Method: open
+ * ------------
+ * When recording, creates the directory (if need be) and opens its manifest
+ * for appending; when replaying, reads the manifest in.  Returns false if
+ * either can't be done.
+ */
+  bool open();
+
+  bool isReplaying() const { return mode == kReplay; }
+  size_t getNumEntries() const { return numEntries; }
+
+/**
+ * Methods: recordFeedList, recordFeed, recordDocument, recordFailure
+ * ------------------------------------------------------------------
+ * Store what the URL parsed to (or that it couldn't be downloaded) and
+ * append it to the manifest.  Safe to call from any number of threads.  The
+ * manifest is flushed line by line, so a crawl that dies partway through
+ * still leaves a usable corpus behind.
+ */
+  void recordFeedList(const std::string& url, const std::map<std::string, std::string>& feeds);
+  void recordFeed(const std::string& url, const std::vector<Article>& articles);
+  void recordDocument(const std::string& url, const std::vector<std::string>& tokens);
+  void recordFailure(const std::string& url);
+
+/**
+ * Methods: replayFeedList, replayFeed, replayDocument
+ * ---------------------------------------------------
+ * Load what the URL parsed to when it was recorded, returning false if it
+ * failed to download then or was never recorded at all.  Safe to call from
+ * any number of threads.
+ */
+  bool replayFeedList(const std::string& url, std::map<std::string, std::string>& feeds) const;
+  bool replayFeed(const std::string& url, std::vector<Article>& articles) const;
+  bool replayDocument(const std::string& url, ArenaVector<token_view>& tokens) const;
+
+ private:
+  std::string directory;
+  Mode mode;
+  size_t numEntries;
+
+  std::ofstream manifest;                           // recording only
+  std::mutex manifestLock;
+  std::unordered_map<std::string, std::string> hashes; // replaying only: url -> object hash
+
+  struct Mapping {
+    const char *data;
+    size_t size;
+  };
+  mutable std::unordered_map<std::string, Mapping> mappings; // object hash -> where it's mapped
+  mutable std::mutex mappingsLock;
+
+  void record(const std::string& url, const std::string& contents);
+  bool lookup(const std::string& url, token_view& contents) const;
+
+  CrawlCorpus(const CrawlCorpus& original) = delete;
+  CrawlCorpus& operator=(const CrawlCorpus& rhs) = delete;
+};
@@ -0,0 +1,100 @@
+/**
+ * File: index-segment.h
+ * ---------------------
+ * Exports the classes that write and read index segments.  A segment is
+ * everything one crawl (typically one shard of a larger crawl) analyzed,
+ * stored so that segments from several crawls can be merged into a single
+ * index and queried by a later aggregate without crawling again.
+ *
+ * A segment is an eight-byte magic number followed by a sorted run of its
+ * articles (see sorted-run.h).  Since every segment is sorted by the same
+ * (server, title) key, merging any number of them is a single streaming
+ * k-way merge, and versions of one article crawled by different shards are
+ * combined exactly as a single crawl would have combined them.
+ *
+ * Segments are written to a temporary file beside the real one and renamed
+ * into place once complete, so a reader never sees a partial segment.
+ */
+
+#pragma once
+#include <cstddef>
+#include <string>
+#include <memory>
+#include "sorted-run.h"
+
+class IndexSegmentWriter {
+ public:
+  IndexSegmentWriter(const std::string& filename);
+
+/**
+ * Discards the segment unless it was committed.
+ */
+  ~IndexSegmentWriter();
+
+/**
+ * Method: open
+ * ------------
+ * Starts a new segment.  Returns false if it can't be created.
+ */
+  bool open();
+
+/**
+ * Method: append
+ * --------------
+ * Adds an article to the segment.  Articles must be appended in ascending
+ * key order, and each key only once.
+ */
+  bool append(const ArticleKey& key, const Article& article, const TokenBag& bag);
+
+/**
+ * Method: commit
+ * --------------
+ * Writes out the rest of the segment, syncs it, and renames it into place,
+ * replacing any old segment of the same name.
+ */
+  bool commit();
+
+  size_t getNumArticles() const { return writer ? writer->getNumEntries() : 0; }
+
+ private:
+  std::string filename;
+  std::string tempFilename;
+  int fd;
+  std::unique_ptr<SortedRunWriter> writer;
+
+  IndexSegmentWriter(const IndexSegmentWriter& original) = delete;
+  IndexSegmentWriter& operator=(const IndexSegmentWriter& rhs) = delete;
+};
+
+class IndexSegmentReader : public SortedSource {
+ public:
+  IndexSegmentReader(const std::string& filename);
+  ~IndexSegmentReader();
+
+/**
+ * Method: open
+ * ------------
+ * Returns false if the file can't be read or isn't a segment.
+ */
+  bool open();
+
+/**
+ * Method: next
+ * ------------
+ * Advances to the segment's next article.  A segment that's been cut short
+ * reads as though it ended at its last complete article.
+ */
+  bool next() { return reader->next(); }
+  const ArticleKey& key() const { return reader->key(); }
+  const Article& article() const { return reader->article(); }
+  const TokenBag& bag() const { return reader->bag(); }
+  void take(Article& article, TokenBag& bag) { reader->take(article, bag); }
+
+ private:
+  std::string filename;
+  int fd;
+  std::unique_ptr<SortedRunReader> reader;
+
+  IndexSegmentReader(const IndexSegmentReader& original) = delete;
+  IndexSegmentReader& operator=(const IndexSegmentReader& rhs) = delete;
+};
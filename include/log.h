@@ -2,15 +2,39 @@
  * File: log.h
  * -----------
  * Exports a class that's dedicated to printing out structured info, warning, and error messages.
+ *
+ * The per-feed and per-article messages are noted from every download worker,
+ * so rather than having all of them take turns on the console, each note
+ * copies its kind and strings into a slot of a bounded, lock-free queue, and
+ * a background thread formats and writes them in batches, sleeping while
+ * there's nothing to write.  If the queue ever fills,
+ * informational messages are dropped (and counted) rather than stalling the
+ * workers; failures always wait for room.  The one-off summary messages are
+ * written directly, after everything queued ahead of them has been flushed.
  */
 
 #pragma once
+#include <cstddef>
 #include <string>
+#include <memory>
+#include <atomic>
+#include <thread>
 #include "article.h"
+#include "bounded-mpsc-queue.h"
 
 class NewsAggregatorLog {
  public:
-  NewsAggregatorLog(bool verbose): verbose(verbose) {} 
+  NewsAggregatorLog(bool verbose);
+
+/**
+ * Flushes any queued messages and stops the background writer.
+ */
+  ~NewsAggregatorLog();
+
+/**
+ * Returns once every message noted so far has been written out.
+ */
+  void flush() const;
   
   // Prints out the message and executable with a message on available usage flags.
   static void printUsage(const std::string& message, const std::string& executableName);
@@ -47,9 +71,135 @@ class NewsAggregatorLog {
 
   // Log for when we failed to parse an article
   void noteSingleArticleDownloadFailure(const Article& article) const;
+
+  // Log for when we drop an article because the crawl deadline passed before it was downloaded
+  void noteSingleArticleDownloadDropped(const Article& article) const;
+
+  // Log for when we drop an article because it's a near-duplicate of one already indexed
+  void noteSingleArticleNearDuplicateSkipped(const Article& article) const;
+
+  // Log for how many near-duplicate clusters and duplicates were found
+  void noteNearDuplicateSummary(size_t numClusters, size_t numDuplicates) const;
+
+  // Log for how many tokens the analyzer dropped or stemmed across all articles
+  void noteAnalysisSummary(size_t numTokens, size_t numTooShort, size_t numStopWords, size_t numStemmed) const;
+
+  // Log for the worker counts the crawl ran with, and where the article download limit ended up
+  void noteConcurrencySummary(size_t numFeedWorkers, size_t numAnalysisWorkers, size_t finalLimit,
+                              size_t lowestLimit, size_t highestLimit, size_t numDecreases, double meanLatency) const;
+
+  // Log for how often article downloads were retried, timed out, turned away by a swamped server or
+  // hedged, and how many feeds and articles were dropped at the crawl deadline
+  void noteFetchSummary(size_t numRetries, size_t numTimeouts, size_t numRefused, size_t numHedges,
+                        size_t numHedgeWins, size_t numFeedsDropped, size_t numArticlesDropped) const;
+
+  // Log for when a recrawl couldn't read the feed list (the current index stays)
+  void noteRecrawlFeedListFailure(const std::string& feedListURI) const;
+
+  // Log for when a recrawl has published (or found no need for) a new index generation
+  void noteRecrawlEnd(size_t numUpdated, double elapsed) const;
+
+  // Log for how many articles (and article URLs) a recrawl evicted for not being listed lately
+  void noteStaleArticlesEvicted(size_t numArticles, size_t numURLs, size_t retainCrawls) const;
+
+  // Log for when the crawl was cancelled partway, and how many queued downloads were dropped
+  void noteCrawlCancelled(size_t numFeedsDropped, size_t numArticlesDropped) const;
+
+  // Log for when the stop words file can't be opened
+  void noteStopWordsFileFailureAndExit(const std::string& filename) const;
+
+  // Log for when the feed weights file can't be opened or has a malformed line
+  void noteFeedWeightsFileFailureAndExit(const std::string& filename) const;
+
+  // Log for when the trace file can't be written (the crawl itself still succeeded)
+  void noteTraceFileFailure(const std::string& filename) const;
+
+  // Log for when the trace file has been written
+  void noteTraceWritten(const std::string& filename, size_t numSpans) const;
+
+  // Log for when the checkpoint file can't be read or written
+  void noteCheckpointFailureAndExit(const std::string& filename) const;
+
+  // Log for when writing the checkpoint file failed partway through the crawl, which stops checkpointing
+  void noteCheckpointWriteFailure(const std::string& filename, size_t numRecorded, int error) const;
+
+  // Log for how many articles were resumed from the checkpoint file
+  void noteCheckpointResumed(const std::string& filename, size_t numArticles) const;
+
+  // Log for when part of the raw index can't be spilled to disk
+  void noteRawMapSpillFailureAndExit(const std::string& directory) const;
+
+  // Log for how much of the raw index was spilled to disk to stay under the memory budget
+  void noteRawMapSpillSummary(size_t numRuns, size_t numArticles, size_t numBytes) const;
+
+  // Log for how much memory the published index's articles and posting lists take up
+  void noteIndexSummary(size_t numBytes) const;
+
+  // Log for how many of the feed list's feeds belong to this shard
+  void noteShardFeeds(size_t shardIndex, size_t numShards, size_t numFeedsInShard, size_t numFeeds) const;
+
+  // Log for when the index segment can't be written
+  void noteSegmentFailureAndExit(const std::string& filename) const;
+
+  // Log for when the index segment has been written
+  void noteSegmentWritten(const std::string& filename, size_t numArticles) const;
+
+  // Log for when the --index file can't be read as an index segment
+  void noteIndexFileFailureAndExit(const std::string& filename) const;
+
+  // Log for when the index has been loaded from an index segment
+  void noteIndexLoaded(const std::string& filename, size_t numArticles) const;
+
+  // Log for when a --record or --replay corpus directory can't be opened
+  void noteCorpusFailureAndExit(const std::string& directory) const;
+
+  // Log for when a recorded corpus is complete
+  void noteCorpusRecorded(const std::string& directory, size_t numEntries) const;
+
+  // Log for when a batch queries or results file can't be opened
+  void noteBatchQueryFileFailureAndExit(const std::string& filename) const;
+
+  // Log for the throughput and latency percentiles (in microseconds) of a batch of queries
+  void noteBatchQueryStats(size_t numQueries, double seconds, double p50, double p90,
+                           double p99, double max) const;
+
+  // Log for when the query server can't listen on its endpoint
+  void noteQueryServerFailureAndExit(const std::string& endpoint) const;
+
+  // Log for when the query server is ready to accept connections
+  void noteQueryServerListening(const std::string& endpoint) const;
+
+  // Log for how often queries were answered from the query cache
+  void noteQueryCacheStats(size_t hits, size_t misses) const;
   
  private:
+  enum Kind {
+    kFullRSSFeedListDownloadEnd, kAllFeedsHaveBeenScheduledForFeedList, kSingleFeedDownloadBeginning,
+    kSingleFeedDownloadSkipped, kSingleFeedDownloadFailure, kAllArticlesHaveBeenScheduledForFeed,
+    kAllRSSFeedsDownloadEnd, kSingleArticleDownloadBeginning, kSingleArticleDownloadSkipped,
+    kSingleArticleDownloadFailure, kSingleArticleDownloadDropped, kSingleArticleNearDuplicateSkipped
+  };
+
+  // A queued message: what kind it is and the (at most two) strings it mentions.
+  // The strings in each slot are reused, so once they've grown to fit, noting a
+  // message doesn't allocate.
+  struct Record {
+    Kind kind;
+    std::string first;
+    std::string second;
+  };
+
+  static const size_t kQueueCapacity = 4096; // must be a power of two
+
   bool verbose;
+  mutable BoundedMpscQueue<Record> queue;
+  mutable std::atomic<size_t> numDropped;
+  std::thread writer;
+
+  void enqueue(Kind kind, const std::string& first, const std::string& second = "") const;
+  void runWriter();
+  static bool isError(Kind kind);
+  static void format(const Record& record, std::string& out);
   NewsAggregatorLog(const NewsAggregatorLog& original) = delete;
   NewsAggregatorLog& operator=(const NewsAggregatorLog& rhs) = delete;
 };
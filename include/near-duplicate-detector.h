@@ -0,0 +1,107 @@
+/**
+ * File: near-duplicate-detector.h
+ * -------------------------------
+ * Exports a NearDuplicateDetector, which clusters articles whose bodies are
+ * nearly identical (the same wire story syndicated across hosts, say, or
+ * republished under a lightly edited title).  Each article is reduced to a
+ * 64-bit SimHash of its tokens; two articles are near-duplicates when their
+ * fingerprints differ in at most kMaxDistance bits.
+ *
+ * Candidates are found by splitting fingerprints into kNumBands 16-bit bands.
+ * With kMaxDistance < kNumBands, any two near-duplicates agree exactly on at
+ * least one band, so it's enough to compare against fingerprints that share
+ * a band.  The band tables are split across kNumShards independently locked
+ * shards, and a lookup only locks the (at most kNumBands) shards its own
+ * bands hash to, so unrelated articles never contend.
+ *
+ * A cluster is represented by the smallest key that has joined it so far,
+ * so which article represents it doesn't depend on which one arrived first.
+ */
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <utility>
+#include <unordered_map>
+#include "token-bag.h"
+
+class NearDuplicateDetector {
+ public:
+  typedef std::pair<std::string, std::string> key_t; // (server, title)
+
+  static const size_t kMaxDistance = 3;
+  static const size_t kNumBands = 4;
+  static const size_t kNumShards = 64;
+
+/**
+ * Articles with fewer distinct tokens than this aren't fingerprinted, since
+ * a handful of tokens doesn't say much about whether two bodies match.
+ */
+  static const size_t kMinDistinctTokens = 32;
+
+  NearDuplicateDetector(): numClusters(0), numDuplicates(0) {}
+
+/**
+ * Method: fingerprint
+ * -------------------
+ * Returns the SimHash of the supplied tokens, weighting each distinct token
+ * by the number of times it appears.
+ */
+  static uint64_t fingerprint(const TokenBag& tokens);
+
+/**
+ * Method: findOrInsert
+ * --------------------
+ * Looks for a previously registered fingerprint within kMaxDistance bits of
+ * the supplied one.  If there is one, canonical is set to the key of that
+ * cluster's representative (as it was before this call) and true is
+ * returned; if the supplied key is smaller, it takes canonical's place as
+ * the representative.  Otherwise the supplied fingerprint starts a new
+ * cluster, with the supplied key as its representative, and false is
+ * returned.  Check-and-insert is atomic with respect to any other
+ * fingerprint that could be a near-duplicate.
+ */
+  bool findOrInsert(uint64_t fingerprint, const key_t& key, key_t& canonical);
+
+/**
+ * Method: clear
+ * -------------
+ * Forgets every cluster, so the detector can be rebuilt from scratch.
+ * Mustn't be called while another thread is looking anything up.
+ */
+  void clear();
+
+  size_t getNumClusters() const { return numClusters; }
+  size_t getNumDuplicates() const { return numDuplicates; }
+
+ private:
+  // Shared by the entries a cluster has in each band.  Two lookups can find
+  // the same cluster through bands in different shards, so the representative
+  // has a lock of its own, always taken inside the shard locks.
+  struct Cluster {
+    std::mutex lock;
+    key_t representative;
+  };
+
+  struct Entry {
+    uint64_t fingerprint;
+    std::shared_ptr<Cluster> cluster;
+  };
+
+  struct Shard {
+    std::mutex lock;
+    std::unordered_map<uint32_t, std::vector<Entry>> buckets; // keyed by band number and band value
+  };
+
+  Shard shards[kNumShards];
+  std::atomic<size_t> numClusters;
+  std::atomic<size_t> numDuplicates;
+
+  NearDuplicateDetector(const NearDuplicateDetector& original) = delete;
+  NearDuplicateDetector& operator=(const NearDuplicateDetector& rhs) = delete;
+};
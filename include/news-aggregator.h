@@ -14,17 +14,72 @@
 #include <set>
 #include <mutex>
 #include <memory>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
 
 #include "log.h"
 #include "rss-index.h"
 #include "html-document.h"
 #include "article.h"
+#include "arena.h"
+#include "token-bag.h"
+#include "near-duplicate-detector.h"
+#include "query-cache.h"
+#include "text-normalizer.h"
+#include "token-analyzer.h"
+#include "crawl-corpus.h"
+#include "concurrency-controller.h"
+#include "article-fetcher.h"
+#include "cancellation-token.h"
+#include "crawl-checkpoint.h"
+#include "raw-map-spill.h"
+#include "index-segment.h"
+#include "socket-utils.h"
 #include "thread-pool-release.h"
 #include "thread-pool.h"
 
-namespace tp = release;
+namespace tp = develop; // the release pool has no bounded queues
 using tp::ThreadPool;
 
+/**
+ * Type: NewsAggregatorOptions
+ * ---------------------------
+ * Bundles everything createNewsAggregator pulls out of the command line.
+ */
+struct NewsAggregatorOptions {
+  std::string rssFeedListURI;
+  bool verbose = true;
+  bool keepNearDuplicates = false; // if false, only one article per near-duplicate cluster is indexed
+  std::string queriesFile;         // if nonempty, queries are read from here rather than the console
+  std::string resultsFile;         // where batch query results go (stdout if empty)
+  std::string serveEndpoint;       // if nonempty, queries are answered over this socket (port or path)
+  bool stripAccents = false;       // if true, accented letters index (and are queried) as their base letters
+  std::string stopWordsFile;       // if nonempty, replaces the built-in stop word list
+  bool removeStopWords = true;
+  bool stem = true;
+  size_t minTokenLength = TokenAnalyzer::kDefaultMinLength;
+  std::string traceFile;           // if nonempty, a Chrome trace of the (first) crawl is written here
+  std::string recordDirectory;     // if nonempty, everything the crawl downloads is captured here...
+  std::string replayDirectory;     // ...so that a later crawl can load it from here instead of the network
+  size_t numFeedWorkers = 8;
+  size_t minArticleWorkers = 4;    // article downloads in flight are kept between these two bounds,
+  size_t maxArticleWorkers = 64;   // adjusted as the crawl goes according to how upstreams respond
+  size_t numAnalysisWorkers = 0;   // 0 means one per core
+  std::string feedWeightsFile;     // if nonempty, lines of "<feed-url> [<weight>]" giving feeds more article workers
+  FetchPolicy fetchPolicy;
+  double crawlDeadline = 0;        // in seconds; if nonzero, articles not downloaded by then are dropped
+  double recrawlInterval = 0;      // in seconds; if nonzero, feeds are recrawled this often and the index swapped in
+  size_t retainCrawls = 0;         // if nonzero, articles no feed has listed in this many crawls are evicted
+  std::string checkpointFile;      // if nonempty, every analyzed article is logged here...
+  bool resume = false;             // ...and, if resuming, the articles already logged there aren't downloaded again
+  double memoryBudget = 0;         // in megabytes; if nonzero, the raw map is spilled to disk whenever it outgrows this
+  size_t shardIndex = 0;           // only the feeds whose URLs hash to this shard...
+  size_t numShards = 1;            // ...of this many are crawled
+  std::string segmentFile;         // if nonempty, the crawl's articles are written here as an index segment
+  std::string indexFile;           // if nonempty, the index is loaded from this segment rather than crawled
+};
+
 class NewsAggregator {
   
  public:
@@ -38,12 +93,21 @@ class NewsAggregator {
  */
   static NewsAggregator *createNewsAggregator(int argc, char *argv[]);
 
+/**
+ * Destructor: ~NewsAggregator
+ * ---------------------------
+ * Stops recrawling, if the aggregator was recrawling.
+ */
+  ~NewsAggregator();
+
 /**
  * Method: buildIndex
  * ------------------
  * Pulls the embedded RSSFeedList, parses it, parses the
  * RSSFeeds, and finally parses the HTMLDocuments they
- * reference to actually build the index.
+ * reference to actually build the index.  With a recrawl
+ * interval, also starts the thread that keeps the index fresh.
+ * Given an index segment instead, just loads that.
  */
   void buildIndex();
 
@@ -51,36 +115,107 @@ class NewsAggregator {
  * Method: queryIndex
  * ------------------
  * Provides the read-query-print loop that allows the user to
- * query the index to list articles.
+ * query the index to list articles, or, if a queries file was
+ * supplied, evaluates all of its queries in one batch, or, if a
+ * server endpoint was supplied, answers queries arriving over it.
  */
   void queryIndex() const;
 
  private:
 
+/**
+ * Method: runQuery
+ * ----------------
+ * Returns the number of articles matching the (already whitespace-normalized)
+ * query along with the top few, consulting the query cache first.  The query
+ * goes through the same TextNormalizer and TokenAnalyzer the article tokens
+ * went through, so "Café" finds "café" and "Connections" finds "connected".  A query of several space-separated words matches
+ * the articles containing all of them.
+ */
+  std::shared_ptr<const QueryResult> runQuery(const std::string& query) const;
+
+/**
+ * Method: runBatchQueries
+ * -----------------------
+ * Evaluates every query in the queries file in parallel against the (by now
+ * read-only) index, writes the results in input order, and reports
+ * throughput and latency percentiles.
+ */
+  void runBatchQueries() const;
+
+/**
+ * Method: serveQueries
+ * --------------------
+ * Listens on the server endpoint and polls every open connection, handing
+ * each request (not each connection) to a worker, so idle clients never
+ * tie up the pool.  An index generation is never modified once it's
+ * published, so workers read it without locking.
+ *
+ * The protocol is line-oriented: each request is a single line holding a
+ * query, and each response is a line "<numMatches> <numShown>" followed by
+ * numShown lines of the form "<count>\t<url>\t<title>".
+ */
+  void serveQueries() const;
+
+/**
+ * Method: serveRequests
+ * ---------------------
+ * Reads what the client has sent and answers every complete query in it.
+ * Returns false once the client hangs up, sends an overlong line, or can't
+ * be written to.
+ */
+  bool serveRequests(int client, SocketLineReader& reader) const;
+
 /**
  * Method: runFeedThread
  * ---------------------
  * Downloads all the articles from a single feed by scheduling them
- * all via the articlePool.
+ * all via the articlePool, as they're parsed when the feed can be
+ * streamed.  Returns once they're all scheduled, not once they're done.
  */  
   void runFeedThread(const std::pair<std::string, std::string>&);
 
 /**
  * Method: runArticleThread
  * ------------------------
- * Run by a single worker in articlePool to download a given article
- * and add it to the raw index if it hasn't yet been downloaded. Includes
- * the work of intersecting tokens with other versions of the same article.
+ * Run by a single worker in articlePool to download a given article if it
+ * hasn't yet been downloaded, and then hand the document over to
+ * analysisPool.  Downloads spend most of their time waiting on the network,
+ * so articlePool is sized for that and does no more than it must.
  */
   void runArticleThread(const Article&);
+  void forgetURL(const std::string& articleUrl); // so the next crawl tries it again
+
+/**
+ * Method: runAnalysisThread
+ * -------------------------
+ * Run by a single worker in analysisPool, which is sized to the number of
+ * cores, to normalize and analyze a downloaded article's tokens and add
+ * them to the raw index.  Includes the work of intersecting tokens with
+ * other versions of the same article.  When replaying, document is NULL and
+ * the tokens are loaded from the corpus here instead.
+ */
+  void runAnalysisThread(const Article&, const std::shared_ptr<HTMLDocument>& document);
   
 /** Method: updateRawMap
  *  --------------------
  *  Updates the raw map index performing intersection on articles we've seen and
- *  adding articles we haven't.
+ *  adding articles we haven't.  The tokens are views into storage owned by the
+ *  caller (typically the worker's arena), and are sorted in place.
  */
 
-  void updateRawMap(std::vector<std::string>, std::pair<std::string, std::string>, const Article&);
+  void updateRawMap(ArenaVector<token_view>& tokens, const std::pair<std::string, std::string>&, const Article&);
+
+/** Method: mergeIntoRawMap
+ *  -----------------------
+ *  The second half of updateRawMap, once the tokens are collapsed into a
+ *  bag (which may be moved into the raw map).  Also used to merge articles
+ *  resumed from the checkpoint.  A near-duplicate of an article with a
+ *  smaller key is skipped, and one with a larger key is displaced.  If the
+ *  raw map outgrows the memory budget, the caller spills it to disk before
+ *  returning.
+ */
+  void mergeIntoRawMap(TokenBag& bag, const std::pair<std::string, std::string>&, const Article&);
 /**
  * Private Types: url, server, title
  * ---------------------------------
@@ -95,34 +230,128 @@ class NewsAggregator {
   typedef std::string title;
   
   NewsAggregatorLog log;
+  NewsAggregatorOptions options;
   std::string rssFeedListURI;
-  RSSIndex index;
+  TextNormalizer normalizer; // applied to article tokens and to queries alike...
+  TokenAnalyzer analyzer;    // ...as is this, after the normalizer
+  std::shared_ptr<const RSSIndex> index; // the current generation, only ever accessed via std::atomic_load/store
+  mutable QueryCache queryCache; // top results for recent queries, tagged with the index generation
   bool built = false;
   ThreadPool feedPool;
   ThreadPool articlePool;
+  ThreadPool analysisPool;
+  ConcurrencyController articleConcurrency; // how many of articlePool's workers may be downloading at once
+  ArticleFetcher fetcher;
+  std::atomic<size_t> numFeedsPastDeadline; // feeds this crawl never started because the crawl deadline passed
+  std::unique_ptr<CrawlCheckpoint> checkpoint; // NULL unless checkpointing
+  CancellationToken crawlToken; // cancelled by Ctrl-C or a failed feed list, to drop the rest of the crawl
 
-  std::set<url> seenURLs; // URLs we've already seen
-  std::mutex seenLock; // Lock around checking and modifying the set
+  std::map<url, size_t> seenURLs; // article URLs we've already seen, across all crawls, and the last crawl to list each
+  std::set<url> seenFeeds;  // feed URLs we've already seen this crawl
+  std::set<url> failedURLs; // article URLs to try again next crawl
+  std::map<std::pair<server, title>, size_t> lastListed; // with --retain-crawls, the last crawl to list each article...
+  std::map<url, std::pair<server, title>> nearDuplicateOf; // ...and, for each near-duplicate, the key whose eviction
+                                                           // means it should be downloaded again
+  size_t crawlNumber; // how many crawls have started
+  std::mutex seenLock; // Lock around checking and modifying the sets and maps above
 
   // Our raw index -- maps server prefixes and article titles to Articles and tokens.
-  std::map<std::pair<server, title>, std::pair<Article, std::vector<std::string>>> articleMap;
+  std::map<std::pair<server, title>, std::pair<Article, TokenBag>> articleMap;
   std::mutex mapLock; // Lock around modifying and checking this raw index
+  size_t numRawMapUpdates;    // how many times the raw map has changed...
+  size_t numPublishedUpdates; // ...and how many of those the current index generation reflects
+  size_t rawMapBytes;         // roughly how much memory the raw map occupies
+  std::unique_ptr<RawMapSpill> spill; // NULL unless there's a memory budget
+  std::set<std::pair<server, title>> displacedKeys; // near-duplicates displaced as their cluster's representative,
+                                                    // left out of the index even if they made it into a spilled run
+
+  NearDuplicateDetector nearDuplicates; // clusters article bodies by SimHash, without touching mapLock
+
+  std::unique_ptr<CrawlCorpus> corpus;  // NULL unless recording or replaying
+
+  std::thread recrawler;                // only running with a recrawl interval
+  std::mutex recrawlLock;
+  std::condition_variable recrawlStopped;
+  bool stopRecrawling;
   
 /**
  * Constructor: NewsAggregator
  * ---------------------------
  * Private constructor used exclusively by the createNewsAggregator function
- * (and no one else) to construct a NewsAggregator around the supplied URI.
+ * (and no one else) to construct a NewsAggregator around the supplied options.
+ */
+  NewsAggregator(const NewsAggregatorOptions& options);
+
+/**
+ * Method: loadFeedWeights
+ * -----------------------
+ * Gives the feeds listed in the named file extra turns in articlePool.
  */
-  NewsAggregator(const std::string& rssFeedListURI, bool verbose);
+  void loadFeedWeights(const std::string& filename);
+
+/**
+ * Method: openCheckpoint
+ * ----------------------
+ * Opens the checkpoint file, resuming from it if asked to.
+ */
+  void openCheckpoint();
+
+/**
+ * Method: cancelCrawl
+ * -------------------
+ * Drops every download that hasn't started, and waits for the rest.
+ */
+  void cancelCrawl();
 
 /**
  * Method: processAllFeeds
  * -----------------------
- * Downloads all of the feeds and news articles to build the index.
- * You need to implement this function.
+ * Downloads all of the feeds and any news articles not already downloaded,
+ * and publishes a new index generation.  Returns false if the feed list
+ * couldn't be read on a recrawl (on the first crawl, that's fatal).
+ */
+  bool processAllFeeds();
+  bool abandonCrawl();
+
+/**
+ * Method: evictStaleArticles
+ * --------------------------
+ * Forgets every article no feed has listed in the last retainCrawls crawls,
+ * so a long-running recrawler's raw map, spilled runs and seen URLs only
+ * hold what's still current.  Near-duplicates that lost out to an evicted
+ * article are downloaded again on the next crawl, to be clustered afresh.
+ */
+  void evictStaleArticles();
+
+/**
+ * Method: publishIndex
+ * --------------------
+ * Builds a new index generation from the raw map (and anything spilled
+ * from it) and swaps it in, leaving out displaced near-duplicates.
+ */
+  void publishIndex();
+
+/**
+ * Method: writeSegment
+ * --------------------
+ * Writes everything in the raw map (and anything spilled from it) to the
+ * segment file, for merge-index to combine with other shards' segments.
+ */
+  void writeSegment();
+
+/**
+ * Method: loadIndex
+ * -----------------
+ * Builds the index from a segment file instead of crawling.
+ */
+  void loadIndex();
+
+/**
+ * Method: recrawlPeriodically
+ * ---------------------------
+ * Runs processAllFeeds every recrawl interval until told to stop.
  */
-  void processAllFeeds();
+  void recrawlPeriodically();
 
 /**
  * Copy Constructor, Assignment Operator
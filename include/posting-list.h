@@ -0,0 +1,119 @@
+/**
+ * File: posting-list.h
+ * --------------------
+ * Exports a PostingList, the compressed list of (document id, frequency)
+ * pairs that RSSIndex keeps for each word.  Postings are grouped into
+ * blocks of kBlockSize; within a block, document ids are stored as varint
+ * deltas interleaved with varint frequencies.  Each block has a skip entry
+ * recording its last document id, where its bytes start, and the largest
+ * frequency inside it, so that cursors can jump straight to the block that
+ * might hold a given document and top-k scans can pass over blocks that
+ * can't possibly contribute.
+ */
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class PostingList {
+ public:
+  static const size_t kBlockSize = 128;
+
+/**
+ * Constructs an empty posting list.
+ */
+  PostingList(): numPostings(0), lastDocId(0) {}
+
+/**
+ * Method: append
+ * --------------
+ * Appends a posting.  Document ids must be appended in strictly
+ * increasing order.
+ */
+  void append(uint32_t docId, uint32_t frequency);
+
+/**
+ * Method: size
+ * ------------
+ * Returns the number of postings (that is, the number of documents containing the word).
+ */
+  size_t size() const { return numPostings; }
+
+/**
+ * Method: bytes
+ * -------------
+ * Returns the approximate number of bytes the list occupies.
+ */
+  size_t bytes() const { return sizeof(*this) + data.capacity() + skips.capacity() * sizeof(Skip); }
+
+/**
+ * Method: shrinkToFit
+ * -------------------
+ * Releases any capacity reserved for future appends.
+ */
+  void shrinkToFit() { data.shrink_to_fit(); skips.shrink_to_fit(); }
+
+/**
+ * Class: PostingList::Cursor
+ * --------------------------
+ * Forward iterator over a posting list.  Blocks are decoded lazily, the
+ * first time one of their postings is actually inspected, so blocks that
+ * are skipped over (via advanceTo or nextBlock) are never decoded at all.
+ * A cursor starts out on the first posting; once it's been advanced past
+ * the last posting, done() returns true.
+ */
+  class Cursor {
+   public:
+    Cursor(const PostingList& list): list(&list), block(0), pos(0), decoded(false), blockLength(0) {}
+
+    bool done() const { return block == list->skips.size(); }
+    uint32_t docId() const { load(); return docIds[pos]; }
+    uint32_t frequency() const { load(); return frequencies[pos]; }
+
+/**
+ * Moves to the next posting.
+ */
+    void next();
+
+/**
+ * Moves to the first posting whose document id is at least target, decoding
+ * only the block that could hold it.  Never moves backwards.
+ */
+    void advanceTo(uint32_t target);
+
+/**
+ * Returns the largest frequency in the current block.  nextBlock moves to
+ * the start of the following block, so a block whose maximum can't matter
+ * is passed over without being decoded.
+ */
+    uint32_t blockMaxFrequency() const { return list->skips[block].maxFrequency; }
+    void nextBlock() { moveToBlock(block + 1); }
+
+   private:
+    const PostingList *list;
+    size_t block;
+    size_t pos;
+    mutable bool decoded;
+    mutable size_t blockLength;
+    mutable uint32_t docIds[kBlockSize];
+    mutable uint32_t frequencies[kBlockSize];
+
+    void moveToBlock(size_t index) { block = index; pos = 0; decoded = false; }
+    void load() const { if (!decoded) decode(); }
+    void decode() const;
+  };
+
+ private:
+  struct Skip {
+    uint32_t lastDocId;    // largest document id in the block
+    uint32_t offset;       // where the block's bytes begin within data
+    uint32_t maxFrequency; // largest frequency in the block
+  };
+
+  std::string data;
+  std::vector<Skip> skips;
+  uint32_t numPostings;
+  uint32_t lastDocId;
+};
@@ -0,0 +1,99 @@
+/**
+ * File: query-cache.h
+ * -------------------
+ * Exports a QueryCache, a bounded, thread-safe LRU cache of query results
+ * sitting in front of an RSSIndex.  Each entry is tagged with the generation
+ * of the index it was computed against; an entry whose generation doesn't
+ * match the index being queried is treated as a miss and discarded, so
+ * rebuilding or updating the index invalidates the cache without any explicit
+ * flush.
+ *
+ * The cache is split into independently locked shards (by hash of the query)
+ * so that concurrent readers rarely contend.
+ */
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <utility>
+#include <unordered_map>
+#include "article.h"
+
+/**
+ * Type: QueryResult
+ * -----------------
+ * The total number of articles matching a query, along with the
+ * highest-ranked of them.
+ */
+struct QueryResult {
+  size_t numMatches;
+  std::vector<std::pair<Article, int> > matches;
+};
+
+class QueryCache {
+ public:
+  static const size_t kNumShards = 16;
+
+/**
+ * Constructs a cache holding at most (roughly) the specified number of results.
+ */
+  QueryCache(size_t capacity);
+
+/**
+ * Method: normalize
+ * -----------------
+ * Returns the canonical form of a query: leading and trailing whitespace
+ * removed, and interior runs of whitespace collapsed to a single space.
+ * Callers should run the normalized query, so that the key always
+ * describes exactly what was computed.
+ */
+  static std::string normalize(const std::string& query);
+
+/**
+ * Method: lookup
+ * --------------
+ * Returns the cached result for the normalized query if there is one computed
+ * against the specified index generation, or NULL otherwise.
+ */
+  std::shared_ptr<const QueryResult> lookup(const std::string& query, uint64_t generation);
+
+/**
+ * Method: insert
+ * --------------
+ * Records the result for the normalized query, computed against the specified
+ * index generation, evicting the least recently used entry in its shard if need be.
+ */
+  void insert(const std::string& query, uint64_t generation, const std::shared_ptr<const QueryResult>& result);
+
+  size_t getHits() const { return hits; }
+  size_t getMisses() const { return misses; }
+
+ private:
+  struct Entry {
+    std::string query;
+    uint64_t generation;
+    std::shared_ptr<const QueryResult> result;
+  };
+
+  struct Shard {
+    std::mutex lock;
+    std::list<Entry> entries; // most recently used first
+    std::unordered_map<std::string, std::list<Entry>::iterator> lookup;
+  };
+
+  size_t shardCapacity;
+  Shard shards[kNumShards];
+  std::atomic<size_t> hits;
+  std::atomic<size_t> misses;
+
+  Shard& shardFor(const std::string& query) { return shards[std::hash<std::string>()(query) % kNumShards]; }
+
+  QueryCache(const QueryCache& original) = delete;
+  QueryCache& operator=(const QueryCache& rhs) = delete;
+};
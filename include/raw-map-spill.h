@@ -0,0 +1,96 @@
+/**
+ * File: raw-map-spill.h
+ * ---------------------
+ * Exports the RawMapSpill class, which lets the aggregator's raw map live
+ * under a memory budget.  Whenever the map grows past the budget, its
+ * contents are written out as a sorted run (the map is already ordered by
+ * its (server, title) key) and the map starts over empty.  Building the
+ * index then takes a k-way merge of every run and whatever is still in
+ * memory, so the index sees each key exactly once, just as it would have
+ * if nothing had been spilled.
+ *
+ * Each run is a temporary file under $TMPDIR (or /tmp) that's unlinked as
+ * soon as it's created, so runs vanish when the process exits, however it
+ * exits.  Runs are in the format described in sorted-run.h, which also
+ * explains how versions of an article that land in different runs are
+ * combined.
+ */
+
+#pragma once
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <functional>
+#include "sorted-run.h"
+
+class RawMapSpill {
+ public:
+/**
+ * Runs go in $TMPDIR, or /tmp if it isn't set.
+ */
+  RawMapSpill();
+
+/**
+ * Closes (and so deletes) every run.
+ */
+  ~RawMapSpill();
+
+/**
+ * Method: spill
+ * -------------
+ * Writes the supplied map out as a new run.  Any number of threads may
+ * spill at once, each writing its own file.  Returns false if the run
+ * couldn't be written, in which case nothing is added.
+ */
+  bool spill(const ArticleMap& articles);
+
+/**
+ * Method: merge
+ * -------------
+ * Merges every run with the supplied in-memory map, and calls handler once
+ * per distinct key, in key order, with the combined article and bag.  Runs
+ * are only read, so the spill can be merged again later (after more has
+ * been spilled, say).  Mustn't be called while another thread is spilling.
+ */
+  void merge(const ArticleMap& inMemory,
+             const std::function<void(const ArticleKey&, const Article&, const TokenBag&)>& handler) const;
+
+/**
+ * Method: compact
+ * ---------------
+ * Merges every run with the supplied in-memory map, just as merge does, and
+ * replaces the runs with a single one holding only the entries keep
+ * accepts.  The in-memory entries are then in the run, so the caller should
+ * clear the map.  Returns false if the new run couldn't be written, in
+ * which case the old runs stay.  Mustn't be called while another thread is
+ * spilling.
+ */
+  bool compact(const ArticleMap& inMemory,
+               const std::function<bool(const ArticleKey&, const Article&, const TokenBag&)>& keep);
+
+/**
+ * Accessors: getNumRuns, getNumSpilled, getSpilledBytes
+ * -----------------------------------------------------
+ * Return how many runs have been written, how many map entries they hold
+ * between them, and how many bytes they take up on disk.
+ */
+  size_t getNumRuns() const;
+  size_t getNumSpilled() const;
+  size_t getSpilledBytes() const;
+  const std::string& getDirectory() const { return directory; }
+
+ private:
+  struct Run {
+    int fd;
+    size_t size;
+    size_t numEntries;
+  };
+
+  std::string directory;
+  std::vector<Run> runs;
+  mutable std::mutex runsLock;
+
+  RawMapSpill(const RawMapSpill& original) = delete;
+  RawMapSpill& operator=(const RawMapSpill& rhs) = delete;
+};
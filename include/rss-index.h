@@ -2,39 +2,108 @@
  * File: rss-index.h
  * -----------------
  * Exports an RSSIndex type, which is a data structure that maps
- * words to vectors of document/frequency pairs (where the document frequency 
+ * words to vectors of document/frequency pairs (where the document frequency
  * pairs are represented as pair<Article, int>s).
+ *
+ * Each Article is stored once and identified by a dense document id, and each
+ * word maps to a compressed PostingList of (document id, frequency) pairs.
+ * While articles are being added, words are kept in a map; once the index is
+ * frozen, they're moved into a sorted TermDictionary, which supports prefix
+ * and wildcard lookups ("elect*", "colo?r") in addition to exact ones.
  */
 
 #pragma once
 #include <map>
+#include <string>
 #include <vector>
+#include <functional>
 #include "article.h"
+#include "token-bag.h"
+#include "posting-list.h"
+#include "term-dictionary.h"
 
 class RSSIndex {
  public:
 /**
  * Zero-argument constructor, constructs an empty index.
  */
-  RSSIndex() {}
+  RSSIndex();
 
 /**
  * Notes that each of the words in the supplied vector appears within the
  * specified article.  The add operation is not thread-safe, so care must be taken
  * to externally lock the RSSIndex down if two racing threads might try to
- * add to the RSSIndex at the same time.
+ * add to the RSSIndex at the same time.  Each article should be added only
+ * once, since postings are appended in document id order.
  */
   void add(const Article& article, const std::vector<std::string>& words);
 
+/**
+ * Same as above, except that the words arrive already collapsed into a
+ * TokenBag, so each distinct word is credited with its full count at once.
+ */
+  void add(const Article& article, const TokenBag& words);
+
 /**
  * Returns a reference to the list of documents associated with the specified
  * word.  The list is a vector of URL/frequency pairs, sorted by frequency from
  * high to low (and alphabetically for those with the same frequence counts.)
  */
   std::vector<std::pair<Article, int> > getMatchingArticles(const std::string& word) const;
-  
+
+/**
+ * Same as above, except that only the first k matches are returned, and the
+ * word may be a pattern using '*' and '?' wildcards.  A pattern matches every
+ * article containing any matching word, crediting it with the combined
+ * frequency of all of them; the matching posting lists are merged through a
+ * heap.  For an exact word, blocks of postings whose largest frequency can't
+ * make the cut are never decoded.  If numMatches is supplied, it's set to the
+ * total number of matching articles.
+ */
+  std::vector<std::pair<Article, int> > getMatchingArticles(const std::string& word, size_t k,
+                                                            size_t *numMatches = NULL) const;
+
+/**
+ * Returns the (at most k) articles containing every one of the supplied words
+ * (each of which may be a pattern), ranked as above by their combined
+ * frequency.  Posting lists are intersected smallest first, using the skip
+ * entries to decode only the blocks that might hold a candidate.  If numMatches is supplied, it's set to the total number
+ * of articles containing every word.
+ */
+  std::vector<std::pair<Article, int> > getArticlesContainingAll(const std::vector<std::string>& words,
+                                                                 size_t k, size_t *numMatches = NULL) const;
+
+/**
+ * Returns the index's generation, which changes every time an article is
+ * added.  Generations are unique across all RSSIndex instances, so anything
+ * derived from an index (a cached query result, say) can be tagged with the
+ * generation it was computed against and recognized as stale later on.
+ */
+  uint64_t getGeneration() const { return generation; }
+
+/**
+ * Moves the words into a sorted TermDictionary and releases the slack the
+ * posting lists reserved while growing.  Call it once all articles have been
+ * added; adding another article afterwards thaws the index again.
+ */
+  void freeze();
+
+/**
+ * Returns the approximate number of bytes occupied by the articles and posting lists.
+ */
+  size_t getPostingBytes() const;
+
  private:
-  std::map<std::string, std::map<Article, int> > index;
+  std::vector<Article> articles;
+  std::map<std::string, PostingList, std::less<>> index; // while adding
+  TermDictionary dictionary;                              // once frozen...
+  std::vector<PostingList> postings;                      // ...postings[i] belongs to dictionary.word(i)
+  bool frozen;
+  uint64_t generation;
+
+  const PostingList *find(const std::string& word) const;
+  void expand(const std::string& word, std::vector<const PostingList *>& lists) const;
+  void thaw();
 
 /**
  * RSSIndex instances can theoretically store a huge amount of data, so we
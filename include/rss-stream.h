@@ -0,0 +1,38 @@
+/**
+ * File: rss-stream.h
+ * ------------------
+ * Exports a streaming alternative to RSSFeedList::parse and RSSFeed::parse.
+ * Rather than downloading the whole document and building a tree before
+ * handing back the first entry, streamRSSItems reads the document through
+ * libxml2's xmlTextReader and passes each <item> (or Atom <entry>) to the
+ * supplied handler as soon as its closing tag has been read.  A feed list
+ * with tens of thousands of entries therefore starts feeding the crawl
+ * right away, in constant memory.
+ *
+ * libxml2 can read local files and plain http:// URLs itself, but it has
+ * no TLS support, so https:// documents still need RSSFeedList and RSSFeed.
+ */
+
+#pragma once
+#include <string>
+#include <functional>
+
+/**
+ * Function: canStreamRSS
+ * ----------------------
+ * Returns true if streamRSSItems can read the document at the supplied URI:
+ * a local path, a file:// URI, or an http:// URL.
+ */
+bool canStreamRSS(const std::string& uri);
+
+/**
+ * Function: streamRSSItems
+ * ------------------------
+ * Reads the RSS or Atom document at the supplied URI, calling handler with
+ * the link and title of each entry, in document order.  Entries without a
+ * link are skipped.  Returns false if the document couldn't be opened or
+ * turned out to be malformed, possibly after some entries have already
+ * been handed over.
+ */
+bool streamRSSItems(const std::string& uri,
+                    const std::function<void(const std::string& link, const std::string& title)>& handler);
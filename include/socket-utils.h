@@ -0,0 +1,92 @@
+/**
+ * File: socket-utils.h
+ * --------------------
+ * Defines a handful of thin wrappers around the POSIX socket API used by
+ * the query server and its load generator.  Endpoints are strings: one made
+ * up entirely of digits names a TCP port on the loopback interface, and
+ * anything else names a Unix domain socket path.  A port above 65535 is an
+ * error, like any other endpoint that can't be bound or reached, and so is
+ * port 0 for a client (a server given port 0 listens on any free port).
+ */
+
+#pragma once
+#include <cstddef>
+#include <string>
+
+/**
+ * Function: createServerSocket
+ * ----------------------------
+ * Binds and listens on the specified endpoint, returning the listening
+ * descriptor, or -1 on failure.  A stale Unix socket file at the same path
+ * is removed first.
+ */
+int createServerSocket(const std::string& endpoint, int backlog = 128);
+
+/**
+ * Function: createClientSocket
+ * ----------------------------
+ * Connects to the specified endpoint, returning the connected descriptor,
+ * or -1 on failure.
+ */
+int createClientSocket(const std::string& endpoint);
+
+/**
+ * Function: writeFully
+ * --------------------
+ * Writes all of the supplied bytes, retrying short writes.  Returns false
+ * if the peer has gone away.  Never raises SIGPIPE.
+ */
+bool writeFully(int fd, const char *data, size_t length);
+inline bool writeFully(int fd, const std::string& data) { return writeFully(fd, data.data(), data.size()); }
+
+/**
+ * Function: setSendTimeout
+ * ------------------------
+ * Makes any send on the descriptor that can't make progress for the
+ * specified number of milliseconds fail, so writeFully returns false rather
+ * than blocking forever on a peer that has stopped reading.  Returns false
+ * if the timeout can't be set.
+ */
+bool setSendTimeout(int fd, long milliseconds);
+
+/**
+ * Class: SocketLineReader
+ * -----------------------
+ * Buffered reader that pulls newline-terminated lines off a descriptor.  A
+ * peer that sends more than maxLineLength bytes without a newline is
+ * treated as though it had closed the connection, so the buffer stays
+ * bounded.
+ */
+class SocketLineReader {
+ public:
+  static const size_t kDefaultMaxLineLength = 64 << 10;
+  SocketLineReader(int fd, size_t maxLineLength = kDefaultMaxLineLength):
+    fd(fd), maxLineLength(maxLineLength), start(0) {}
+
+/**
+ * Reads the next line (without its terminating newline, or trailing
+ * carriage return) into line, returning false once the peer closes the
+ * connection or an error occurs.
+ */
+  bool readLine(std::string& line);
+
+/**
+ * Performs a single read into the buffer, returning false once the peer
+ * closes the connection, an error occurs, or the line being read has
+ * outgrown maxLineLength.  Lets an event loop read only
+ * what poll says is there, and then drain it with takeLine.
+ */
+  bool fill();
+
+/**
+ * Moves the next complete line already in the buffer into line, returning
+ * false (without reading) if there isn't one yet.
+ */
+  bool takeLine(std::string& line);
+
+ private:
+  int fd;
+  size_t maxLineLength;
+  std::string buffer;
+  size_t start;
+};
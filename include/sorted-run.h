@@ -0,0 +1,142 @@
+/**
+ * File: sorted-run.h
+ * ------------------
+ * Exports the pieces shared by everything that stores analyzed articles in
+ * (server, title) order outside of memory: the raw map's spill runs and the
+ * index segments that sharded crawls write out.
+ *
+ * A sorted run is a sequence of records of the form
+ *
+ *   <payload length: 4 bytes> <server> <article record>
+ *
+ * with the server varint-prefixed and the article record as described in
+ * article-record.h, in ascending (server, title) order.
+ *
+ * mergeSortedSources takes any number of such sequences (runs on disk, or
+ * a raw map still in memory) and combines them into one.  The same key can
+ * turn up in several of them, since different versions of an article may
+ * land in different runs or different shards.  The merge combines them
+ * exactly as the raw map does: it intersects their token bags and keeps
+ * the lexicographically first URL, neither of which depends on the order
+ * the versions arrive in.
+ */
+
+#pragma once
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <map>
+#include <utility>
+#include <functional>
+#include "article.h"
+#include "token-bag.h"
+#include "word-tokenizer.h"
+
+typedef std::pair<std::string, std::string> ArticleKey; // (server, title)
+typedef std::map<ArticleKey, std::pair<Article, TokenBag>> ArticleMap;
+
+/**
+ * Class: SortedSource
+ * -------------------
+ * Anything mergeSortedSources can read from.  next must be called once
+ * before the first entry is available, and returns false once the source
+ * is exhausted (or can't be read).
+ */
+class SortedSource {
+ public:
+  virtual ~SortedSource() {}
+  virtual bool next() = 0;
+  virtual const ArticleKey& key() const = 0;
+  virtual const Article& article() const = 0;
+  virtual const TokenBag& bag() const = 0;
+
+/**
+ * Hands over the current article and bag.  A source that's about to read
+ * the next entry over them anyway may move them rather than copy them.
+ */
+  virtual void take(Article& article, TokenBag& bag) { article = this->article(); bag = this->bag(); }
+};
+
+/**
+ * Class: ArticleMapSource
+ * -----------------------
+ * Reads the entries of a raw map, which must outlive it.
+ */
+class ArticleMapSource : public SortedSource {
+ public:
+  ArticleMapSource(const ArticleMap& articles): articles(articles), curr(articles.end()), started(false) {}
+  bool next();
+  const ArticleKey& key() const { return curr->first; }
+  const Article& article() const { return curr->second.first; }
+  const TokenBag& bag() const { return curr->second.second; }
+
+ private:
+  const ArticleMap& articles;
+  ArticleMap::const_iterator curr;
+  bool started;
+};
+
+/**
+ * Class: SortedRunReader
+ * ----------------------
+ * Reads the sorted run occupying bytes [start, end) of an open file.  The
+ * file is read with pread, so any number of readers may share it.
+ */
+class SortedRunReader : public SortedSource {
+ public:
+  SortedRunReader(int fd, size_t start, size_t end);
+  bool next();
+  const ArticleKey& key() const { return currKey; }
+  const Article& article() const { return currArticle; }
+  const TokenBag& bag() const { return currBag; }
+  void take(Article& article, TokenBag& bag);
+
+ private:
+  int fd;
+  size_t offset;   // how much of the file has been read into the buffer
+  size_t end;
+  size_t position; // where the next record starts in the buffer
+  std::string buffer;
+  std::vector<token_view> scratch;
+  ArticleKey currKey;
+  Article currArticle;
+  TokenBag currBag;
+
+  bool fill(size_t needed);
+};
+
+/**
+ * Class: SortedRunWriter
+ * ----------------------
+ * Appends a sorted run to an open file, a large chunk at a time.  Entries
+ * must be appended in ascending key order.  finish must be called to write
+ * out the last chunk.  Returns false from append or finish once a write
+ * has failed.
+ */
+class SortedRunWriter {
+ public:
+  SortedRunWriter(int fd): fd(fd), size(0), numEntries(0), failed(false) {}
+  bool append(const ArticleKey& key, const Article& article, const TokenBag& bag);
+  bool finish();
+  size_t getSize() const { return size; }
+  size_t getNumEntries() const { return numEntries; }
+
+ private:
+  int fd;
+  size_t size;
+  size_t numEntries;
+  bool failed;
+  std::string chunk;
+  std::string record;
+
+  bool flush();
+};
+
+/**
+ * Function: mergeSortedSources
+ * ----------------------------
+ * Merges the sources through a heap and calls handler once per distinct
+ * key, in key order, with the combined article and bag.
+ */
+void mergeSortedSources(const std::vector<SortedSource *>& sources,
+                        const std::function<void(const ArticleKey&, const Article&, const TokenBag&)>& handler);
@@ -0,0 +1,94 @@
+/**
+ * File: term-dictionary.h
+ * -----------------------
+ * Exports a TermDictionary, the frozen, sorted array of words an RSSIndex
+ * maps to posting lists.  All of the words live back to back in a single
+ * buffer, with a parallel array of offsets, so the dictionary costs about
+ * four bytes per word beyond the characters themselves and can be binary
+ * searched without chasing pointers.  Because it's sorted, every word sharing
+ * a prefix occupies one contiguous range, which is what makes prefix and
+ * wildcard lookups cheap.
+ */
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <utility>
+#include "word-tokenizer.h"
+
+class TermDictionary {
+ public:
+  static const size_t npos = size_t(-1);
+
+/**
+ * Constructs an empty dictionary.
+ */
+  TermDictionary() {}
+
+/**
+ * Method: append
+ * --------------
+ * Appends a word, which must sort after every word already present.
+ */
+  void append(token_view word);
+
+/**
+ * Method: shrinkToFit
+ * -------------------
+ * Releases any capacity reserved for future appends.
+ */
+  void shrinkToFit() { words.shrink_to_fit(); offsets.shrink_to_fit(); }
+
+  size_t size() const { return offsets.size(); }
+  token_view word(size_t i) const {
+    size_t end = i + 1 < offsets.size() ? offsets[i + 1] : words.size();
+    return token_view(words.data() + offsets[i], end - offsets[i]);
+  }
+
+/**
+ * Method: find
+ * ------------
+ * Returns the position of the specified word, or npos if it isn't present.
+ */
+  size_t find(token_view word) const;
+
+/**
+ * Method: prefixRange
+ * -------------------
+ * Returns the half-open range [first, last) of positions holding words that
+ * begin with the supplied prefix.
+ */
+  std::pair<size_t, size_t> prefixRange(token_view prefix) const;
+
+/**
+ * Method: match
+ * -------------
+ * Appends to positions every word matching the supplied pattern, where '*'
+ * stands for any run of characters (including none) and '?' stands for any
+ * single character.  Only the range sharing the pattern's literal prefix is
+ * examined.
+ */
+  void match(const std::string& pattern, std::vector<size_t>& positions) const;
+
+/**
+ * Function: isPattern
+ * -------------------
+ * Returns true if and only if the supplied word contains a wildcard.
+ */
+  static bool isPattern(const std::string& word) { return word.find_first_of("*?") != std::string::npos; }
+
+/**
+ * Function: matches
+ * -----------------
+ * Returns true if and only if the supplied word matches the supplied pattern.
+ */
+  static bool matches(token_view pattern, token_view word);
+
+ private:
+  std::string words;
+  std::vector<uint32_t> offsets;
+
+  size_t lowerBound(token_view word) const;
+};
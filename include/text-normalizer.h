@@ -0,0 +1,56 @@
+/**
+ * File: text-normalizer.h
+ * -----------------------
+ * Exports a TextNormalizer, which maps every spelling variant of a term to
+ * one key before it reaches the index, and does the same to queries so the two
+ * agree.  Text is case folded per Unicode simple case folding (Latin, Greek
+ * and Cyrillic, plus a few compatibility letters), and accents can optionally
+ * be stripped, so "Café", "CAFÉ" and (with stripping) "cafe" all index alike.
+ *
+ * Tokens are overwhelmingly plain, lowercase ASCII, so the normalizer first
+ * checks 16 bytes at a time whether there's anything to do at all and, if
+ * there isn't, hands the token back untouched.  Folding never lengthens the
+ * text, so the normalized copy fits in a buffer the size of the original.
+ * Malformed UTF-8 is passed through byte for byte.
+ */
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include "arena.h"
+#include "word-tokenizer.h"
+
+class TextNormalizer {
+ public:
+/**
+ * Constructor: TextNormalizer
+ * ---------------------------
+ * Constructs a normalizer that case folds and, if stripAccents is true, also
+ * reduces accented Latin letters to their base letters (ß to "ss", æ to "ae",
+ * and so forth) and drops combining diacritical marks.
+ */
+  TextNormalizer(bool stripAccents = false): stripAccents(stripAccents) {}
+
+/**
+ * Method: normalize
+ * -----------------
+ * Returns the normalized form of the supplied token.  If the token is
+ * already normalized, the view is returned as is; otherwise the normalized
+ * copy is carved out of the supplied arena.
+ */
+  token_view normalize(token_view token, Arena& arena) const;
+
+/**
+ * Method: normalize
+ * -----------------
+ * Same as above, except that the normalized text is returned as a string.
+ * This is the version applied to queries.
+ */
+  std::string normalize(const std::string& text) const;
+
+ private:
+  bool stripAccents;
+
+  size_t fold(const char *text, size_t length, char *out) const;
+};
@@ -5,8 +5,19 @@
  * of worker threads that collaboratively work through a sequence of tasks.
  * As each task is scheduled, the ThreadPool waits for at least
  * one worker thread to be free and then assigns that task to that worker.  
- * Threads are scheduled and served in a FIFO manner, and tasks need to
- * take the form of thunks, which are zero-argument thread routines.
+ * Tasks need to take the form of thunks, which are zero-argument thread
+ * routines.  Each thunk can be scheduled on behalf of a named source (a
+ * feed, say, or a host).  Thunks from the same source are served in FIFO
+ * order, and the sources take turns, so one source with a long backlog
+ * doesn't hold up the rest; a source with weight w gets w turns for each
+ * turn of a source with weight 1.  Thunks scheduled without a source all
+ * share one, so a pool that never names sources is plain FIFO.
+ *
+ * Thunks may also be scheduled with a CancellationToken.  Once the token
+ * is cancelled, any of its thunks still queued are dropped, in constant
+ * time each, instead of being run, and discardBacklog drops everything
+ * queued at once, so that a pool can be shut down without first working
+ * through its whole queue.
  */
 
 #ifndef _thread_pool_
@@ -17,11 +28,16 @@
 #include <thread>
 #include <vector>
 #include <queue>
+#include <deque>
+#include <string>
+#include <unordered_map>
 #include <mutex>
 #include <iostream>
 #include <condition_variable>
 #include <atomic>
+#include <chrono>
 #include "semaphore.h"
+#include "cancellation-token.h"
 // place additional #include statements here
 
 namespace develop {
@@ -31,9 +47,12 @@ class ThreadPool {
 
 /**
  * Constructs a ThreadPool configured to spawn up to the specified
- * number of threads.
+ * number of threads.  If capacity is nonzero, at most that many thunks
+ * may be waiting for a worker at once, and scheduling blocks (or fails,
+ * with trySchedule) until there's room, so that a producer can't get
+ * arbitrarily far ahead of the workers.
  */
-  ThreadPool(size_t numThreads);
+  ThreadPool(size_t numThreads, size_t capacity = 0);
 
 /**
  * Destroys the ThreadPool class
@@ -44,9 +63,51 @@ class ThreadPool {
  * Schedules the provided thunk (which is something that can
  * be invoked as a zero-argument function without a return value)
  * to be executed by one of the ThreadPool's threads as soon as
- * all previously scheduled thunks have been handled.
+ * all previously scheduled thunks from the same source have been
+ * handled and it's that source's turn.
+ *
+ * In a bounded pool, a source may always queue as many thunks as its
+ * weight, even when the queue is otherwise full, so that no source is
+ * shut out by the others' backlogs.
  */
-  void schedule(const std::function<void(void)>& thunk);
+  void schedule(const std::function<void(void)>& thunk, const std::string& source = std::string());
+
+/**
+ * Schedules the provided thunk as above, but to be dropped rather than
+ * run if the token is cancelled before a worker gets to it.  The thunk
+ * can poll the token itself once it's running.
+ */
+  void schedule(const std::function<void(void)>& thunk, const CancellationToken& token,
+                const std::string& source = std::string());
+
+/**
+ * Schedules the provided thunk if there's room for it in the queue,
+ * returning false rather than blocking if there isn't (or, in the second
+ * version, if room doesn't open up before the timeout).  Always succeeds
+ * for an unbounded pool.
+ */
+  bool trySchedule(const std::function<void(void)>& thunk, const std::string& source = std::string());
+  bool trySchedule(const std::function<void(void)>& thunk, std::chrono::steady_clock::duration timeout,
+                   const std::string& source = std::string());
+
+/**
+ * Sets how many turns the named source gets each time round the sources
+ * with thunks waiting.  Sources have weight 1 unless set otherwise.
+ */
+  void setWeight(const std::string& source, size_t weight);
+
+/**
+ * Drops every thunk still waiting for a worker, returning how many there
+ * were.  Thunks already running are left to finish; a wait() that follows
+ * only waits for those.
+ */
+  size_t discardBacklog();
+
+/**
+ * Returns how many thunks have been dropped without running, whether by
+ * cancellation or by discardBacklog.
+ */
+  size_t getNumDropped() const;
   
 /**
  * Blocks and waits until all previously scheduled thunks
@@ -59,7 +120,7 @@ class ThreadPool {
   typedef std::function<void(void)> thunk_t;
   typedef struct worker_t {
       size_t id;
-      int available;
+      std::atomic<bool> available;
       semaphore job_waiting;
       thunk_t job;
   } worker_t;
@@ -88,10 +149,34 @@ class ThreadPool {
   std::mutex cv_lock;
   std::condition_variable_any all_available;
 
-  bool done;
-
-  std::mutex q_lock;
-  std::queue<thunk_t> scheduled;
+  std::atomic<bool> done;
+
+  typedef struct task_t {
+      thunk_t thunk;
+      CancellationToken token;
+  } task_t;
+
+  typedef struct source_t {
+      std::queue<task_t> scheduled;
+      size_t turns_left = 0; // in the source's current turn
+  } source_t;
+
+  mutable std::mutex q_lock;
+  std::condition_variable not_full;
+  std::unordered_map<std::string, source_t> sources; // only those with thunks waiting
+  std::deque<std::string> turns;                      // the same sources, in the order they'll be served
+  std::unordered_map<std::string, size_t> weights;    // only those set to something other than 1
+  size_t num_scheduled;
+  size_t num_dropped;
+  size_t capacity; // 0 if unbounded
+  CancellationToken never_cancelled; // shared by thunks scheduled without a token
+
+  size_t getWeight(const std::string& source) const;
+  bool hasRoom(const std::string& source) const;
+  bool enqueue(const thunk_t& thunk, const CancellationToken& token, const std::string& source,
+               std::unique_lock<std::mutex>& ul);
+  bool dequeue(thunk_t& thunk);
+  void notifyAllAvailable();
   
   ThreadPool(const ThreadPool& original) = delete;
   ThreadPool& operator=(const ThreadPool& rhs) = delete;
@@ -0,0 +1,97 @@
+/**
+ * File: token-analyzer.h
+ * ----------------------
+ * Exports a TokenAnalyzer, the stage between tokenization and indexing that
+ * decides which (already normalized) tokens are worth indexing and in what
+ * form.  Tokens shorter than a minimum length and stop words ("the", "and",
+ * ...) are dropped, since their posting lists are enormous and no one
+ * searches for them, and what's left is reduced to its stem with the Porter
+ * stemmer, so "connected", "connecting" and "connection" share one posting
+ * list.  Queries go through the same analysis, so they find what was indexed.
+ */
+
+#pragma once
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <set>
+#include <atomic>
+#include <functional>
+#include "arena.h"
+#include "word-tokenizer.h"
+
+/**
+ * Type: AnalysisStats
+ * -------------------
+ * Counts of what the analyzer did to a batch of tokens.
+ */
+struct AnalysisStats {
+  size_t numTokens = 0;
+  size_t numTooShort = 0;
+  size_t numStopWords = 0;
+  size_t numStemmed = 0;
+};
+
+class TokenAnalyzer {
+ public:
+  static const size_t kDefaultMinLength = 2;
+
+/**
+ * Constructor: TokenAnalyzer
+ * --------------------------
+ * Constructs an analyzer that drops tokens shorter than minLength bytes,
+ * drops stop words (from a built-in English list, unless replaced via
+ * setStopWords) if removeStopWords is true, and stems if stem is true.
+ */
+  TokenAnalyzer(bool removeStopWords = true, bool stem = true, size_t minLength = kDefaultMinLength);
+
+/**
+ * Method: setStopWords
+ * --------------------
+ * Replaces the stop word list.  The words should already be normalized
+ * the same way tokens are.
+ */
+  void setStopWords(const std::vector<std::string>& words);
+
+/**
+ * Method: analyze
+ * ---------------
+ * Returns the indexable form of the supplied token, or an empty view if it
+ * should be dropped.  Stemmed tokens are copied into the supplied arena;
+ * all others are returned as is.  What happened is tallied into stats.
+ */
+  token_view analyze(token_view token, Arena& arena, AnalysisStats& stats) const;
+
+/**
+ * Method: analyzeQuery
+ * --------------------
+ * Applies the same analysis to each space-separated word of a (normalized)
+ * query, returning what's left, again separated by single spaces.  Words
+ * containing wildcards are passed through untouched.
+ */
+  std::string analyzeQuery(const std::string& query) const;
+
+/**
+ * Method: record
+ * --------------
+ * Adds the supplied per-article tallies to the running totals.  Thread-safe.
+ */
+  void record(const AnalysisStats& stats);
+  AnalysisStats getTotals() const;
+
+ private:
+  bool removeStopWords;
+  bool stem;
+  size_t minLength;
+  std::set<std::string, std::less<>> stopWords;
+
+  std::atomic<size_t> numTokens;
+  std::atomic<size_t> numTooShort;
+  std::atomic<size_t> numStopWords;
+  std::atomic<size_t> numStemmed;
+
+  bool isStopWord(token_view token) const;
+
+  TokenAnalyzer(const TokenAnalyzer& original) = delete;
+  TokenAnalyzer& operator=(const TokenAnalyzer& rhs) = delete;
+};
@@ -0,0 +1,71 @@
+/**
+ * File: token-bag.h
+ * -----------------
+ * Exports a TokenBag, the compact form in which an article's tokens are
+ * kept in the raw index.  A bag stores each distinct token once, along with
+ * the number of times it appeared, in two contiguous allocations (one for
+ * the characters and one for the entries) rather than one heap-allocated
+ * string per occurrence.
+ */
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "word-tokenizer.h"
+
+class TokenBag {
+ public:
+/**
+ * Constructs an empty bag.
+ */
+  TokenBag() {}
+
+/**
+ * Method: assign
+ * --------------
+ * Replaces the contents of the bag with the supplied tokens, which must
+ * already be sorted.  Runs of equal tokens collapse into a single entry.
+ */
+  void assign(const token_view *sorted, size_t count);
+
+/**
+ * Method: intersect
+ * -----------------
+ * Returns the multiset intersection of this bag and another one: the
+ * tokens common to both, each with the smaller of its two counts.  This
+ * is exactly what std::set_intersection yields over the sorted token
+ * vectors the two bags were built from.
+ */
+  TokenBag intersect(const TokenBag& other) const;
+
+/**
+ * Accessors: size, term, count
+ * ----------------------------
+ * size returns the number of distinct tokens, and term and count
+ * return the ith token (in sorted order) and its number of occurrences.
+ */
+  size_t size() const { return entries.size(); }
+  token_view term(size_t i) const { return token_view(terms.data() + entries[i].offset, entries[i].length); }
+  uint32_t count(size_t i) const { return entries[i].count; }
+
+/**
+ * Method: bytes
+ * -------------
+ * Returns the approximate number of bytes the bag occupies.
+ */
+  size_t bytes() const { return sizeof(*this) + terms.capacity() + entries.capacity() * sizeof(Entry); }
+
+ private:
+  struct Entry {
+    uint32_t offset;
+    uint32_t length;
+    uint32_t count;
+  };
+
+  std::string terms;
+  std::vector<Entry> entries;
+
+  void append(token_view term, uint32_t count);
+};
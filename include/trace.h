@@ -0,0 +1,127 @@
+/**
+ * File: trace.h
+ * -------------
+ * Exports a minimal span tracer for finding out where a crawl spends its
+ * time.  A TraceSpan marks a scope; when tracing is enabled, its start and
+ * end times are appended, along with the name, to a buffer private to the
+ * calling thread, so recording never takes a lock.  Once the work is done,
+ * Tracer::dump writes every span out in Chrome's trace_event JSON format,
+ * which chrome://tracing and Perfetto both open.
+ *
+ * When tracing is disabled (the default), a span costs one load of a
+ * flag and one branch at either end.
+ */
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <atomic>
+
+/**
+ * Type: TraceTotal
+ * ----------------
+ * The number of spans recorded under one name, and their combined duration
+ * (summed across threads, so it can exceed the wall time).
+ */
+struct TraceTotal {
+  std::string name;
+  size_t count;
+  uint64_t nanoseconds;
+};
+
+class Tracer {
+ public:
+/**
+ * Method: enable
+ * --------------
+ * Turns tracing on from this point forward.  Timestamps in the dump are
+ * relative to the moment tracing was enabled.
+ */
+  static void enable();
+
+/**
+ * Method: disable
+ * ---------------
+ * Stops recording new spans.  Spans already recorded stay put, so they can
+ * still be dumped or summarized, but nothing more accumulates.
+ */
+  static void disable();
+  static bool isEnabled() { return enabled.load(std::memory_order_relaxed); }
+
+/**
+ * Method: record
+ * --------------
+ * Appends a completed span to the calling thread's buffer.  The name must be
+ * a string literal (or otherwise outlive the tracer) and should not need
+ * escaping in JSON.
+ */
+  static void record(const char *name, uint64_t start, uint64_t end);
+
+/**
+ * Method: now
+ * -----------
+ * Returns the current time, in nanoseconds, on the clock spans are measured against.
+ */
+  static uint64_t now();
+
+/**
+ * Method: dump
+ * ------------
+ * Writes every span recorded so far to the named file, returning the number
+ * of spans written, or -1 if the file couldn't be opened.  Spans recorded
+ * while the dump is in progress may or may not be included.
+ */
+  static long dump(const std::string& filename);
+
+/**
+ * Method: summarize
+ * -----------------
+ * Returns the totals for every span name recorded so far, ordered by name.
+ */
+  static std::vector<TraceTotal> summarize();
+
+ private:
+  static std::atomic<bool> enabled;
+};
+
+class TraceSpan {
+ public:
+  explicit TraceSpan(const char *name): name(name), start(Tracer::isEnabled() ? Tracer::now() : 0) {}
+  ~TraceSpan() { if (start != 0) Tracer::record(name, start, Tracer::now()); }
+
+ private:
+  const char *name;
+  uint64_t start; // 0 if tracing was disabled when the span opened
+
+  TraceSpan(const TraceSpan& original) = delete;
+  TraceSpan& operator=(const TraceSpan& rhs) = delete;
+};
+
+/**
+ * Class: PausableTraceSpan
+ * ------------------------
+ * A span that can step aside while its scope does something that belongs
+ * under another name, such as a streaming parse handing each entry to a
+ * pool that may block.  Every stretch between a resume and the next pause
+ * is recorded as a span of its own.
+ */
+class PausableTraceSpan {
+ public:
+  explicit PausableTraceSpan(const char *name): name(name) { resume(); }
+  ~PausableTraceSpan() { pause(); }
+
+  void pause() {
+    if (start != 0) Tracer::record(name, start, Tracer::now());
+    start = 0;
+  }
+  void resume() { start = Tracer::isEnabled() ? Tracer::now() : 0; }
+
+ private:
+  const char *name;
+  uint64_t start; // 0 while paused, or if tracing was disabled when the span resumed
+
+  PausableTraceSpan(const PausableTraceSpan& original) = delete;
+  PausableTraceSpan& operator=(const PausableTraceSpan& rhs) = delete;
+};
@@ -7,6 +7,8 @@
  */
 
 #pragma once
+#include <cstddef>
+#include <cstdint>
 #include <string>
 
 /**
@@ -35,3 +37,23 @@ bool shouldTruncate(const std::string& str);
  * itself prompts shouldTruncate to return true.
  */
 std::string truncate(const std::string& str);
+
+/**
+ * Function: hash64
+ * ----------------
+ * Returns a 64-bit hash of the supplied bytes: FNV-1a, followed by the
+ * splitmix64 finalizer so every bit depends on every byte.  It's spelled
+ * out rather than left to std::hash, so it's the same in every process on
+ * every machine, and so can be written to disk or used to split work
+ * between processes.
+ */
+uint64_t hash64(const char *data, size_t length);
+inline uint64_t hash64(const std::string& str) { return hash64(str.data(), str.size()); }
+
+/**
+ * Function: getShard
+ * ------------------
+ * Returns which of numShards shards the supplied URL belongs to, by way of
+ * hash64, so every process taking part in a sharded crawl agrees on it.
+ */
+size_t getShard(const std::string& url, size_t numShards);
@@ -0,0 +1,136 @@
+/**
+ * File: word-tokenizer.h
+ * ----------------------
+ * Exports a WordTokenizer, a buffer-oriented alternative to StreamTokenizer.
+ * Rather than pulling one character at a time through an istream and handing
+ * back a freshly allocated string per token, the WordTokenizer lowercases a
+ * contiguous buffer in one pass and then hands out views into that buffer,
+ * classifying 16 (SSSE3) or 32 (AVX2) bytes at a time with a nibble-indexed
+ * lookup of the delimiter bitmap.
+ */
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <experimental/string_view>
+#include "arena.h"
+
+/**
+ * Type: token_view
+ * ----------------
+ * Non-owning view of a token.  Views handed out by a WordTokenizer
+ * point into the tokenizer's own buffer, so they're only valid until
+ * the next call to reset (or until the tokenizer is destroyed).
+ */
+typedef std::experimental::string_view token_view;
+
+/**
+ * Constant: kDefaultWordDelimiters
+ * --------------------------------
+ * Whitespace and ASCII punctuation, which is what we split article
+ * text on.  Bytes 0x80 and above are never delimiters, so multibyte
+ * UTF-8 sequences stay inside the token they appear in.
+ */
+extern const std::string kDefaultWordDelimiters;
+
+class WordTokenizer {
+ public:
+/**
+ * Constructor: WordTokenizer
+ * --------------------------
+ * Builds the delimiter bitmap for the supplied delimiter set.  Delimiters are
+ * matched case-insensitively, since tokens are lowercased before they're split.
+ */
+  WordTokenizer(const std::string& delimiters = kDefaultWordDelimiters);
+
+/**
+ * Method: reset
+ * -------------
+ * Lowercases (ASCII only) a private copy of the supplied text and positions
+ * the tokenizer at its first token.  Any views handed out before the reset
+ * are invalidated.
+ */
+  void reset(const char *text, size_t length);
+  void reset(const std::string& text) { reset(text.data(), text.size()); }
+
+/**
+ * Method: reset
+ * -------------
+ * Same as above, except that the lowercased copy is carved out of the
+ * supplied arena instead of the tokenizer's own buffer.  Views handed out
+ * afterwards remain valid until the arena itself is reset.
+ */
+  void reset(const char *text, size_t length, Arena& arena);
+
+/**
+ * Method: hasMoreTokens
+ * ---------------------
+ * Returns true if and only if nextToken has at least one more token to return.
+ */
+  bool hasMoreTokens() const { return pos < length; }
+
+/**
+ * Method: nextToken
+ * -----------------
+ * Returns a view of the next (lowercased) token, or an empty view if
+ * there are no more tokens.
+ */
+  token_view nextToken();
+
+/**
+ * Method: appendTokens
+ * --------------------
+ * Drains all remaining tokens into the supplied (typically arena-backed) vector.
+ */
+  void appendTokens(ArenaVector<token_view>& tokens);
+
+/**
+ * Method: isDelimiter
+ * -------------------
+ * Returns true if and only if the supplied (lowercased) byte is a delimiter.
+ */
+  bool isDelimiter(unsigned char ch) const { return (bitmap[ch >> 6] >> (ch & 63)) & 1; }
+
+/**
+ * Type: Classifier
+ * ----------------
+ * How the tokenizer scans for token boundaries, chosen at construction from
+ * the delimiter set and what the CPU supports:
+ *
+ *   kAVX2Lookup, kSSSE3Lookup: 32 or 16 bytes at a time, with a pshufb lookup
+ *       of each byte's low and high nibbles (any set of ASCII delimiters)
+ *   kSSE2Ranges: 16 bytes at a time, with range compares against the runs of
+ *       word bytes (at most kMaxVectorRanges of them)
+ *   kScalar: one byte at a time against the bitmap
+ */
+  enum Classifier { kScalar, kSSE2Ranges, kSSSE3Lookup, kAVX2Lookup };
+  Classifier getClassifier() const { return classifier; }
+
+ private:
+  static const size_t kMaxVectorRanges = 8;
+
+  uint64_t bitmap[4];
+  Classifier classifier;
+
+  // lowNibbles[lo] has bit hi set when byte (hi << 4 | lo) is a delimiter, for
+  // the eight ASCII high nibbles; the lookup classifiers index it with pshufb.
+  alignas(16) unsigned char lowNibbles[16];
+
+  // When the non-delimiter bytes form at most kMaxVectorRanges runs, they're
+  // recorded here as [low, low + span] pairs and classified with vector compares.
+  size_t numRanges;
+  unsigned char rangeLow[kMaxVectorRanges];
+  unsigned char rangeSpan[kMaxVectorRanges];
+
+  std::string ownedBuffer;
+  const char *text;
+  size_t length;
+  size_t pos;
+
+  size_t find(size_t from, bool wordByte) const;
+  size_t findScalar(size_t from, bool wordByte) const;
+
+  WordTokenizer(const WordTokenizer& orig) = delete;
+  void operator=(const WordTokenizer& other) = delete;
+};
@@ -0,0 +1,229 @@
+/**
+ * File: article-fetcher.cc
+ * ------------------------
+ * Presents the implementation of the ArticleFetcher class.
+ */
+
+#include "article-fetcher.h"
+#include "html-document-exception.h"
+#include "utils.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <random>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+static const size_t kLatencySamplesPerServer = 64;
+static const size_t kMinHedgeSamples = 16; // don't hedge against a server until we know its p95
+
+struct ArticleFetcher::Shared {
+  struct Samples {
+    vector<double> latencies; // a ring of the most recent successes, in seconds
+    size_t next = 0;
+  };
+  mutex latenciesLock;
+  unordered_map<string, Samples> latencies;
+
+  atomic<size_t> numRetries{0};
+  atomic<size_t> numTimeouts{0};
+  atomic<size_t> numRefused{0};
+  atomic<size_t> numHedges{0};
+  atomic<size_t> numHedgeWins{0};
+  atomic<size_t> numPastDeadline{0};
+
+  void recordLatency(const string& server, double latency) {
+    lock_guard<mutex> lg(latenciesLock);
+    Samples& samples = latencies[server];
+    if (samples.latencies.size() < kLatencySamplesPerServer) samples.latencies.push_back(latency);
+    else samples.latencies[samples.next++ % kLatencySamplesPerServer] = latency;
+  }
+
+  // Returns 0 if there aren't enough samples to go on
+  double getP95(const string& server) {
+    vector<double> recent;
+    {
+      lock_guard<mutex> lg(latenciesLock);
+      auto found = latencies.find(server);
+      if (found == latencies.end() || found->second.latencies.size() < kMinHedgeSamples) return 0;
+      recent = found->second.latencies;
+    }
+    auto p95 = recent.begin() + size_t(0.95 * (recent.size() - 1));
+    nth_element(recent.begin(), p95, recent.end());
+    return *p95;
+  }
+
+  // Attempts running on threads of their own, per server and in all
+  mutex runningLock;
+  condition_variable allFinished;
+  unordered_map<string, size_t> running;
+  size_t numRunning = 0;
+
+  bool startAttempt(const string& server) {
+    lock_guard<mutex> lg(runningLock);
+    size_t& numRunningForServer = running[server];
+    if (numRunningForServer >= ArticleFetcher::kMaxAttemptsPerServer) return false;
+    numRunningForServer++;
+    numRunning++;
+    return true;
+  }
+
+  void finishAttempt(const string& server) {
+    lock_guard<mutex> lg(runningLock);
+    if (--running[server] == 0) running.erase(server);
+    if (--numRunning == 0) allFinished.notify_all();
+  }
+};
+
+struct ArticleFetcher::Attempts {
+  mutex m;
+  condition_variable cv;
+  size_t numPending = 0;
+  int winner = -1; // which attempt finished first with a document, if any has
+  shared_ptr<HTMLDocument> document;
+};
+
+static double secondsSince(ArticleFetcher::time_point start) {
+  return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+static chrono::steady_clock::duration toDuration(double seconds) {
+  return chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(seconds));
+}
+
+// Waits for the predicate or the time point, whichever comes first; max() means forever
+template <typename Predicate>
+static bool waitUntil(condition_variable& cv, unique_lock<mutex>& ul, ArticleFetcher::time_point until,
+                      Predicate predicate) {
+  if (until == ArticleFetcher::time_point::max()) {
+    cv.wait(ul, predicate);
+    return true;
+  }
+  return cv.wait_until(ul, until, predicate);
+}
+
+ArticleFetcher::ArticleFetcher(const FetchPolicy& policy):
+  policy(policy), deadline(time_point::max()), shared(make_shared<Shared>()) {}
+
+ArticleFetcher::~ArticleFetcher() {
+  unique_lock<mutex> ul(shared->runningLock);
+  shared->allFinished.wait(ul, [this] { return shared->numRunning == 0; });
+}
+
+/**
+ * Runs one attempt on a detached thread, unless the server already has
+ * kMaxAttemptsPerServer running, in which case it returns false.  The
+ * thread holds its own references to everything it touches, so it can
+ * safely finish after the fetch that launched it has moved on.
+ */
+bool ArticleFetcher::launch(const shared_ptr<Attempts>& attempts, const shared_ptr<Shared>& shared,
+                            const shared_ptr<ConcurrencyPermit>& permit, const string& url,
+                            const string& server, int which) {
+  if (!shared->startAttempt(server)) {
+    shared->numRefused++;
+    return false;
+  }
+  attempts->numPending++; // caller holds attempts->m
+  thread([attempts, shared, held = permit, url, server, which]() mutable {
+    time_point start = chrono::steady_clock::now();
+    shared_ptr<HTMLDocument> document = make_shared<HTMLDocument>(url);
+    bool succeeded = true;
+    try {
+      document->parse();
+    } catch (const HTMLDocumentException& hde) {
+      succeeded = false;
+    }
+    if (succeeded) shared->recordLatency(server, secondsSince(start));
+    {
+      lock_guard<mutex> lg(attempts->m);
+      attempts->numPending--;
+      if (succeeded && attempts->winner < 0) {
+        attempts->winner = which;
+        attempts->document = move(document);
+      }
+      attempts->cv.notify_all();
+    }
+    held.reset(); // the connection is closed, so the download slot can go to someone else
+    shared->finishAttempt(server); // last, since the destructor may stop waiting once this is done
+  }).detach();
+  return true;
+}
+
+ArticleFetcher::Attempt ArticleFetcher::tryOnce(const string& url, const string& server,
+                                                shared_ptr<HTMLDocument>& document,
+                                                const shared_ptr<ConcurrencyPermit>& permit) {
+  time_point start = chrono::steady_clock::now();
+  if (policy.attemptTimeout == 0 && !policy.hedge && deadline == time_point::max()) {
+    document = make_shared<HTMLDocument>(url);
+    try {
+      document->parse();
+    } catch (const HTMLDocumentException& hde) {
+      document.reset();
+      return kAttemptFailed;
+    }
+    shared->recordLatency(server, secondsSince(start));
+    return kAttemptSucceeded;
+  }
+
+  time_point attemptDeadline = deadline;
+  if (policy.attemptTimeout > 0) attemptDeadline = min(attemptDeadline, start + toDuration(policy.attemptTimeout));
+  double p95 = policy.hedge ? shared->getP95(server) : 0;
+  time_point hedgeAt = p95 > 0 ? start + toDuration(p95) : time_point::max();
+
+  shared_ptr<Attempts> attempts = make_shared<Attempts>();
+  unique_lock<mutex> ul(attempts->m);
+  auto finished = [&attempts] { return attempts->winner >= 0 || attempts->numPending == 0; };
+  if (!launch(attempts, shared, permit, url, server, 0)) return kAttemptTimedOut; // the server is swamped
+  if (hedgeAt < attemptDeadline && !waitUntil(attempts->cv, ul, hedgeAt, finished) &&
+      launch(attempts, shared, permit, url, server, 1)) {
+    shared->numHedges++;
+  }
+  waitUntil(attempts->cv, ul, attemptDeadline, finished);
+  if (attempts->winner >= 0) {
+    if (attempts->winner == 1) shared->numHedgeWins++;
+    document = attempts->document;
+    return kAttemptSucceeded;
+  }
+  if (attempts->numPending == 0) return kAttemptFailed;
+  shared->numTimeouts++;
+  return kAttemptTimedOut;
+}
+
+ArticleFetcher::Outcome ArticleFetcher::fetch(const string& url, shared_ptr<HTMLDocument>& document,
+                                              const shared_ptr<ConcurrencyPermit>& permit) {
+  static thread_local minstd_rand jitter(hash<thread::id>()(this_thread::get_id()));
+  string server = getURLServer(url);
+  for (size_t attempt = 0; ; attempt++) {
+    if (isPastDeadline()) break;
+    Attempt result = tryOnce(url, server, document, permit);
+    if (result == kAttemptSucceeded) return kSucceeded;
+    if (isPastDeadline()) break;
+    if (result == kAttemptFailed || attempt == policy.maxRetries) return kFailed;
+
+    // Back off for between half and all of the capped exponential delay
+    double backoff = min(policy.maxBackoff, policy.initialBackoff * pow(2.0, attempt));
+    backoff *= 0.5 + 0.5 * (jitter() - jitter.min()) / double(jitter.max() - jitter.min());
+    time_point resume = chrono::steady_clock::now() + toDuration(backoff);
+    this_thread::sleep_until(min(resume, deadline));
+    shared->numRetries++;
+  }
+  shared->numPastDeadline++;
+  return kPastDeadline;
+}
+
+FetchStats ArticleFetcher::getStats() const {
+  FetchStats stats;
+  stats.numRetries = shared->numRetries;
+  stats.numTimeouts = shared->numTimeouts;
+  stats.numRefused = shared->numRefused;
+  stats.numHedges = shared->numHedges;
+  stats.numHedgeWins = shared->numHedgeWins;
+  stats.numPastDeadline = shared->numPastDeadline;
+  return stats;
+}
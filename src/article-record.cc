@@ -0,0 +1,75 @@
+/**
+ * File: article-record.cc
+ * -----------------------
+ * Presents the implementation of the article record encoding.
+ */
+
+#include "article-record.h"
+using namespace std;
+
+void appendUint32(string& out, uint32_t value) {
+  for (size_t i = 0; i < 4; i++) out += static_cast<char>((value >> (8 * i)) & 0xff);
+}
+
+uint32_t readUint32(const char *data) {
+  uint32_t value = 0;
+  for (size_t i = 0; i < 4; i++) value |= uint32_t(static_cast<unsigned char>(data[i])) << (8 * i);
+  return value;
+}
+
+void appendVarint(string& out, uint64_t value) {
+  while (value >= 0x80) {
+    out += static_cast<char>((value & 0x7f) | 0x80);
+    value >>= 7;
+  }
+  out += static_cast<char>(value);
+}
+
+bool readVarint(const char *& data, const char *end, uint64_t& value) {
+  value = 0;
+  for (size_t shift = 0; data < end && shift < 64; shift += 7) {
+    unsigned char byte = *data++;
+    value |= uint64_t(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) return true;
+  }
+  return false;
+}
+
+void appendString(string& out, token_view str) {
+  appendVarint(out, str.size());
+  out.append(str.data(), str.size());
+}
+
+bool readString(const char *& data, const char *end, token_view& str) {
+  uint64_t length;
+  if (!readVarint(data, end, length) || length > uint64_t(end - data)) return false;
+  str = token_view(data, length);
+  data += length;
+  return true;
+}
+
+void appendArticleRecord(string& out, const Article& article, const TokenBag& bag) {
+  appendString(out, article.url);
+  appendString(out, article.title);
+  appendVarint(out, bag.size());
+  for (size_t i = 0; i < bag.size(); i++) {
+    appendString(out, bag.term(i));
+    appendVarint(out, bag.count(i));
+  }
+}
+
+bool readArticleRecord(const char *& data, const char *end, Article& article, TokenBag& bag,
+                       vector<token_view>& scratch) {
+  token_view url, title, term;
+  uint64_t numTerms, count;
+  if (!readString(data, end, url) || !readString(data, end, title) || !readVarint(data, end, numTerms)) return false;
+  scratch.clear();
+  for (uint64_t i = 0; i < numTerms; i++) {
+    if (!readString(data, end, term) || !readVarint(data, end, count)) return false;
+    scratch.insert(scratch.end(), count, term); // assign collapses the run back into one entry
+  }
+  article.url = url.to_string();
+  article.title = title.to_string();
+  bag.assign(scratch.data(), scratch.size());
+  return true;
+}
@@ -0,0 +1,103 @@
+/**
+ * File: concurrency-controller.cc
+ * -------------------------------
+ * Presents the implementation of the ConcurrencyController class.
+ */
+
+#include "concurrency-controller.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+using namespace std;
+
+constexpr double ConcurrencyController::kBackoff;
+constexpr double ConcurrencyController::kLatencyTolerance;
+constexpr double ConcurrencyController::kMaxFailureFraction;
+
+static const size_t kMinWindow = 8;         // completions judged together, at the least
+static const double kLatencySlack = 0.005;  // seconds of latency growth ignored as noise
+
+ConcurrencyController::ConcurrencyController(size_t minLimit, size_t maxLimit):
+  minLimit(max<size_t>(minLimit, 1)), maxLimit(max(maxLimit, max<size_t>(minLimit, 1))),
+  limit(this->minLimit), inFlight(0), slowStart(true),
+  totalLatency(0), numSucceeded(0), windowCompletions(0), windowFailures(0), windowLatency(0),
+  windowSaturated(false), bestLatency(0),
+  lowestLimit(this->minLimit), highestLimit(this->minLimit), numIncreases(0), numDecreases(0) {}
+
+void ConcurrencyController::acquire() {
+  unique_lock<mutex> ul(m);
+  if (inFlight >= size_t(limit)) windowSaturated = true;
+  cv.wait(ul, [this] { return inFlight < size_t(limit); });
+  inFlight++;
+  if (inFlight == size_t(limit)) windowSaturated = true;
+}
+
+void ConcurrencyController::release(double latency, bool succeeded) {
+  lock_guard<mutex> lg(m);
+  inFlight--;
+  windowCompletions++;
+  if (succeeded) {
+    numSucceeded++;
+    totalLatency += latency;
+    windowLatency += latency;
+  } else {
+    windowFailures++;
+  }
+  if (windowCompletions >= max(kMinWindow, size_t(limit))) endWindow();
+  cv.notify_all();
+}
+
+void ConcurrencyController::endWindow() {
+  size_t windowSucceeded = windowCompletions - windowFailures;
+  double meanLatency = windowSucceeded == 0 ? 0 : windowLatency / windowSucceeded;
+  bool slow = bestLatency > 0 && meanLatency > kLatencyTolerance * bestLatency + kLatencySlack;
+  bool congested = slow || windowFailures > kMaxFailureFraction * windowCompletions;
+  if (meanLatency > 0 && (bestLatency == 0 || meanLatency < bestLatency || (slow && size_t(limit) == minLimit)))
+    bestLatency = meanLatency;
+
+  double previous = limit;
+  if (congested) {
+    slowStart = false;
+    limit = max(double(minLimit), floor(limit * kBackoff));
+  } else if (windowSaturated) {
+    limit = min(double(maxLimit), slowStart ? limit * 2 : limit + 1);
+  }
+  if (size_t(limit) < size_t(previous)) numDecreases++;
+  if (size_t(limit) > size_t(previous)) numIncreases++;
+  lowestLimit = min(lowestLimit, size_t(limit));
+  highestLimit = max(highestLimit, size_t(limit));
+  windowCompletions = windowFailures = 0;
+  windowLatency = 0;
+  windowSaturated = false;
+}
+
+size_t ConcurrencyController::getLimit() const {
+  lock_guard<mutex> lg(m);
+  return size_t(limit);
+}
+
+ConcurrencyStats ConcurrencyController::getStats() const {
+  lock_guard<mutex> lg(m);
+  ConcurrencyStats stats;
+  stats.finalLimit = size_t(limit);
+  stats.lowestLimit = lowestLimit;
+  stats.highestLimit = highestLimit;
+  stats.numIncreases = numIncreases;
+  stats.numDecreases = numDecreases;
+  stats.meanLatency = numSucceeded == 0 ? 0 : totalLatency / numSucceeded;
+  return stats;
+}
+
+static uint64_t nowNanoseconds() {
+  return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+ConcurrencyPermit::ConcurrencyPermit(ConcurrencyController& controller): controller(controller), succeeded(false) {
+  controller.acquire();
+  start = nowNanoseconds();
+}
+
+ConcurrencyPermit::~ConcurrencyPermit() {
+  controller.release((nowNanoseconds() - start) / 1e9, succeeded);
+}
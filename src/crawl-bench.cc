@@ -0,0 +1,341 @@
+/**
+ * File: crawl-bench.cc
+ * --------------------
+ * End-to-end crawl benchmark.  Starts a handful of synthetic HTTP "hosts" on
+ * loopback ports, each serving generated RSS feeds and HTML articles, points
+ * a NewsAggregator at the feed list they publish, and times buildIndex.
+ * Everything served is a deterministic function of the request path and the
+ * configuration, so runs are reproducible and need no network access.
+ *
+ *   ./crawl-bench [--hosts <n>] [--feeds <n>] [--articles <n>] [--words <n>]
+ *                 [--vocabulary <n>] [--duplicates <ratio>] [--latency <ms>[,<ms>...]]
+ *                 [--errors <ratio>[,<ratio>...]] [-- <aggregate flags>]
+ *
+ * Each host i answers after latency[i % #latencies] milliseconds, and answers
+ * an errors[i % #errors] fraction of its article requests with a 500.  A
+ * duplicates fraction of each feed's items repeat an earlier item's title
+ * and body under a second URL.  Anything after "--" is passed along to the
+ * aggregator (--keep-near-duplicates, say, or --no-stemming).
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+#include <random>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+
+#include "news-aggregator.h"
+#include "socket-utils.h"
+#include "trace.h"
+using namespace std;
+
+struct CrawlConfig {
+  size_t numHosts = 4;
+  size_t numFeeds = 16;
+  size_t numArticlesPerFeed = 32;
+  size_t numWordsPerArticle = 400;
+  size_t vocabularySize = 5000;
+  double duplicateRatio = 0.1;
+  vector<size_t> latencies = {0}; // in milliseconds
+  vector<double> errorRates = {0.0};
+};
+
+static void usage(const char *executable) {
+  cerr << "Usage: " << executable << " [--hosts <n>] [--feeds <n>] [--articles <n>] [--words <n>]"
+       << " [--vocabulary <n>] [--duplicates <ratio>] [--latency <ms>[,<ms>...]]"
+       << " [--errors <ratio>[,<ratio>...]]"
+       << " [-- <aggregate flags>]" << endl;
+  exit(1);
+}
+
+/**
+ * Returns a number in [0, 1) determined entirely by the supplied key.
+ */
+static double fraction(const string& key) {
+  return (hash<string>()(key) % 1000000) / 1000000.0;
+}
+
+class SyntheticWeb {
+ public:
+  SyntheticWeb(const CrawlConfig& config): config(config), numRequests(0), numArticlesServed(0),
+                                           numErrors(0), numBytes(0) {
+    mt19937 generator(110);
+    for (size_t i = 0; i < config.vocabularySize; i++) {
+      size_t length = 3 + generator() % 8;
+      string word;
+      for (size_t j = 0; j < length; j++) word += char('a' + generator() % 26);
+      vocabulary.push_back(word);
+    }
+  }
+
+  ~SyntheticWeb() { stop(); }
+
+  // Binds one listener per host; returns false if any can't be bound
+  bool start() {
+    for (size_t i = 0; i < config.numHosts; i++) {
+      int fd = createServerSocket("0", 1024);
+      if (fd < 0) return false;
+      struct sockaddr_in address;
+      socklen_t length = sizeof(address);
+      getsockname(fd, reinterpret_cast<struct sockaddr *>(&address), &length);
+      listeners.push_back(fd);
+      ports.push_back(ntohs(address.sin_port));
+    }
+    for (size_t i = 0; i < config.numHosts; i++) acceptors.push_back(thread([this, i] { accept(i); }));
+    return true;
+  }
+
+  void stop() {
+    for (int fd: listeners) shutdown(fd, SHUT_RDWR);
+    for (thread& acceptor: acceptors) acceptor.join();
+    for (int fd: listeners) close(fd);
+    acceptors.clear();
+    listeners.clear();
+    map<size_t, thread> remaining;
+    {
+      lock_guard<mutex> lg(connectionsLock); // released before joining, since each thread takes it on its way out
+      remaining.swap(connections);
+      finished.clear();
+    }
+    for (auto& connection: remaining) connection.second.join();
+  }
+
+  string getFeedListURL() const { return hostURL(0) + "/feeds.xml"; }
+  size_t getNumRequests() const { return numRequests; }
+  size_t getNumArticlesServed() const { return numArticlesServed; }
+  size_t getNumErrors() const { return numErrors; }
+  size_t getNumBytes() const { return numBytes; }
+
+ private:
+  const CrawlConfig& config;
+  vector<string> vocabulary;
+  vector<int> listeners;
+  vector<unsigned short> ports;
+  vector<thread> acceptors;
+  map<size_t, thread> connections; // by sequence number
+  vector<size_t> finished; // connections whose threads are done serving and can be joined
+  size_t nextConnection = 0;
+  mutex connectionsLock;
+  atomic<size_t> numRequests;
+  atomic<size_t> numArticlesServed;
+  atomic<size_t> numErrors;
+  atomic<size_t> numBytes;
+
+  string hostURL(size_t host) const { return "http://127.0.0.1:" + to_string(ports[host]); }
+
+  void accept(size_t host) {
+    while (true) {
+      int client = ::accept(listeners[host], NULL, NULL);
+      if (client < 0) return;
+      lock_guard<mutex> lg(connectionsLock);
+      for (size_t done: finished) {
+        connections[done].join();
+        connections.erase(done);
+      }
+      finished.clear();
+      size_t id = nextConnection++;
+      connections[id] = thread([this, host, client, id] {
+        serve(host, client);
+        lock_guard<mutex> lg(connectionsLock);
+        finished.push_back(id);
+      });
+    }
+  }
+
+  void serve(size_t host, int client) {
+    SocketLineReader reader(client);
+    string requestLine, header;
+    if (reader.readLine(requestLine)) {
+      while (reader.readLine(header) && !header.empty()) {}
+      istringstream iss(requestLine);
+      string method, path;
+      iss >> method >> path;
+      numRequests++;
+      size_t latency = config.latencies[host % config.latencies.size()];
+      if (latency > 0) this_thread::sleep_for(chrono::milliseconds(latency));
+      int status = 200;
+      string contentType, body;
+      respond(host, path, status, contentType, body);
+      if (status != 200) numErrors++;
+      ostringstream response;
+      response << "HTTP/1.1 " << status << (status == 200 ? " OK" : status == 404 ? " Not Found" : " Internal Server Error")
+               << "\r\nContent-Type: " << contentType << "\r\nContent-Length: " << body.size()
+               << "\r\nConnection: close\r\n\r\n" << body;
+      numBytes += body.size();
+      writeFully(client, response.str());
+    }
+    close(client);
+  }
+
+  void respond(size_t host, const string& path, int& status, string& contentType, string& body) {
+    string resource = path.substr(0, path.find('?')); // duplicates differ only in their query strings
+    size_t feed, article;
+    contentType = "text/xml";
+    if (resource == "/feeds.xml") {
+      body = feedList();
+    } else if (sscanf(resource.c_str(), "/feed/%zu.xml", &feed) == 1 && feed < config.numFeeds) {
+      body = feedItems(feed);
+    } else if (sscanf(resource.c_str(), "/article/%zu/%zu.html", &feed, &article) == 2) {
+      contentType = "text/html";
+      if (fraction("error" + path) < config.errorRates[host % config.errorRates.size()]) {
+        status = 500;
+        body = "<html><body>Internal Server Error</body></html>";
+      } else {
+        numArticlesServed++;
+        body = articlePage(feed, article);
+      }
+    } else {
+      status = 404;
+      contentType = "text/html";
+      body = "<html><body>Not Found</body></html>";
+    }
+  }
+
+  string feedList() const {
+    ostringstream oss;
+    oss << "<?xml version=\"1.0\" encoding=\"iso-8859-1\" ?>\n<rss version=\"2.0\">\n  <channel>\n";
+    for (size_t feed = 0; feed < config.numFeeds; feed++) {
+      oss << "    <item>\n      <title>Synthetic Feed " << feed << "</title>\n"
+          << "      <link>" << hostURL(feed % config.numHosts) << "/feed/" << feed << ".xml</link>\n    </item>\n";
+    }
+    oss << "  </channel>\n</rss>\n";
+    return oss.str();
+  }
+
+  string feedItems(size_t feed) const {
+    ostringstream oss;
+    oss << "<?xml version=\"1.0\" encoding=\"utf-8\" ?>\n<rss version=\"2.0\">\n  <channel>\n"
+        << "    <title>Synthetic Feed " << feed << "</title>\n";
+    size_t latest = 0;
+    for (size_t article = 0; article < config.numArticlesPerFeed; article++) {
+      // A duplicate republishes the latest original story under a second URL
+      size_t original = article;
+      string suffix;
+      if (article > 0 && fraction("duplicate/" + to_string(feed) + "/" + to_string(article)) < config.duplicateRatio) {
+        original = latest;
+        suffix = "?copy=" + to_string(article);
+      } else {
+        latest = article;
+      }
+      oss << "    <item>\n      <title>Synthetic Story " << feed << "-" << original << "</title>\n"
+          << "      <link>" << hostURL((feed + original) % config.numHosts) << "/article/" << feed << "/"
+          << original << ".html" << suffix << "</link>\n    </item>\n";
+    }
+    oss << "  </channel>\n</rss>\n";
+    return oss.str();
+  }
+
+  string articlePage(size_t feed, size_t article) const {
+    // Word frequencies are skewed toward the front of the vocabulary
+    mt19937 generator(feed * 1000003 + article);
+    uniform_real_distribution<double> uniform(0, 1);
+    ostringstream oss;
+    oss << "<html><head><title>Synthetic Story " << feed << "-" << article << "</title></head><body><p>";
+    for (size_t i = 0; i < config.numWordsPerArticle; i++) {
+      double u = uniform(generator);
+      oss << vocabulary[size_t(u * u * u * vocabulary.size())] << (i % 12 == 11 ? ".</p><p>" : " ");
+    }
+    oss << "</p></body></html>\n";
+    return oss.str();
+  }
+};
+
+static bool parseArguments(int argc, char *argv[], CrawlConfig& config, vector<string>& aggregatorFlags) {
+  for (int i = 1; i < argc; i++) {
+    string flag = argv[i];
+    if (flag == "--") {
+      aggregatorFlags.assign(argv + i + 1, argv + argc);
+      return true;
+    }
+    if (i + 1 == argc) return false;
+    const char *value = argv[++i];
+    if (flag == "--hosts") config.numHosts = strtoul(value, NULL, 10);
+    else if (flag == "--feeds") config.numFeeds = strtoul(value, NULL, 10);
+    else if (flag == "--articles") config.numArticlesPerFeed = strtoul(value, NULL, 10);
+    else if (flag == "--words") config.numWordsPerArticle = strtoul(value, NULL, 10);
+    else if (flag == "--vocabulary") config.vocabularySize = strtoul(value, NULL, 10);
+    else if (flag == "--duplicates") config.duplicateRatio = strtod(value, NULL);
+    else if (flag == "--errors") {
+      config.errorRates.clear();
+      istringstream iss(value);
+      string errorRate;
+      while (getline(iss, errorRate, ',')) config.errorRates.push_back(strtod(errorRate.c_str(), NULL));
+    } else if (flag == "--latency") {
+      config.latencies.clear();
+      istringstream iss(value);
+      string latency;
+      while (getline(iss, latency, ',')) config.latencies.push_back(strtoul(latency.c_str(), NULL, 10));
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+  CrawlConfig config;
+  vector<string> aggregatorFlags;
+  if (!parseArguments(argc, argv, config, aggregatorFlags) || config.numHosts == 0 ||
+      config.vocabularySize == 0 || config.latencies.empty() ||
+      config.errorRates.empty()) {
+    usage(argv[0]);
+  }
+
+  SyntheticWeb web(config);
+  if (!web.start()) {
+    cerr << "Could not bind the synthetic hosts to loopback ports." << endl;
+    return 1;
+  }
+
+  vector<string> arguments = {argv[0], "--quiet", "--url", web.getFeedListURL()};
+  arguments.insert(arguments.end(), aggregatorFlags.begin(), aggregatorFlags.end());
+  vector<char *> aggregatorArgv;
+  for (string& argument: arguments) aggregatorArgv.push_back(&argument[0]);
+  aggregatorArgv.push_back(NULL);
+
+  Tracer::enable();
+  unique_ptr<NewsAggregator> aggregator(NewsAggregator::createNewsAggregator(aggregatorArgv.size() - 1,
+                                                                            aggregatorArgv.data()));
+  auto start = chrono::steady_clock::now();
+  aggregator->buildIndex();
+  double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  web.stop();
+
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  size_t numArticles = web.getNumArticlesServed();
+  cout << config.numHosts << " hosts, " << config.numFeeds << " feeds, " << config.numArticlesPerFeed
+       << " articles per feed, " << config.numWordsPerArticle << " words per article" << endl;
+  cout << fixed << setprecision(3) << "Crawled " << numArticles << " articles (" << web.getNumRequests()
+       << " requests, " << web.getNumErrors() << " errors, " << setprecision(1)
+       << web.getNumBytes() / double(1 << 20) << " MiB) in " << setprecision(3) << elapsed << "s: "
+       << setprecision(1) << numArticles / elapsed << " articles/sec" << endl;
+  cout << "Peak RSS: " << usage.ru_maxrss / 1024.0 << " MiB" << endl;
+
+  vector<TraceTotal> phases = Tracer::summarize();
+  sort(phases.begin(), phases.end(), [](const TraceTotal& one, const TraceTotal& two) {
+    return one.nanoseconds > two.nanoseconds;
+  });
+  cout << "Per-phase totals (summed across threads):" << endl;
+  for (const TraceTotal& phase: phases) {
+    cout << "  " << left << setw(32) << phase.name << right << setw(8) << phase.count << " spans "
+         << setw(12) << setprecision(1) << phase.nanoseconds / 1e6 << " ms " << setw(12)
+         << phase.nanoseconds / 1e3 / phase.count << " us/span" << endl;
+  }
+  return 0;
+}
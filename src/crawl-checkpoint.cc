@@ -0,0 +1,175 @@
+/**
+ * File: crawl-checkpoint.cc
+ * -------------------------
+ * Presents the implementation of the CrawlCheckpoint class.
+ */
+
+#include "crawl-checkpoint.h"
+#include "article-record.h"
+#include "utils.h"
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <chrono>
+#include <algorithm>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+using namespace std;
+
+static const char kMagic[8] = {'N', 'A', 'C', 'K', 'P', 'T', '2', '\n'};
+static const size_t kHeaderSize = 8; // payload length and checksum
+static const chrono::milliseconds kSyncInterval(250);
+static const size_t kMaxBatchSize = 256;
+static const size_t kLoadChunkSize = 1 << 20; // the log is read back a megabyte at a time
+
+static uint32_t checksum(const char *data, size_t length) {
+  return static_cast<uint32_t>(hash64(data, length)); // the low half of hash64 is as good as any 32 bits of it
+}
+
+CrawlCheckpoint::CrawlCheckpoint(const string& filename):
+  filename(filename), fd(-1), numResumed(0), queue(kQueueCapacity), numWritten(0), writeError(0) {}
+
+CrawlCheckpoint::~CrawlCheckpoint() {
+  if (writer.joinable()) {
+    queue.close();
+    writer.join();
+  }
+  if (fd < 0) return;
+  fsync(fd);
+  close(fd);
+}
+
+/**
+ * Parses records until the first one that's incomplete or corrupt, leaving
+ * validLength just past the last good one.  The log is streamed through a
+ * buffer that holds a chunk or a single record, whichever is larger, the
+ * same way SortedRunReader reads runs.  Returns false only if the file
+ * exists but can't be read or doesn't start with the magic number.
+ */
+bool CrawlCheckpoint::load(const function<void(const Article&, TokenBag&)>& handler, size_t& validLength) {
+  validLength = 0;
+  int in = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+  if (in < 0) return errno == ENOENT; // a log that doesn't exist yet is empty
+  struct stat info;
+  if (fstat(in, &info) < 0) {
+    close(in);
+    return false;
+  }
+
+  size_t end = info.st_size, offset = 0, position = 0;
+  string buffer;
+  bool readFailed = false;
+  // Makes sure the buffer holds at least needed bytes past position
+  auto fill = [&](size_t needed) {
+    if (buffer.size() - position >= needed) return true;
+    buffer.erase(0, position);
+    position = 0;
+    while (buffer.size() < needed && offset < end) {
+      size_t count = min(max(kLoadChunkSize, needed - buffer.size()), end - offset);
+      size_t start = buffer.size();
+      buffer.resize(start + count);
+      ssize_t numRead = pread(in, &buffer[start], count, offset);
+      if (numRead < 0 && errno == EINTR) numRead = 0;
+      else if (numRead <= 0) readFailed = true;
+      buffer.resize(start + max(numRead, ssize_t(0)));
+      if (readFailed) return false;
+      offset += numRead;
+    }
+    return buffer.size() >= needed;
+  };
+
+  bool loaded = end == 0 || (fill(sizeof(kMagic)) && memcmp(buffer.data(), kMagic, sizeof(kMagic)) == 0);
+  if (loaded && end > 0) {
+    position = validLength = sizeof(kMagic);
+    Article article;
+    vector<token_view> scratch;
+    while (fill(kHeaderSize)) {
+      uint32_t length = readUint32(buffer.data() + position);
+      if (length > end - validLength - kHeaderSize || !fill(kHeaderSize + length)) break;
+      const char *payload = buffer.data() + position + kHeaderSize, *payloadEnd = payload + length;
+      if (checksum(payload, length) != readUint32(buffer.data() + position + 4)) break;
+
+      const char *data = payload;
+      TokenBag bag;
+      if (!readArticleRecord(data, payloadEnd, article, bag, scratch) || data != payloadEnd) break;
+      handler(article, bag);
+      numResumed++;
+      position += kHeaderSize + length;
+      validLength += kHeaderSize + length;
+    }
+    loaded = !readFailed; // a log that can't be read mustn't be truncated as though it were torn
+  }
+  close(in);
+  return loaded;
+}
+
+bool CrawlCheckpoint::open(bool resume, const function<void(const Article&, TokenBag&)>& handler) {
+  size_t validLength = 0;
+  if (resume && !load(handler, validLength)) return false;
+  fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC | (resume ? 0 : O_TRUNC), 0644);
+  if (fd < 0) return false;
+  // Drop any torn record a crash left at the end, and start an empty log with the magic number
+  if (resume && ftruncate(fd, validLength) < 0) return false;
+  if (validLength == 0 && write(fd, kMagic, sizeof(kMagic)) != ssize_t(sizeof(kMagic))) return false;
+  writer = thread([this] { runWriter(); });
+  return true;
+}
+
+void CrawlCheckpoint::recordArticle(const Article& article, const TokenBag& bag) {
+  if (writeError.load(memory_order_relaxed) != 0) return; // checkpointing has stopped
+  // Checkpoint records are never dropped, so a full queue means waiting for room
+  queue.push(true, [&](string& record) {
+    record.assign(kHeaderSize, '\0');
+    appendArticleRecord(record, article, bag);
+    string header;
+    appendUint32(header, record.size() - kHeaderSize);
+    appendUint32(header, checksum(record.data() + kHeaderSize, record.size() - kHeaderSize));
+    record.replace(0, kHeaderSize, header);
+  });
+}
+
+// Returns 0, or the errno of the write that failed
+static int appendFully(int fd, const string& batch) {
+  size_t written = 0;
+  while (written < batch.size()) {
+    ssize_t count = write(fd, batch.data() + written, batch.size() - written);
+    if (count < 0) {
+      if (errno == EINTR) continue;
+      return errno;
+    }
+    written += count;
+  }
+  return 0;
+}
+
+void CrawlCheckpoint::runWriter() {
+  size_t position = 0;
+  string batch;
+  bool unsynced = false;
+  chrono::steady_clock::time_point lastSync = chrono::steady_clock::now();
+  auto append = [this, &batch](const string& record) {
+    if (writeError == 0) batch += record; // after a failure, records are just drained
+  };
+  while (true) {
+    size_t numPopped = queue.pop(kMaxBatchSize, append);
+    position += numPopped;
+    if (!batch.empty()) {
+      int error = appendFully(fd, batch);
+      if (error != 0) writeError = error;
+      else numWritten.store(position);
+      batch.clear();
+      unsynced = error == 0;
+    }
+    // With appends outstanding, sleep only until the next sync is due, and
+    // sync early if the log is closing
+    bool quiet = numPopped == 0 && unsynced && !queue.waitUntil(lastSync + kSyncInterval);
+    if (unsynced && (quiet || chrono::steady_clock::now() - lastSync >= kSyncInterval)) {
+      if (fdatasync(fd) < 0) writeError = errno;
+      unsynced = false;
+      lastSync = chrono::steady_clock::now();
+    }
+    if (numPopped == 0 && !unsynced && !queue.wait()) break;
+  }
+}
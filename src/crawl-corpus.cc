@@ -0,0 +1,175 @@
+/**
+ * File: crawl-corpus.cc
+ * ---------------------
+ * Presents the implementation of the CrawlCorpus class.
+ */
+
+#include "crawl-corpus.h"
+#include "utils.h"
+#include <atomic>
+#include <cstdio>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+static const char *kManifestName = "manifest";
+static const char *kFailureHash = "-";
+
+static string hashContents(const string& contents) {
+  char hex[17];
+  snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(hash64(contents)));
+  return hex;
+}
+
+static void appendField(string& contents, const string& field) {
+  contents += field;
+  contents += '\0';
+}
+
+// Calls visit on each NUL-terminated field in turn
+template <typename Visitor>
+static void forEachField(token_view contents, Visitor visit) {
+  while (!contents.empty()) {
+    size_t end = contents.find('\0');
+    if (end == token_view::npos) end = contents.size(); // tolerate a missing final terminator
+    visit(contents.substr(0, end));
+    contents.remove_prefix(min(end + 1, contents.size()));
+  }
+}
+
+CrawlCorpus::~CrawlCorpus() {
+  for (const auto& entry: mappings) {
+    if (entry.second.size > 0) munmap(const_cast<char *>(entry.second.data), entry.second.size);
+  }
+}
+
+bool CrawlCorpus::open() {
+  string manifestPath = directory + "/" + kManifestName;
+  if (mode == kRecord) {
+    if (mkdir(directory.c_str(), 0755) < 0 && errno != EEXIST) return false;
+    manifest.open(manifestPath, ios::app);
+    return bool(manifest);
+  }
+
+  ifstream infile(manifestPath);
+  if (!infile) return false;
+  string line;
+  while (getline(infile, line)) {
+    size_t tab = line.find('\t');
+    if (tab == string::npos) continue;
+    hashes[line.substr(tab + 1)] = line.substr(0, tab); // later entries win
+  }
+  numEntries = hashes.size();
+  return true;
+}
+
+void CrawlCorpus::record(const string& url, const string& contents) {
+  string hash = hashContents(contents);
+  string path = directory + "/" + hash;
+  if (access(path.c_str(), F_OK) < 0) {
+    // Write under a private name and rename, so that two threads storing the
+    // same object never see each other's partial writes
+    static atomic<size_t> numTemporaries(0);
+    string temporary = path + ".tmp" + to_string(numTemporaries++);
+    ofstream outfile(temporary, ios::binary);
+    outfile.write(contents.data(), contents.size());
+    outfile.close();
+    if (!outfile || rename(temporary.c_str(), path.c_str()) < 0) {
+      remove(temporary.c_str());
+      hash = kFailureHash;
+    }
+  }
+
+  lock_guard<mutex> lg(manifestLock);
+  manifest << hash << '\t' << url << endl;
+  numEntries++;
+}
+
+void CrawlCorpus::recordFeedList(const string& url, const map<string, string>& feeds) {
+  string contents;
+  for (const pair<const string, string>& feed: feeds) {
+    appendField(contents, feed.first);
+    appendField(contents, feed.second);
+  }
+  record(url, contents);
+}
+
+void CrawlCorpus::recordFeed(const string& url, const vector<Article>& articles) {
+  string contents;
+  for (const Article& article: articles) {
+    appendField(contents, article.url);
+    appendField(contents, article.title);
+  }
+  record(url, contents);
+}
+
+void CrawlCorpus::recordDocument(const string& url, const vector<string>& tokens) {
+  string contents;
+  for (const string& token: tokens) appendField(contents, token);
+  record(url, contents);
+}
+
+void CrawlCorpus::recordFailure(const string& url) {
+  lock_guard<mutex> lg(manifestLock);
+  manifest << kFailureHash << '\t' << url << endl;
+  numEntries++;
+}
+
+bool CrawlCorpus::lookup(const string& url, token_view& contents) const {
+  auto found = hashes.find(url);
+  if (found == hashes.end() || found->second == kFailureHash) return false;
+  const string& hash = found->second;
+
+  lock_guard<mutex> lg(mappingsLock);
+  auto mapped = mappings.find(hash);
+  if (mapped == mappings.end()) {
+    int fd = ::open((directory + "/" + hash).c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    Mapping mapping = {"", 0};
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+      void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data != MAP_FAILED) mapping = {static_cast<const char *>(data), size_t(st.st_size)};
+    }
+    close(fd);
+    mapped = mappings.emplace(hash, mapping).first;
+  }
+  contents = token_view(mapped->second.data, mapped->second.size);
+  return true;
+}
+
+bool CrawlCorpus::replayFeedList(const string& url, map<string, string>& feeds) const {
+  token_view contents;
+  if (!lookup(url, contents)) return false;
+  string feedURL;
+  bool haveURL = false;
+  forEachField(contents, [&](token_view field) {
+    if (haveURL) feeds[feedURL] = field.to_string();
+    else feedURL = field.to_string();
+    haveURL = !haveURL;
+  });
+  return true;
+}
+
+bool CrawlCorpus::replayFeed(const string& url, vector<Article>& articles) const {
+  token_view contents;
+  if (!lookup(url, contents)) return false;
+  bool haveURL = false;
+  forEachField(contents, [&](token_view field) {
+    if (haveURL) articles.back().title = field.to_string();
+    else articles.push_back(Article{field.to_string(), ""});
+    haveURL = !haveURL;
+  });
+  return true;
+}
+
+bool CrawlCorpus::replayDocument(const string& url, ArenaVector<token_view>& tokens) const {
+  token_view contents;
+  if (!lookup(url, contents)) return false;
+  forEachField(contents, [&tokens](token_view token) { tokens.push_back(token); });
+  return true;
+}
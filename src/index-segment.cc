@@ -0,0 +1,61 @@
+/**
+ * File: index-segment.cc
+ * ----------------------
+ * Presents the implementation of the IndexSegmentWriter and
+ * IndexSegmentReader classes.
+ */
+
+#include "index-segment.h"
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+using namespace std;
+
+static const char kMagic[8] = {'N', 'A', 'S', 'E', 'G', '0', '1', '\n'};
+
+IndexSegmentWriter::IndexSegmentWriter(const string& filename):
+  filename(filename), tempFilename(filename + ".tmp"), fd(-1) {}
+
+IndexSegmentWriter::~IndexSegmentWriter() {
+  if (fd < 0) return;
+  close(fd);
+  unlink(tempFilename.c_str());
+}
+
+bool IndexSegmentWriter::open() {
+  fd = ::open(tempFilename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) return false;
+  if (write(fd, kMagic, sizeof(kMagic)) != ssize_t(sizeof(kMagic))) return false;
+  writer.reset(new SortedRunWriter(fd));
+  return true;
+}
+
+bool IndexSegmentWriter::append(const ArticleKey& key, const Article& article, const TokenBag& bag) {
+  return writer->append(key, article, bag);
+}
+
+bool IndexSegmentWriter::commit() {
+  if (!writer->finish() || fsync(fd) < 0) return false;
+  close(fd);
+  fd = -1;
+  return rename(tempFilename.c_str(), filename.c_str()) == 0;
+}
+
+IndexSegmentReader::IndexSegmentReader(const string& filename): filename(filename), fd(-1) {}
+
+IndexSegmentReader::~IndexSegmentReader() {
+  if (fd >= 0) close(fd);
+}
+
+bool IndexSegmentReader::open() {
+  fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return false;
+  struct stat info;
+  char magic[sizeof(kMagic)];
+  if (fstat(fd, &info) < 0 || pread(fd, magic, sizeof(magic), 0) != ssize_t(sizeof(magic)) ||
+      memcmp(magic, kMagic, sizeof(kMagic)) != 0) return false;
+  reader.reset(new SortedRunReader(fd, sizeof(kMagic), info.st_size));
+  return true;
+}
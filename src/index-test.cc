@@ -0,0 +1,366 @@
+/**
+ * File: index-test.cc
+ * -------------------
+ * Unit tests for PostingList and RSSIndex.  Everything the index reports is
+ * checked against a brute-force map from each word to the articles that
+ * contain it (and how often), which is simple enough to be obviously right.
+ * A test prints what it checked, along with the first few places where the
+ * index and the map disagreed, if any; the program exits with status 1 if
+ * any check failed.
+ */
+
+#include <iostream>
+#include <sstream>
+#include <map>
+#include <string>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <cstdint>
+#include <fnmatch.h>
+
+#include "posting-list.h"
+#include "rss-index.h"
+using namespace std;
+
+static const size_t kMaxFailuresShown = 10;
+static size_t numFailures = 0;
+
+static void check(bool condition, const string& what) {
+  if (condition) return;
+  if (numFailures++ < kMaxFailuresShown) cout << "  FAILED: " << what << endl;
+}
+
+/**
+ * Appends numPostings postings with random gaps and frequencies.  Most gaps
+ * and frequencies are small, but every so often one needs a two- or
+ * three-byte varint.  Returns the (document id, frequency) pairs appended.
+ */
+static vector<pair<uint32_t, uint32_t>> appendPostings(PostingList& list, size_t numPostings, unsigned seed) {
+  mt19937 generator(seed);
+  vector<pair<uint32_t, uint32_t>> expected;
+  uint32_t docId = generator() % 3;
+  for (size_t i = 0; i < numPostings; i++) {
+    if (i > 0) docId += 1 + generator() % (i % 5 == 0 ? 100000 : 100);
+    uint32_t frequency = 1 + generator() % (i % 7 == 0 ? 1000 : 5);
+    list.append(docId, frequency);
+    expected.push_back(make_pair(docId, frequency));
+  }
+  return expected;
+}
+
+static string describe(size_t numPostings, const string& what) {
+  ostringstream oss;
+  oss << numPostings << " postings: " << what;
+  return oss.str();
+}
+
+static void checkPostingList(size_t numPostings) {
+  PostingList list;
+  vector<pair<uint32_t, uint32_t>> expected = appendPostings(list, numPostings, numPostings);
+  check(list.size() == numPostings, describe(numPostings, "size() is wrong"));
+
+  size_t i = 0;
+  for (PostingList::Cursor cursor(list); !cursor.done(); cursor.next(), i++) {
+    if (i == numPostings) break;
+    check(cursor.docId() == expected[i].first && cursor.frequency() == expected[i].second,
+          describe(numPostings, "posting " + to_string(i) + " doesn't match what was appended"));
+  }
+  check(i == numPostings, describe(numPostings, "iteration visited " + to_string(i) + " postings"));
+
+  // Each block's maximum frequency, and nextBlock landing on the first posting of the next block
+  size_t numBlocks = 0;
+  for (PostingList::Cursor cursor(list); !cursor.done(); cursor.nextBlock(), numBlocks++) {
+    size_t start = numBlocks * PostingList::kBlockSize;
+    size_t end = min(start + PostingList::kBlockSize, numPostings);
+    uint32_t maxFrequency = 0;
+    for (size_t j = start; j < end; j++) maxFrequency = max(maxFrequency, expected[j].second);
+    check(cursor.blockMaxFrequency() == maxFrequency,
+          describe(numPostings, "block " + to_string(numBlocks) + " has the wrong maximum frequency"));
+    check(cursor.docId() == expected[start].first,
+          describe(numPostings, "block " + to_string(numBlocks) + " doesn't start where it should"));
+  }
+  size_t expectedBlocks = (numPostings + PostingList::kBlockSize - 1) / PostingList::kBlockSize;
+  check(numBlocks == expectedBlocks, describe(numPostings, "nextBlock visited " + to_string(numBlocks) + " blocks"));
+
+  // advanceTo from a fresh cursor, to every document id and to the gap just before each
+  for (size_t j = 0; j < numPostings; j++) {
+    PostingList::Cursor exact(list);
+    exact.advanceTo(expected[j].first);
+    check(!exact.done() && exact.docId() == expected[j].first && exact.frequency() == expected[j].second,
+          describe(numPostings, "advanceTo(" + to_string(expected[j].first) + ") missed it"));
+    if (expected[j].first == 0) continue;
+    PostingList::Cursor before(list);
+    before.advanceTo(expected[j].first - 1);
+    size_t landing = (j > 0 && expected[j - 1].first == expected[j].first - 1) ? j - 1 : j;
+    check(!before.done() && before.docId() == expected[landing].first,
+          describe(numPostings, "advanceTo(" + to_string(expected[j].first - 1) + ") landed in the wrong place"));
+  }
+
+  // One cursor advanced through increasing targets, as intersections do
+  mt19937 generator(numPostings + 1);
+  PostingList::Cursor cursor(list);
+  uint32_t target = 0;
+  while (!cursor.done()) {
+    target += generator() % 20000;
+    cursor.advanceTo(target);
+    auto found = lower_bound(expected.begin(), expected.end(), make_pair(target, uint32_t(0)));
+    if (found == expected.end()) {
+      check(cursor.done(), describe(numPostings, "advanceTo(" + to_string(target) + ") should have finished"));
+    } else {
+      check(!cursor.done() && cursor.docId() == found->first,
+            describe(numPostings, "successive advanceTo(" + to_string(target) + ") landed in the wrong place"));
+    }
+  }
+  cout << "  " << numPostings << " posting" << (numPostings == 1 ? "" : "s") << " in " << numBlocks
+       << " block" << (numBlocks == 1 ? "" : "s") << ": checked." << endl;
+}
+
+static void blockBoundariesTest() {
+  for (size_t numPostings: {1, 127, 128, 129, 255, 256, 257, 1000}) checkPostingList(numPostings);
+}
+
+static void advancePastEndTest() {
+  PostingList empty;
+  PostingList::Cursor nothing(empty);
+  check(nothing.done(), "a cursor over an empty list isn't done");
+  nothing.advanceTo(0);
+  check(nothing.done(), "advanceTo on an empty list isn't done");
+
+  for (size_t numPostings: {127, 128, 129}) {
+    PostingList list;
+    vector<pair<uint32_t, uint32_t>> expected = appendPostings(list, numPostings, numPostings);
+    uint32_t last = expected.back().first;
+    for (uint32_t target: {last + 1, last + 1000, numeric_limits<uint32_t>::max()}) {
+      PostingList::Cursor cursor(list);
+      cursor.advanceTo(target);
+      check(cursor.done(), describe(numPostings, "advanceTo(" + to_string(target) + ") past the end isn't done"));
+      cursor.advanceTo(target);
+      check(cursor.done(), describe(numPostings, "advanceTo once done isn't still done"));
+    }
+    PostingList::Cursor cursor(list);
+    cursor.advanceTo(last);
+    check(!cursor.done() && cursor.docId() == last, describe(numPostings, "advanceTo the last posting missed it"));
+    cursor.next();
+    check(cursor.done(), describe(numPostings, "next past the last posting isn't done"));
+  }
+  cout << "  advanceTo past the end of 0, 127, 128 and 129 postings: checked." << endl;
+}
+
+/**
+ * The brute-force index: every word, and the articles containing it with
+ * their frequencies.  A pattern's matches are the union over every word it
+ * matches, with the frequencies summed.
+ */
+typedef map<string, map<Article, int>> ReferenceIndex;
+
+static map<Article, int> referenceMatches(const ReferenceIndex& reference, const string& pattern) {
+  map<Article, int> matches;
+  for (const auto& entry: reference) {
+    if (fnmatch(pattern.c_str(), entry.first.c_str(), 0) != 0) continue;
+    for (const auto& match: entry.second) matches[match.first] += match.second;
+  }
+  return matches;
+}
+
+static vector<pair<Article, int>> rankMatches(const map<Article, int>& matches) {
+  vector<pair<Article, int>> ranked(matches.begin(), matches.end());
+  sort(ranked.begin(), ranked.end(), [](const pair<Article, int>& one, const pair<Article, int>& two) {
+    return one.second > two.second || (one.second == two.second && one.first < two.first);
+  });
+  return ranked;
+}
+
+static bool sameResults(const vector<pair<Article, int>>& results, const vector<pair<Article, int>>& expected) {
+  if (results.size() != expected.size()) return false;
+  for (size_t i = 0; i < results.size(); i++) {
+    if (results[i].first.url != expected[i].first.url || results[i].second != expected[i].second) return false;
+  }
+  return true;
+}
+
+/**
+ * Adds articles [from, to) to both the index and the reference.  Word i is
+ * chosen with a skewed distribution, so low-numbered words turn up in
+ * hundreds of articles (and so span several blocks) and high-numbered ones
+ * in just a few.
+ */
+static void addArticles(RSSIndex& index, ReferenceIndex& reference, size_t from, size_t to, mt19937& generator) {
+  for (size_t i = from; i < to; i++) {
+    Article article = {"http://example.com/" + to_string(generator() % 100000) + "/" + to_string(i), "title"};
+    vector<string> words;
+    size_t numWords = generator() % 60;
+    for (size_t j = 0; j < numWords; j++) words.push_back("w" + to_string(generator() % (1 + generator() % 400)));
+    index.add(article, words);
+    for (const string& word: words) reference[word][article]++;
+  }
+}
+
+static string randomQuery(mt19937& generator) {
+  static const char *patterns[] = {"w1*", "w?", "w*3", "w1?", "*", "w2?*", "x*", "w??1", "w*1*", "?1*", "w"};
+  const size_t numPatterns = sizeof(patterns) / sizeof(patterns[0]);
+  if (generator() % 2 == 0) return patterns[generator() % numPatterns];
+  return "w" + to_string(generator() % 500);
+}
+
+static void checkQueries(const RSSIndex& index, const ReferenceIndex& reference, mt19937& generator,
+                         const string& phase) {
+  const size_t kNumQueries = 100;
+  for (size_t i = 0; i < kNumQueries; i++) {
+    string query = randomQuery(generator);
+    vector<pair<Article, int>> expected = rankMatches(referenceMatches(reference, query));
+    for (size_t k: {size_t(0), size_t(1), size_t(15), numeric_limits<size_t>::max()}) {
+      size_t numMatches = 0;
+      vector<pair<Article, int>> results = index.getMatchingArticles(query, k, &numMatches);
+      vector<pair<Article, int>> best(expected.begin(), expected.begin() + min(k, expected.size()));
+      check(numMatches == expected.size() && sameResults(results, best),
+            phase + ": getMatchingArticles(\"" + query + "\", " + to_string(k) + ") disagrees");
+    }
+    if (!TermDictionary::isPattern(query)) {
+      check(sameResults(index.getMatchingArticles(query), expected),
+            phase + ": getMatchingArticles(\"" + query + "\") disagrees");
+    }
+  }
+
+  for (size_t i = 0; i < kNumQueries; i++) {
+    vector<string> words;
+    size_t numWords = 1 + generator() % 3;
+    for (size_t j = 0; j < numWords; j++) words.push_back(randomQuery(generator));
+    vector<string> distinct(words);
+    sort(distinct.begin(), distinct.end());
+    distinct.erase(unique(distinct.begin(), distinct.end()), distinct.end());
+    map<Article, int> all = referenceMatches(reference, distinct[0]);
+    for (size_t j = 1; j < distinct.size(); j++) {
+      map<Article, int> matches = referenceMatches(reference, distinct[j]);
+      map<Article, int> both;
+      for (const auto& match: all) {
+        auto found = matches.find(match.first);
+        if (found != matches.end()) both[match.first] = match.second + found->second;
+      }
+      all = both;
+    }
+    vector<pair<Article, int>> expected = rankMatches(all);
+    size_t numMatches = 0;
+    vector<pair<Article, int>> results = index.getArticlesContainingAll(words, 10, &numMatches);
+    size_t numExpected = expected.size();
+    if (expected.size() > 10) expected.resize(10);
+    string description;
+    for (const string& word: words) description += (description.empty() ? "\"" : ", \"") + word + "\"";
+    check(numMatches == numExpected && sameResults(results, expected),
+          phase + ": getArticlesContainingAll({" + description + "}, 10) disagrees");
+  }
+  cout << "  " << 2 * kNumQueries << " queries against the " << phase << " index: checked." << endl;
+}
+
+static void thawedIndexTest() {
+  RSSIndex index;
+  ReferenceIndex reference;
+  mt19937 generator(1);
+  addArticles(index, reference, 0, 2000, generator);
+  checkQueries(index, reference, generator, "thawed");
+}
+
+static void frozenIndexTest() {
+  RSSIndex index;
+  ReferenceIndex reference;
+  mt19937 generator(2);
+  addArticles(index, reference, 0, 2000, generator);
+  index.freeze();
+  checkQueries(index, reference, generator, "frozen");
+}
+
+static void refrozenIndexTest() {
+  RSSIndex index;
+  ReferenceIndex reference;
+  mt19937 generator(3);
+  addArticles(index, reference, 0, 2000, generator);
+  index.freeze();
+  addArticles(index, reference, 2000, 2500, generator); // thaws the index again
+  checkQueries(index, reference, generator, "rethawed");
+  index.freeze();
+  checkQueries(index, reference, generator, "refrozen");
+}
+
+/**
+ * Top-k scans pass over whole blocks whose maximum frequency can't make the
+ * cut, so a word found in exactly 127, 128 or 129 articles is queried for a
+ * few k, with the index both thawed and frozen.
+ */
+static void indexBlockBoundariesTest() {
+  for (size_t numArticles: {127, 128, 129}) {
+    RSSIndex index;
+    ReferenceIndex reference;
+    mt19937 generator(numArticles);
+    for (size_t i = 0; i < numArticles; i++) {
+      Article article = {"http://example.com/" + to_string(generator() % 1000) + "/" + to_string(i), "title"};
+      vector<string> words(1 + generator() % (i == numArticles - 1 ? 50 : 5), "edge");
+      index.add(article, words);
+      reference["edge"][article] += words.size();
+    }
+    vector<pair<Article, int>> expected = rankMatches(reference["edge"]);
+    for (bool frozen: {false, true}) {
+      if (frozen) index.freeze();
+      for (size_t k: {size_t(1), size_t(10), numArticles - 1, numArticles, numArticles + 1}) {
+        size_t numMatches = 0;
+        vector<pair<Article, int>> results = index.getMatchingArticles("edge", k, &numMatches);
+        vector<pair<Article, int>> best(expected.begin(), expected.begin() + min(k, expected.size()));
+        check(numMatches == numArticles && sameResults(results, best),
+              describe(numArticles, string(frozen ? "frozen" : "thawed") + " top-" + to_string(k) + " disagrees"));
+      }
+    }
+    cout << "  a word in " << numArticles << " articles, thawed and frozen: checked." << endl;
+  }
+}
+
+struct testEntry {
+  string flag;
+  function<void(void)> testfn;
+};
+
+static void buildMap(map<string, function<void(void)>>& testFunctionMap) {
+  testEntry entries[] = {
+    {"--block-boundaries", blockBoundariesTest},
+    {"--advance-past-end", advancePastEndTest},
+    {"--thawed-index", thawedIndexTest},
+    {"--frozen-index", frozenIndexTest},
+    {"--refrozen-index", refrozenIndexTest},
+    {"--index-block-boundaries", indexBlockBoundariesTest},
+  };
+
+  for (const testEntry& entry: entries) {
+    testFunctionMap[entry.flag] = entry.testfn;
+  }
+}
+
+static void executeAll(const map<string, function<void(void)>>& testFunctionMap) {
+  for (const auto& entry: testFunctionMap) {
+    cout << entry.first << ":" << endl;
+    entry.second();
+  }
+}
+
+int main(int argc, char **argv) {
+  if (argc != 2) {
+    cout << "Ouch! I need exactly two arguments." << endl;
+    return 0;
+  }
+
+  map<string, function<void(void)>> testFunctionMap;
+  buildMap(testFunctionMap);
+  string flag = argv[1];
+  if (flag == "--all") {
+    executeAll(testFunctionMap);
+  } else {
+    auto found = testFunctionMap.find(argv[1]);
+    if (found == testFunctionMap.end()) {
+      cout << "Oops... we don't recognize the flag \"" << argv[1] << "\"." << endl;
+      return 0;
+    }
+    found->second();
+  }
+
+  if (numFailures > 0) cout << numFailures << " check" << (numFailures == 1 ? "" : "s") << " failed." << endl;
+  return numFailures > 0 ? 1 : 0;
+}
@@ -10,79 +10,421 @@
 #include "utils.h"
 #include <iostream>
 #include <iomanip>
+#include <cstring>
 #include "ostreamlock.h"
 using namespace std;
 
+static const size_t kMaxBatchSize = 256;
+
+NewsAggregatorLog::NewsAggregatorLog(bool verbose):
+  verbose(verbose), queue(kQueueCapacity), numDropped(0) {
+  writer = thread([this] { runWriter(); });
+}
+
+NewsAggregatorLog::~NewsAggregatorLog() {
+  flush();
+  queue.close();
+  writer.join();
+}
+
+void NewsAggregatorLog::flush() const {
+  queue.waitUntilDone();
+}
+
+bool NewsAggregatorLog::isError(Kind kind) {
+  return kind == kSingleFeedDownloadFailure || kind == kSingleArticleDownloadFailure ||
+    kind == kSingleArticleDownloadDropped;
+}
+
+void NewsAggregatorLog::enqueue(Kind kind, const string& first, const string& second) const {
+  // Only failures are worth waiting for room in a full queue
+  bool queued = queue.push(isError(kind), [&](Record& record) {
+    record.kind = kind;
+    record.first = first;
+    record.second = second;
+  });
+  if (!queued) numDropped++;
+}
+
+static void writeBatch(ostream& os, string& batch) {
+  if (batch.empty()) return;
+  os << oslock << batch << flush << osunlock;
+  batch.clear();
+}
+
+void NewsAggregatorLog::runWriter() {
+  string batch;
+  bool batchIsError = false;
+  auto append = [&](const Record& record) {
+    if (isError(record.kind) != batchIsError) {
+      writeBatch(batchIsError ? cerr : cout, batch);
+      batchIsError = !batchIsError;
+    }
+    format(record, batch);
+  };
+  while (true) {
+    size_t numPopped = queue.pop(kMaxBatchSize, append);
+    writeBatch(batchIsError ? cerr : cout, batch);
+    size_t dropped = numDropped.exchange(0);
+    if (dropped > 0) cerr << oslock << "Dropped " << dropped << " log messages under load." << endl << osunlock;
+    queue.markDone();
+    if (numPopped == 0 && !queue.wait()) break; // sleeps until there's more to write, or the log is destroyed
+  }
+}
+
+static void appendArticle(string& out, const char *verb, const string& title, const string& url) {
+  out += "  ";
+  out += verb;
+  out += " \"";
+  out += shouldTruncate(title) ? truncate(title) : title;
+  out += "\"\n      [at \"";
+  out += shouldTruncate(url) ? truncate(url) : url;
+  out += "\"]\n";
+}
+
+void NewsAggregatorLog::format(const Record& record, string& out) {
+  switch (record.kind) {
+  case kFullRSSFeedListDownloadEnd:
+    out += "All RSS news feed documents have been downloaded!\n";
+    break;
+  case kAllFeedsHaveBeenScheduledForFeedList:
+    out += "All feeds have been scheduled for RSS feed list from: " + record.first + "\n";
+    break;
+  case kSingleFeedDownloadBeginning:
+    out += "Begin full download of feed URI: " + record.first + "\n";
+    break;
+  case kSingleFeedDownloadSkipped:
+    out += "Skipped entire download of feed URI: " + record.first + "\n";
+    break;
+  case kSingleFeedDownloadFailure:
+    out += "Ran into trouble while pulling RSS feed from \"" + record.first + "\".\nIgnoring....\n";
+    break;
+  case kAllArticlesHaveBeenScheduledForFeed:
+    out += "All articles have been scheduled for feed URI: " + record.first + "\n";
+    break;
+  case kAllRSSFeedsDownloadEnd:
+    out += "All news articles have been downloaded!\n";
+    break;
+  case kSingleArticleDownloadBeginning:
+    appendArticle(out, "Parsing", record.first, record.second);
+    break;
+  case kSingleArticleDownloadSkipped:
+    appendArticle(out, "Skipped", record.first, record.second);
+    break;
+  case kSingleArticleDownloadFailure:
+    out += "Ran into trouble while pulling HTML document from \"" + record.first + "\" Ignoring....\n";
+    break;
+  case kSingleArticleDownloadDropped:
+    out += "Ran out of time before pulling HTML document from \"" + record.first + "\" Dropping....\n";
+    break;
+  case kSingleArticleNearDuplicateSkipped:
+    appendArticle(out, "Skipped near-duplicate", record.first, record.second);
+    break;
+  }
+}
+
 static const int kIncorrectUsage = 1;
 void NewsAggregatorLog::printUsage(const string& message, const string& executable) {
   cerr << "Error: " << message << endl;
-  cerr << "Usage: ./" << executable << " [--verbose] [--quiet] [--conserve-threads] [--url <feed-file>]" << endl;
+  cerr << "Usage: ./" << executable << " [--verbose] [--quiet] [--conserve-threads] [--url <feed-file>] [--keep-near-duplicates]"
+       << " [--strip-accents] [--stop-words <file> | --keep-stop-words] [--no-stemming] [--min-token-length <n>]"
+       << " [--trace <file>] [--record <dir> | --replay <dir>] [--feed-workers <n>] [--article-workers <n>|<min>:<max>]"
+       << " [--analysis-workers <n>] [--feed-weights <file>] [--request-timeout <seconds>] [--retries <n>] [--hedge] [--crawl-deadline <seconds>] [--recrawl <seconds> [--retain-crawls <n>]]"
+       << " [--checkpoint <file> [--resume]] [--memory-budget <megabytes>] [--shard <i>/<N> --segment <file> | --index <file>]"
+       << " [--queries <file> [--results <file>] | --serve <port|socket-path>]" << endl;
   exit(kIncorrectUsage);
 }
 
 static const int kBogusRSSFeedListName = 1;
 void NewsAggregatorLog::noteFullRSSFeedListDownloadFailureAndExit(const string& rssFeedListURI) const {
+  flush();
   cerr << "Ran into trouble while pulling full RSS feed list from \""
        << rssFeedListURI << "\"." << endl; 
   cerr << "Aborting...." << endl;
   exit(kBogusRSSFeedListName);
 }
 
+static const int kBogusBatchQueryFile = 1;
+void NewsAggregatorLog::noteBatchQueryFileFailureAndExit(const string& filename) const {
+  flush();
+  cerr << "Could not open \"" << filename << "\" for batch queries." << endl;
+  cerr << "Aborting...." << endl;
+  exit(kBogusBatchQueryFile);
+}
+
+void NewsAggregatorLog::noteRecrawlFeedListFailure(const string& feedListURI) const {
+  flush();
+  cerr << oslock << "Ran into trouble while pulling full RSS feed list from \"" << feedListURI << "\" for a recrawl."
+       << "  Keeping the current index...." << endl << osunlock;
+}
+
+void NewsAggregatorLog::noteRecrawlEnd(size_t numUpdated, double elapsed) const {
+  flush();
+  if (!verbose) return;
+  cout << oslock << "Recrawled in " << fixed << setprecision(1) << elapsed << "s: ";
+  if (numUpdated == 0) cout << "nothing new, so the index stays as it was.";
+  else cout << numUpdated << " new, updated or evicted article" << (numUpdated == 1 ? "" : "s") << " swapped into the index.";
+  cout << defaultfloat << endl << osunlock;
+}
+
+void NewsAggregatorLog::noteCrawlCancelled(size_t numFeedsDropped, size_t numArticlesDropped) const {
+  flush();
+  cerr << oslock << "Crawl cancelled: dropped " << numFeedsDropped << " queued feed" << (numFeedsDropped == 1 ? "" : "s")
+       << " and " << numArticlesDropped << " queued article" << (numArticlesDropped == 1 ? "" : "s")
+       << ".  Indexing what was downloaded...." << endl << osunlock;
+}
+
+static const int kBogusStopWordsFile = 1;
+void NewsAggregatorLog::noteStopWordsFileFailureAndExit(const string& filename) const {
+  flush();
+  cerr << "Could not open \"" << filename << "\" for stop words." << endl;
+  cerr << "Aborting...." << endl;
+  exit(kBogusStopWordsFile);
+}
+
+static const int kBogusFeedWeightsFile = 1;
+void NewsAggregatorLog::noteFeedWeightsFileFailureAndExit(const string& filename) const {
+  flush();
+  cerr << "Could not read feed weights from \"" << filename << "\"." << endl;
+  cerr << "Aborting...." << endl;
+  exit(kBogusFeedWeightsFile);
+}
+
+void NewsAggregatorLog::noteTraceFileFailure(const string& filename) const {
+  flush();
+  cerr << oslock << "Could not write trace to \"" << filename << "\".  Ignoring...." << endl << osunlock;
+}
+
+void NewsAggregatorLog::noteTraceWritten(const string& filename, size_t numSpans) const {
+  flush();
+  if (!verbose) return;
+  cout << oslock << "Wrote " << numSpans << " trace spans to " << filename << "." << endl << osunlock;
+}
+
+static const int kBogusCheckpointFile = 1;
+void NewsAggregatorLog::noteCheckpointFailureAndExit(const string& filename) const {
+  flush();
+  cerr << "Could not use \"" << filename << "\" as a crawl checkpoint." << endl;
+  cerr << "Aborting...." << endl;
+  exit(kBogusCheckpointFile);
+}
+
+void NewsAggregatorLog::noteCheckpointWriteFailure(const string& filename, size_t numRecorded, int error) const {
+  flush();
+  cerr << oslock << "Stopped checkpointing to \"" << filename << "\" after " << numRecorded << " article"
+       << (numRecorded == 1 ? "" : "s") << ": " << strerror(error) << ".  Resuming picks up from there." << endl
+       << osunlock;
+}
+
+void NewsAggregatorLog::noteCheckpointResumed(const string& filename, size_t numArticles) const {
+  flush();
+  if (!verbose) return;
+  cout << oslock << "Resumed " << numArticles << " article" << (numArticles == 1 ? "" : "s") << " from " << filename
+       << "; only the rest will be downloaded." << endl << osunlock;
+}
+
+static const int kBogusSpillDirectory = 1;
+void NewsAggregatorLog::noteRawMapSpillFailureAndExit(const string& directory) const {
+  flush();
+  cerr << "Could not spill the raw index to \"" << directory << "\" to stay under the memory budget." << endl;
+  cerr << "Aborting...." << endl;
+  exit(kBogusSpillDirectory);
+}
+
+void NewsAggregatorLog::noteStaleArticlesEvicted(size_t numArticles, size_t numURLs, size_t retainCrawls) const {
+  flush();
+  if (!verbose) return;
+  cout << oslock << "Evicted " << numArticles << " article" << (numArticles == 1 ? "" : "s") << " (and " << numURLs
+       << " URL" << (numURLs == 1 ? "" : "s") << ") that no feed has listed in the last " << retainCrawls << " crawl"
+       << (retainCrawls == 1 ? "" : "s") << "." << endl << osunlock;
+}
+
+void NewsAggregatorLog::noteRawMapSpillSummary(size_t numRuns, size_t numArticles, size_t numBytes) const {
+  flush();
+  if (!verbose) return;
+  cout << oslock << "Spilled " << numArticles << " article" << (numArticles == 1 ? "" : "s") << " to disk in "
+       << numRuns << " sorted run" << (numRuns == 1 ? "" : "s") << " (" << fixed << setprecision(1)
+       << numBytes / 1048576.0 << " MB) to stay under the memory budget." << defaultfloat << endl << osunlock;
+}
+
+void NewsAggregatorLog::noteIndexSummary(size_t numBytes) const {
+  flush();
+  if (!verbose) return;
+  cout << oslock << "Published an index whose articles and posting lists take up " << fixed << setprecision(1)
+       << numBytes / 1048576.0 << " MB." << defaultfloat << endl << osunlock;
+}
+
+void NewsAggregatorLog::noteShardFeeds(size_t shardIndex, size_t numShards, size_t numFeedsInShard,
+                                       size_t numFeeds) const {
+  flush();
+  if (!verbose) return;
+  cout << oslock << "Shard " << shardIndex << "/" << numShards << " is crawling " << numFeedsInShard << " of "
+       << numFeeds << " feed" << (numFeeds == 1 ? "" : "s") << "." << endl << osunlock;
+}
+
+static const int kBogusSegmentFile = 1;
+void NewsAggregatorLog::noteSegmentFailureAndExit(const string& filename) const {
+  flush();
+  cerr << "Could not write the index segment \"" << filename << "\"." << endl;
+  cerr << "Aborting...." << endl;
+  exit(kBogusSegmentFile);
+}
+
+void NewsAggregatorLog::noteSegmentWritten(const string& filename, size_t numArticles) const {
+  flush();
+  if (!verbose) return;
+  cout << oslock << "Wrote " << numArticles << " article" << (numArticles == 1 ? "" : "s") << " to index segment "
+       << filename << "." << endl << osunlock;
+}
+
+static const int kBogusIndexFile = 1;
+void NewsAggregatorLog::noteIndexFileFailureAndExit(const string& filename) const {
+  flush();
+  cerr << "Could not read \"" << filename << "\" as an index segment." << endl;
+  cerr << "Aborting...." << endl;
+  exit(kBogusIndexFile);
+}
+
+void NewsAggregatorLog::noteIndexLoaded(const string& filename, size_t numArticles) const {
+  flush();
+  if (!verbose) return;
+  cout << oslock << "Loaded " << numArticles << " article" << (numArticles == 1 ? "" : "s") << " from " << filename
+       << "." << endl << osunlock;
+}
+
+static const int kBogusCorpusDirectory = 1;
+void NewsAggregatorLog::noteCorpusFailureAndExit(const string& directory) const {
+  flush();
+  cerr << "Could not open the crawl corpus in \"" << directory << "\"." << endl;
+  cerr << "Aborting...." << endl;
+  exit(kBogusCorpusDirectory);
+}
+
+void NewsAggregatorLog::noteCorpusRecorded(const string& directory, size_t numEntries) const {
+  flush();
+  if (!verbose) return;
+  cout << oslock << "Recorded " << numEntries << " downloads to " << directory << "." << endl << osunlock;
+}
+
+static const int kBogusQueryServerEndpoint = 1;
+void NewsAggregatorLog::noteQueryServerFailureAndExit(const string& endpoint) const {
+  flush();
+  cerr << "Could not listen for queries on \"" << endpoint << "\"." << endl;
+  cerr << "Aborting...." << endl;
+  exit(kBogusQueryServerEndpoint);
+}
+
+void NewsAggregatorLog::noteQueryServerListening(const string& endpoint) const {
+  flush();
+  if (verbose) cout << oslock << "Serving queries on " << endpoint << "." << endl << osunlock;
+}
+
 void NewsAggregatorLog::noteFullRSSFeedListDownloadEnd() const {
-  if (verbose) cout << oslock << "All RSS news feed documents have been downloaded!" << endl << osunlock;
+  if (verbose) enqueue(kFullRSSFeedListDownloadEnd, "");
 }
 
 void NewsAggregatorLog::noteSingleFeedDownloadBeginning(const string& feedURI) const {
-  if (!verbose) return;
-  cout << oslock << "Begin full download of feed URI: " << feedURI << endl << osunlock;
+  if (verbose) enqueue(kSingleFeedDownloadBeginning, feedURI);
 }
 
 void NewsAggregatorLog::noteSingleFeedDownloadSkipped(const string& feedURI) const {
-  if (!verbose) return;
-  cout << oslock << "Skipped entire download of feed URI: " << feedURI << endl << osunlock;
+  if (verbose) enqueue(kSingleFeedDownloadSkipped, feedURI);
 }
 
 void NewsAggregatorLog::noteAllArticlesHaveBeenScheduledForFeed(const string& feedURI) const {
-  if (!verbose) return;
-  cout << oslock << "All articles have been scheduled for feed URI: " << feedURI << endl << osunlock;
+  if (verbose) enqueue(kAllArticlesHaveBeenScheduledForFeed, feedURI);
 }
 
 void NewsAggregatorLog::noteAllFeedsHaveBeenScheduledForFeedList(const string& rssFeedListURI) const {
-  if (!verbose) return;
-  cout << oslock << "All feeds have been scheduled for RSS feed list from: " << rssFeedListURI << endl << osunlock;
+  if (verbose) enqueue(kAllFeedsHaveBeenScheduledForFeedList, rssFeedListURI);
 }
 
 void NewsAggregatorLog::noteSingleFeedDownloadFailure(const string& feedURI) const {
-  cerr << oslock << "Ran into trouble while pulling RSS feed from \""
-       << feedURI << "\"." << endl << "Ignoring...." << endl << osunlock;
+  enqueue(kSingleFeedDownloadFailure, feedURI);
 }
 
 void NewsAggregatorLog::noteAllRSSFeedsDownloadEnd() const {
-  if (verbose) cout << oslock << "All news articles have been downloaded!" << endl << osunlock;  
+  if (verbose) enqueue(kAllRSSFeedsDownloadEnd, "");
 }
 
 void NewsAggregatorLog::noteSingleArticleDownloadBeginning(const Article& article) const {
-  if (!verbose) return;
-  string title = shouldTruncate(article.title) ? truncate(article.title) : article.title;
-  string url = shouldTruncate(article.url) ? truncate(article.url) : article.url;
-  cout << oslock;
-  cout << "  Parsing \"" << title << "\"" << endl;
-  cout << "      [at \"" << url << "\"]" << endl;
-  cout << osunlock;
+  if (verbose) enqueue(kSingleArticleDownloadBeginning, article.title, article.url);
 }
 
 void NewsAggregatorLog::noteSingleArticleDownloadSkipped(const Article& article) const {
-  if (!verbose) return;
-  string title = shouldTruncate(article.title) ? truncate(article.title) : article.title;
-  string url = shouldTruncate(article.url) ? truncate(article.url) : article.url;
-  cout << oslock;
-  cout << "  Skipped \"" << title << "\"" << endl;
-  cout << "      [at \"" << url << "\"]" << endl;
-  cout << osunlock;
+  if (verbose) enqueue(kSingleArticleDownloadSkipped, article.title, article.url);
 }
 
 void NewsAggregatorLog::noteSingleArticleDownloadFailure(const Article& article) const {
-  cerr << oslock;
-  cerr << "Ran into trouble while pulling HTML document from \"" << article.url << "\" Ignoring...." << endl;
-  cerr << osunlock;
+  enqueue(kSingleArticleDownloadFailure, article.url);
+}
+
+void NewsAggregatorLog::noteSingleArticleDownloadDropped(const Article& article) const {
+  enqueue(kSingleArticleDownloadDropped, article.url);
+}
+
+void NewsAggregatorLog::noteSingleArticleNearDuplicateSkipped(const Article& article) const {
+  if (verbose) enqueue(kSingleArticleNearDuplicateSkipped, article.title, article.url);
+}
+
+void NewsAggregatorLog::noteNearDuplicateSummary(size_t numClusters, size_t numDuplicates) const {
+  flush();
+  if (!verbose) return;
+  cout << oslock << "Fingerprinted " << numClusters + numDuplicates << " articles into "
+       << numClusters << " near-duplicate clusters." << endl << osunlock;
+}
+
+static double percentOf(size_t part, size_t whole) {
+  return whole == 0 ? 0.0 : 100.0 * part / whole;
+}
+
+void NewsAggregatorLog::noteAnalysisSummary(size_t numTokens, size_t numTooShort, size_t numStopWords,
+                                            size_t numStemmed) const {
+  flush();
+  if (!verbose) return;
+  cout << oslock << "Analyzed " << numTokens << " tokens: dropped " << numStopWords << " stop words ("
+       << fixed << setprecision(1) << percentOf(numStopWords, numTokens) << "%) and " << numTooShort
+       << " short tokens (" << percentOf(numTooShort, numTokens) << "%), stemmed " << numStemmed << " ("
+       << percentOf(numStemmed, numTokens) << "%)." << defaultfloat << endl << osunlock;
+}
+
+void NewsAggregatorLog::noteConcurrencySummary(size_t numFeedWorkers, size_t numAnalysisWorkers, size_t finalLimit,
+                                               size_t lowestLimit, size_t highestLimit, size_t numDecreases, double meanLatency) const {
+  flush();
+  if (!verbose) return;
+  cout << oslock << "Crawled with " << numFeedWorkers << " feed workers and " << numAnalysisWorkers
+       << " analysis worker" << (numAnalysisWorkers == 1 ? "" : "s") << "; article downloads in flight ended at "
+       << finalLimit << " (ranged " << lowestLimit << "-" << highestLimit << ", backed off " << numDecreases
+       << " time" << (numDecreases == 1 ? "" : "s") << ", mean download " << fixed << setprecision(1)
+       << meanLatency * 1000 << "ms)." << defaultfloat << endl << osunlock;
+}
+
+void NewsAggregatorLog::noteFetchSummary(size_t numRetries, size_t numTimeouts, size_t numRefused,
+                                         size_t numHedges, size_t numHedgeWins, size_t numFeedsDropped,
+                                         size_t numArticlesDropped) const {
+  flush();
+  if (numFeedsDropped > 0 || numArticlesDropped > 0) {
+    cerr << oslock << "Dropped " << numFeedsDropped << " feed" << (numFeedsDropped == 1 ? "" : "s") << " and "
+         << numArticlesDropped << " article" << (numArticlesDropped == 1 ? "" : "s")
+         << " still unfinished at the crawl deadline." << endl << osunlock;
+  }
+  if (!verbose) return;
+  cout << oslock << "Article downloads: " << numRetries << " retries, " << numTimeouts << " timeouts, "
+       << numRefused << " turned away by swamped servers, " << numHedges << " hedged (" << numHedgeWins << " won by the hedge)." << endl << osunlock;
+}
+
+void NewsAggregatorLog::noteQueryCacheStats(size_t hits, size_t misses) const {
+  flush();
+  if (!verbose) return;
+  cout << oslock << "Query cache: " << hits << " hit" << (hits == 1 ? "" : "s") << ", "
+       << misses << " miss" << (misses == 1 ? "" : "es") << "." << endl << osunlock;
+}
+
+void NewsAggregatorLog::noteBatchQueryStats(size_t numQueries, double seconds, double p50, double p90,
+                                            double p99, double max) const {
+  flush();
+  cerr << oslock << "Evaluated " << numQueries << " queries in " << fixed << setprecision(3) << seconds << "s ("
+       << setprecision(0) << (seconds > 0 ? numQueries / seconds : 0) << " queries/sec)." << endl
+       << "Latency (us): p50 " << setprecision(1) << p50 << ", p90 " << p90 << ", p99 " << p99
+       << ", max " << max << "." << endl << defaultfloat << osunlock;
 }
@@ -0,0 +1,106 @@
+/**
+ * File: merge-index.cc
+ * --------------------
+ * Combines the index segments written by the shards of a sharded crawl
+ * (aggregate --shard <i>/<N> --segment <file>) into a single segment, which
+ * aggregate --index <file> can then load and query.
+ *
+ *   ./merge-index --output <file> [--keep-near-duplicates] <segment> ...
+ *
+ * Each shard only ever saw its own feeds, so the merge settles what the
+ * shards couldn't settle among themselves, deterministically and whatever
+ * order the segments are listed in:
+ *
+ *   - Versions of the same (server, title) crawled by different shards are
+ *     combined just as one crawl would have combined them: their tokens are
+ *     intersected, and the lexicographically first URL is kept.
+ *   - A representative URL (the one URL a segment keeps for each key) that
+ *     several shards kept under different titles is owned by the smallest
+ *     (server, title) key it appears under, and the others are dropped.  A
+ *     segment doesn't record the other URLs that contributed to a key, so
+ *     an article a single crawl would have skipped because one of those
+ *     URLs had already been seen can still survive the merge.
+ *   - Unless --keep-near-duplicates is given, near-duplicates across shards
+ *     are dropped too, the one with the smallest key representing the
+ *     cluster, as in a single crawl.  This pass sees every article's final
+ *     (intersected) tokens, where a crawl's detector saw versions one at a
+ *     time as they arrived, so it can drop a few articles that no single
+ *     crawl would have.  It never drops anything from a segment merge-index
+ *     itself wrote.
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <set>
+#include <memory>
+#include <cstdlib>
+#include <cstring>
+
+#include "index-segment.h"
+#include "near-duplicate-detector.h"
+using namespace std;
+
+static void usage(const char *executable) {
+  cerr << "Usage: " << executable << " --output <file> [--keep-near-duplicates] <segment> ..." << endl;
+  exit(1);
+}
+
+int main(int argc, char *argv[]) {
+  string outputFile;
+  bool keepNearDuplicates = false;
+  vector<string> segmentFiles;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) outputFile = argv[++i];
+    else if (strcmp(argv[i], "--keep-near-duplicates") == 0) keepNearDuplicates = true;
+    else if (argv[i][0] == '-') usage(argv[0]);
+    else segmentFiles.push_back(argv[i]);
+  }
+  if (outputFile.empty() || segmentFiles.empty()) usage(argv[0]);
+
+  vector<unique_ptr<IndexSegmentReader>> readers;
+  vector<SortedSource *> sources;
+  for (const string& segmentFile : segmentFiles) {
+    readers.emplace_back(new IndexSegmentReader(segmentFile));
+    if (!readers.back()->open()) {
+      cerr << "Could not read \"" << segmentFile << "\" as an index segment." << endl;
+      return 1;
+    }
+    sources.push_back(readers.back().get());
+  }
+
+  IndexSegmentWriter writer(outputFile);
+  if (!writer.open()) {
+    cerr << "Could not write the index segment \"" << outputFile << "\"." << endl;
+    return 1;
+  }
+  set<string> ownedURLs;
+  NearDuplicateDetector nearDuplicates;
+  size_t numMerged = 0, numDuplicateURLs = 0, numNearDuplicates = 0;
+  bool written = true;
+  mergeSortedSources(sources, [&](const ArticleKey& key, const Article& article, const TokenBag& bag) {
+    numMerged++;
+    if (!ownedURLs.insert(article.url).second) {
+      numDuplicateURLs++;
+      return;
+    }
+    if (!keepNearDuplicates && bag.size() >= NearDuplicateDetector::kMinDistinctTokens) {
+      NearDuplicateDetector::key_t canonical;
+      if (nearDuplicates.findOrInsert(NearDuplicateDetector::fingerprint(bag), key, canonical)) {
+        numNearDuplicates++;
+        return;
+      }
+    }
+    written = written && writer.append(key, article, bag);
+  });
+  if (!written || !writer.commit()) {
+    cerr << "Could not write the index segment \"" << outputFile << "\"." << endl;
+    return 1;
+  }
+
+  cout << "Merged " << segmentFiles.size() << " segment" << (segmentFiles.size() == 1 ? "" : "s") << " into "
+       << outputFile << ": " << writer.getNumArticles() << " of " << numMerged << " distinct articles kept, "
+       << numDuplicateURLs << " dropped as duplicate URLs and " << numNearDuplicates
+       << " as near-duplicates." << endl;
+  return 0;
+}
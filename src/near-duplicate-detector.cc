@@ -0,0 +1,84 @@
+/**
+ * File: near-duplicate-detector.cc
+ * --------------------------------
+ * Presents the implementation of the NearDuplicateDetector class.
+ */
+
+#include "near-duplicate-detector.h"
+#include "utils.h"
+#include <algorithm>
+using namespace std;
+
+uint64_t NearDuplicateDetector::fingerprint(const TokenBag& tokens) {
+  int64_t weights[64] = {0};
+  for (size_t i = 0; i < tokens.size(); i++) {
+    token_view token = tokens.term(i);
+    uint64_t hash = hash64(token.data(), token.size());
+    int64_t weight = tokens.count(i);
+    for (size_t bit = 0; bit < 64; bit++) {
+      weights[bit] += (hash >> bit) & 1 ? weight : -weight;
+    }
+  }
+  uint64_t fingerprint = 0;
+  for (size_t bit = 0; bit < 64; bit++) {
+    if (weights[bit] > 0) fingerprint |= uint64_t(1) << bit;
+  }
+  return fingerprint;
+}
+
+static inline uint32_t bandKey(uint64_t fingerprint, size_t band) {
+  return (band << 16) | ((fingerprint >> (band * 16)) & 0xffff);
+}
+
+bool NearDuplicateDetector::findOrInsert(uint64_t fingerprint, const key_t& key, key_t& canonical) {
+  // Lock every shard our bands live in, in index order so that two
+  // overlapping lookups can't deadlock.  Any near-duplicate shares at least
+  // one band with us, so it's serialized against us by that band's shard.
+  size_t shardIndices[kNumBands];
+  for (size_t band = 0; band < kNumBands; band++) {
+    shardIndices[band] = (bandKey(fingerprint, band) * 0x9e3779b1U >> 16) % kNumShards;
+  }
+  size_t sorted[kNumBands];
+  copy(shardIndices, shardIndices + kNumBands, sorted);
+  sort(sorted, sorted + kNumBands);
+  size_t *end = unique(sorted, sorted + kNumBands);
+  for (size_t *index = sorted; index != end; index++) shards[*index].lock.lock();
+
+  bool found = false;
+  for (size_t band = 0; band < kNumBands && !found; band++) {
+    auto& buckets = shards[shardIndices[band]].buckets;
+    auto bucket = buckets.find(bandKey(fingerprint, band));
+    if (bucket == buckets.end()) continue;
+    for (const Entry& entry: bucket->second) {
+      if (size_t(__builtin_popcountll(entry.fingerprint ^ fingerprint)) <= kMaxDistance) {
+        lock_guard<mutex> lg(entry.cluster->lock);
+        canonical = entry.cluster->representative;
+        if (key < canonical) entry.cluster->representative = key;
+        found = true;
+        break;
+      }
+    }
+  }
+
+  if (!found) {
+    Entry entry = {fingerprint, make_shared<Cluster>()};
+    entry.cluster->representative = key;
+    for (size_t band = 0; band < kNumBands; band++) {
+      shards[shardIndices[band]].buckets[bandKey(fingerprint, band)].push_back(entry);
+    }
+  }
+
+  for (size_t *index = sorted; index != end; index++) shards[*index].lock.unlock();
+  if (found) numDuplicates++;
+  else numClusters++;
+  return found;
+}
+
+void NearDuplicateDetector::clear() {
+  for (Shard& shard: shards) {
+    lock_guard<mutex> lg(shard.lock);
+    shard.buckets.clear();
+  }
+  numClusters = 0;
+  numDuplicates = 0;
+}
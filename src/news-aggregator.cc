@@ -14,8 +14,24 @@
 #include <algorithm>
 #include <thread>
 #include <utility>
+#include <fstream>
+#include <sstream>
+#include <iterator>
+#include <chrono>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <cstdlib>
+#include <cctype>
+#include <cmath>
+#include <limits>
+#include <type_traits>
 
 #include <getopt.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
 #include <libxml/parser.h>
 #include <libxml/catalog.h>
 #include "rss-feed.h"
@@ -27,8 +43,42 @@
 #include "utils.h"
 #include "ostreamlock.h"
 #include "string-utils.h"
+#include "socket-utils.h"
+#include "trace.h"
+#include "rss-stream.h"
+#include "crawl-checkpoint.h"
 using namespace std;
 
+/**
+ * Parses all of a numeric flag's argument, printing usage and exiting if
+ * any of it isn't part of the number.  Counts must be unsigned integers
+ * (strtoull would otherwise quietly wrap "-1" around), and everything else
+ * must be finite; whether the value is in range for the flag is checked
+ * once all the flags have been read.
+ */
+static bool parseValue(const string& arg, unsigned long long& value) {
+  if (arg.empty() || !isdigit(static_cast<unsigned char>(arg[0]))) return false;
+  char *end;
+  errno = 0;
+  value = strtoull(arg.c_str(), &end, 10);
+  return errno == 0 && *end == '\0';
+}
+
+static bool parseValue(const string& arg, double& value) {
+  if (arg.empty() || isspace(static_cast<unsigned char>(arg[0]))) return false;
+  char *end;
+  value = strtod(arg.c_str(), &end);
+  return *end == '\0' && isfinite(value);
+}
+
+template <typename T>
+static T parseNumber(const string& arg, const string& flag, const string& executable) {
+  typename conditional<is_integral<T>::value, unsigned long long, double>::type value = 0;
+  if (!parseValue(arg, value) || value > numeric_limits<T>::max())
+    NewsAggregatorLog::printUsage(flag + " expects a number, not \"" + arg + "\".", executable);
+  return value;
+}
+
 /**
  * Factory Method: createNewsAggregator
  * ------------------------------------
@@ -37,28 +87,155 @@ using namespace std;
  * of logging information as it does so.
  */
 static const string kDefaultRSSFeedListURL = "small-feed.xml";
+static const double kBytesPerMegabyte = 1 << 20;
 NewsAggregator *NewsAggregator::createNewsAggregator(int argc, char *argv[]) {
   struct option options[] = {
     {"verbose", no_argument, NULL, 'v'},
     {"quiet", no_argument, NULL, 'q'},
     {"url", required_argument, NULL, 'u'},
+    {"keep-near-duplicates", no_argument, NULL, 'k'},
+    {"queries", required_argument, NULL, 'Q'},
+    {"results", required_argument, NULL, 'R'},
+    {"serve", required_argument, NULL, 'S'},
+    {"strip-accents", no_argument, NULL, 'a'},
+    {"stop-words", required_argument, NULL, 'w'},
+    {"keep-stop-words", no_argument, NULL, 'K'},
+    {"no-stemming", no_argument, NULL, 'N'},
+    {"min-token-length", required_argument, NULL, 'm'},
+    {"trace", required_argument, NULL, 'T'},
+    {"record", required_argument, NULL, 'r'},
+    {"replay", required_argument, NULL, 'p'},
+    {"feed-workers", required_argument, NULL, 'F'},
+    {"article-workers", required_argument, NULL, 'W'},
+    {"request-timeout", required_argument, NULL, 't'},
+    {"retries", required_argument, NULL, 'y'},
+    {"hedge", no_argument, NULL, 'H'},
+    {"crawl-deadline", required_argument, NULL, 'D'},
+    {"analysis-workers", required_argument, NULL, 'A'},
+    {"feed-weights", required_argument, NULL, 'B'},
+    {"recrawl", required_argument, NULL, 'I'},
+    {"retain-crawls", required_argument, NULL, 'X'},
+    {"checkpoint", required_argument, NULL, 'C'},
+    {"resume", no_argument, NULL, 'e'},
+    {"memory-budget", required_argument, NULL, 'M'},
+    {"shard", required_argument, NULL, 'P'},
+    {"segment", required_argument, NULL, 'G'},
+    {"index", required_argument, NULL, 'L'},
     {NULL, 0, NULL, 0},
   };
   
-  string rssFeedListURI = kDefaultRSSFeedListURL;
-  bool verbose = true;
+  NewsAggregatorOptions aggregatorOptions;
+  aggregatorOptions.rssFeedListURI = kDefaultRSSFeedListURL;
   while (true) {
-    int ch = getopt_long(argc, argv, "vqu:", options, NULL);
+    int ch = getopt_long(argc, argv, "vqu:kQ:R:S:aw:KNm:T:r:p:F:W:t:y:HD:A:B:I:X:C:eM:P:G:L:", options, NULL);
     if (ch == -1) break;
     switch (ch) {
     case 'v':
-      verbose = true;
+      aggregatorOptions.verbose = true;
       break;
     case 'q':
-      verbose = false;
+      aggregatorOptions.verbose = false;
       break;
     case 'u':
-      rssFeedListURI = optarg;
+      aggregatorOptions.rssFeedListURI = optarg;
+      break;
+    case 'k':
+      aggregatorOptions.keepNearDuplicates = true;
+      break;
+    case 'Q':
+      aggregatorOptions.queriesFile = optarg;
+      break;
+    case 'R':
+      aggregatorOptions.resultsFile = optarg;
+      break;
+    case 'S':
+      aggregatorOptions.serveEndpoint = optarg;
+      break;
+    case 'a':
+      aggregatorOptions.stripAccents = true;
+      break;
+    case 'w':
+      aggregatorOptions.stopWordsFile = optarg;
+      break;
+    case 'K':
+      aggregatorOptions.removeStopWords = false;
+      break;
+    case 'N':
+      aggregatorOptions.stem = false;
+      break;
+    case 'm':
+      aggregatorOptions.minTokenLength = parseNumber<size_t>(optarg, "--min-token-length", argv[0]);
+      break;
+    case 'T':
+      aggregatorOptions.traceFile = optarg;
+      break;
+    case 'r':
+      aggregatorOptions.recordDirectory = optarg;
+      break;
+    case 'p':
+      aggregatorOptions.replayDirectory = optarg;
+      break;
+    case 'F':
+      aggregatorOptions.numFeedWorkers = parseNumber<size_t>(optarg, "--feed-workers", argv[0]);
+      break;
+    case 'W': {
+      // Either a fixed count or a <min>:<max> range
+      string range = optarg;
+      size_t colon = range.find(':');
+      aggregatorOptions.minArticleWorkers = aggregatorOptions.maxArticleWorkers =
+        parseNumber<size_t>(range.substr(0, colon), "--article-workers", argv[0]);
+      if (colon != string::npos) {
+        aggregatorOptions.maxArticleWorkers = parseNumber<size_t>(range.substr(colon + 1), "--article-workers", argv[0]);
+      }
+      break;
+    }
+    case 't':
+      aggregatorOptions.fetchPolicy.attemptTimeout = parseNumber<double>(optarg, "--request-timeout", argv[0]);
+      break;
+    case 'y':
+      aggregatorOptions.fetchPolicy.maxRetries = parseNumber<size_t>(optarg, "--retries", argv[0]);
+      break;
+    case 'H':
+      aggregatorOptions.fetchPolicy.hedge = true;
+      break;
+    case 'D':
+      aggregatorOptions.crawlDeadline = parseNumber<double>(optarg, "--crawl-deadline", argv[0]);
+      break;
+    case 'A':
+      aggregatorOptions.numAnalysisWorkers = parseNumber<size_t>(optarg, "--analysis-workers", argv[0]);
+      break;
+    case 'B':
+      aggregatorOptions.feedWeightsFile = optarg;
+      break;
+    case 'I':
+      aggregatorOptions.recrawlInterval = parseNumber<double>(optarg, "--recrawl", argv[0]);
+      break;
+    case 'X':
+      aggregatorOptions.retainCrawls = parseNumber<size_t>(optarg, "--retain-crawls", argv[0]);
+      break;
+    case 'C':
+      aggregatorOptions.checkpointFile = optarg;
+      break;
+    case 'e':
+      aggregatorOptions.resume = true;
+      break;
+    case 'M':
+      aggregatorOptions.memoryBudget = parseNumber<double>(optarg, "--memory-budget", argv[0]);
+      break;
+    case 'P': {
+      // <i>/<N>, with shards numbered from 0
+      string shard = optarg;
+      size_t slash = shard.find('/');
+      if (slash == string::npos) NewsAggregatorLog::printUsage("--shard must be <i>/<N>, with i less than N.", argv[0]);
+      aggregatorOptions.shardIndex = parseNumber<size_t>(shard.substr(0, slash), "--shard", argv[0]);
+      aggregatorOptions.numShards = parseNumber<size_t>(shard.substr(slash + 1), "--shard", argv[0]);
+      break;
+    }
+    case 'G':
+      aggregatorOptions.segmentFile = optarg;
+      break;
+    case 'L':
+      aggregatorOptions.indexFile = optarg;
       break;
     default:
       NewsAggregatorLog::printUsage("Unrecognized flag.", argv[0]);
@@ -67,7 +244,42 @@ NewsAggregator *NewsAggregator::createNewsAggregator(int argc, char *argv[]) {
   
   argc -= optind;
   if (argc > 0) NewsAggregatorLog::printUsage("Too many arguments.", argv[0]);
-  return new NewsAggregator(rssFeedListURI, verbose);
+  if (!aggregatorOptions.resultsFile.empty() && aggregatorOptions.queriesFile.empty())
+    NewsAggregatorLog::printUsage("--results requires --queries.", argv[0]);
+  if (!aggregatorOptions.queriesFile.empty() && !aggregatorOptions.serveEndpoint.empty())
+    NewsAggregatorLog::printUsage("--queries and --serve are mutually exclusive.", argv[0]);
+  if (!aggregatorOptions.recordDirectory.empty() && !aggregatorOptions.replayDirectory.empty())
+    NewsAggregatorLog::printUsage("--record and --replay are mutually exclusive.", argv[0]);
+  if (aggregatorOptions.numFeedWorkers == 0)
+    NewsAggregatorLog::printUsage("--feed-workers must be positive.", argv[0]);
+  if (aggregatorOptions.minArticleWorkers == 0 ||
+      aggregatorOptions.minArticleWorkers > aggregatorOptions.maxArticleWorkers)
+    NewsAggregatorLog::printUsage("--article-workers must be a positive count or <min>:<max> range.", argv[0]);
+  if (aggregatorOptions.fetchPolicy.attemptTimeout < 0 || aggregatorOptions.crawlDeadline < 0)
+    NewsAggregatorLog::printUsage("--request-timeout and --crawl-deadline can't be negative.", argv[0]);
+  if (aggregatorOptions.recrawlInterval < 0)
+    NewsAggregatorLog::printUsage("--recrawl can't be negative.", argv[0]);
+  if (aggregatorOptions.recrawlInterval > 0 &&
+      (!aggregatorOptions.queriesFile.empty() || !aggregatorOptions.recordDirectory.empty() ||
+       !aggregatorOptions.replayDirectory.empty()))
+    NewsAggregatorLog::printUsage("--recrawl can't be combined with --queries, --record or --replay.", argv[0]);
+  if (aggregatorOptions.retainCrawls > 0 && aggregatorOptions.recrawlInterval == 0)
+    NewsAggregatorLog::printUsage("--retain-crawls requires --recrawl.", argv[0]);
+  if (aggregatorOptions.resume && aggregatorOptions.checkpointFile.empty())
+    NewsAggregatorLog::printUsage("--resume requires --checkpoint.", argv[0]);
+  if (aggregatorOptions.memoryBudget < 0)
+    NewsAggregatorLog::printUsage("--memory-budget can't be negative.", argv[0]);
+  if (aggregatorOptions.numShards == 0 || aggregatorOptions.shardIndex >= aggregatorOptions.numShards)
+    NewsAggregatorLog::printUsage("--shard must be <i>/<N>, with i less than N.", argv[0]);
+  if (aggregatorOptions.numShards > 1 && aggregatorOptions.segmentFile.empty())
+    NewsAggregatorLog::printUsage("--shard requires --segment.", argv[0]);
+  if (!aggregatorOptions.indexFile.empty() &&
+      (aggregatorOptions.recrawlInterval > 0 || !aggregatorOptions.recordDirectory.empty() ||
+       !aggregatorOptions.replayDirectory.empty() || !aggregatorOptions.checkpointFile.empty() ||
+       aggregatorOptions.numShards > 1 || !aggregatorOptions.segmentFile.empty()))
+    NewsAggregatorLog::printUsage("--index replaces the crawl, so it can't be combined with --recrawl, --record, --replay,"
+                                  " --checkpoint, --shard or --segment.", argv[0]);
+  return new NewsAggregator(aggregatorOptions);
 }
 
 /**
@@ -80,11 +292,29 @@ NewsAggregator *NewsAggregator::createNewsAggregator(int argc, char *argv[]) {
 void NewsAggregator::buildIndex() {
   if (built) return;
   built = true; // optimistically assume it'll all work out
+  if (!options.indexFile.empty()) {
+    loadIndex();
+    return;
+  }
   xmlInitParser();
   xmlInitializeCatalog();
   processAllFeeds();
-  xmlCatalogCleanup();
-  xmlCleanupParser();
+  if (options.recrawlInterval > 0) {
+    // Only the first crawl is traced; recrawls go on indefinitely, and spans are never freed
+    Tracer::disable();
+    // The parser stays initialized for the recrawls
+    recrawler = thread([this] { recrawlPeriodically(); });
+  } else {
+    xmlCatalogCleanup();
+    xmlCleanupParser();
+  }
+  log.flush(); // so none of the crawl's messages interleave with what follows
+  if (corpus && !corpus->isReplaying()) log.noteCorpusRecorded(options.recordDirectory, corpus->getNumEntries());
+  if (!options.traceFile.empty()) {
+    long numSpans = Tracer::dump(options.traceFile);
+    if (numSpans < 0) log.noteTraceFileFailure(options.traceFile);
+    else log.noteTraceWritten(options.traceFile, numSpans);
+  }
 }
 
 /**
@@ -94,23 +324,33 @@ void NewsAggregator::buildIndex() {
  * the user to surface all of the news articles that contains a particular
  * search term.
  */
+static const size_t kMaxMatchesToShow = 15;
 void NewsAggregator::queryIndex() const {
-  static const size_t kMaxMatchesToShow = 15;
+  if (!options.queriesFile.empty()) {
+    runBatchQueries();
+    return;
+  }
+  if (!options.serveEndpoint.empty()) {
+    serveQueries();
+    return;
+  }
   while (true) {
     cout << "Enter a search term [or just hit <enter> to quit]: ";
     string response;
     getline(cin, response);
-    response = trim(response);
+    response = QueryCache::normalize(response);
     if (response.empty()) break;
-    const vector<pair<Article, int> >& matches = index.getMatchingArticles(response);
+    shared_ptr<const QueryResult> result = runQuery(response);
+    size_t numMatches = result->numMatches;
+    const vector<pair<Article, int> >& matches = result->matches;
     if (matches.empty()) {
       cout << "Ah, we didn't find the term \"" << response << "\". Try again." << endl;
     } else {
-      cout << "That term appears in " << matches.size() << " article"
-           << (matches.size() == 1 ? "" : "s") << ".  ";
-      if (matches.size() > kMaxMatchesToShow)
+      cout << "That term appears in " << numMatches << " article"
+           << (numMatches == 1 ? "" : "s") << ".  ";
+      if (numMatches > kMaxMatchesToShow)
         cout << "Here are the top " << kMaxMatchesToShow << " of them:" << endl;
-      else if (matches.size() > 1)
+      else if (numMatches > 1)
         cout << "Here they are:" << endl;
       else
         cout << "Here it is:" << endl;
@@ -129,94 +369,488 @@ void NewsAggregator::queryIndex() const {
       }
     }
   }
+  log.noteQueryCacheStats(queryCache.getHits(), queryCache.getMisses());
 }
 
-void NewsAggregator::updateRawMap(vector<string> tokens, pair<server, title> key, const Article& article) {
-    mapLock.lock(); // Only one thread should be modifying the map at a time
-    if (articleMap.find(key) == articleMap.end()) {
-	// If we haven't seen this server/title pair before, add it to the raw map
-        articleMap[key] = pair<Article, vector<string>>(article, tokens);
-    } else {
-	// Otherwise, taken the set intersection of the sorted token vectors of the current article
-	// and what we already have in the map for this article
-        pair<Article, vector<string>> curr = articleMap[key];
-        vector<string> currTokens = curr.second;
-        sort(currTokens.begin(), currTokens.end());
+shared_ptr<const QueryResult> NewsAggregator::runQuery(const string& rawQuery) const {
+  string query = analyzer.analyzeQuery(normalizer.normalize(rawQuery));
+  // Pin the current generation, which a recrawl may swap out at any moment
+  shared_ptr<const RSSIndex> index = atomic_load(&this->index);
+  uint64_t generation = index->getGeneration();
+  shared_ptr<const QueryResult> result = queryCache.lookup(query, generation);
+  if (result) return result;
+  shared_ptr<QueryResult> computed = make_shared<QueryResult>();
+  if (query.find(' ') == string::npos) {
+    computed->matches = index->getMatchingArticles(query, kMaxMatchesToShow, &computed->numMatches);
+  } else {
+    istringstream iss(query);
+    vector<string> words((istream_iterator<string>(iss)), istream_iterator<string>());
+    computed->matches = index->getArticlesContainingAll(words, kMaxMatchesToShow, &computed->numMatches);
+  }
+  queryCache.insert(query, generation, computed);
+  return computed;
+}
+
+/**
+ * Batch queries are handed to the pool in chunks, so that scheduling
+ * overhead is paid once per chunk rather than once per query.
+ */
+static const size_t kBatchChunkSize = 64;
+static const size_t kDefaultBatchWorkers = 4;
+static string sanitizeField(string field) {
+  replace_if(field.begin(), field.end(), [](char ch) { return ch == '\t' || ch == '\n' || ch == '\r'; }, ' ');
+  return field;
+}
+
+void NewsAggregator::runBatchQueries() const {
+  ifstream queriesFile(options.queriesFile);
+  if (!queriesFile) log.noteBatchQueryFileFailureAndExit(options.queriesFile);
+  vector<string> queries;
+  string line;
+  while (getline(queriesFile, line)) queries.push_back(QueryCache::normalize(line));
+
+  vector<shared_ptr<const QueryResult>> results(queries.size());
+  vector<double> latencies(queries.size());
+  size_t numWorkers = thread::hardware_concurrency();
+  if (numWorkers == 0) numWorkers = kDefaultBatchWorkers;
+  auto start = chrono::steady_clock::now();
+  {
+    ThreadPool queryPool(numWorkers);
+    for (size_t first = 0; first < queries.size(); first += kBatchChunkSize) {
+      size_t last = min(first + kBatchChunkSize, queries.size());
+      queryPool.schedule([this, first, last, &queries, &results, &latencies] {
+        for (size_t i = first; i < last; i++) {
+          auto queryStart = chrono::steady_clock::now();
+          results[i] = runQuery(queries[i]);
+          latencies[i] = chrono::duration<double, micro>(chrono::steady_clock::now() - queryStart).count();
+        }
+      });
+    }
+    queryPool.wait();
+  }
+  double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+  ofstream resultsFile;
+  if (!options.resultsFile.empty()) {
+    resultsFile.open(options.resultsFile);
+    if (!resultsFile) log.noteBatchQueryFileFailureAndExit(options.resultsFile);
+  }
+  ostream& out = options.resultsFile.empty() ? cout : resultsFile;
+  for (size_t i = 0; i < queries.size(); i++) {
+    const string query = sanitizeField(queries[i]);
+    if (results[i]->matches.empty()) {
+      out << query << '\t' << 0 << '\n';
+      continue;
+    }
+    size_t rank = 0;
+    for (const pair<Article, int>& match: results[i]->matches) {
+      out << query << '\t' << results[i]->numMatches << '\t' << ++rank << '\t' << match.second << '\t'
+          << sanitizeField(match.first.url) << '\t' << sanitizeField(match.first.title) << '\n';
+    }
+  }
+  out.flush();
+
+  sort(latencies.begin(), latencies.end());
+  auto percentile = [&latencies](double p) {
+    return latencies.empty() ? 0.0 : latencies[min(latencies.size() - 1, size_t(p * latencies.size()))];
+  };
+  log.noteBatchQueryStats(queries.size(), elapsed, percentile(0.50), percentile(0.90), percentile(0.99),
+                          latencies.empty() ? 0.0 : latencies.back());
+  log.noteQueryCacheStats(queryCache.getHits(), queryCache.getMisses());
+}
+
+/**
+ * Only this thread polls.  A connection with a request waiting is taken out
+ * of the poll set and handed to a worker, which answers what has arrived and
+ * then hands it back through the returned list, waking the poll through a
+ * pipe.  Idle connections cost a descriptor and a buffer, never a worker.
+ * Neither can a client tie one up for long: a request line can't outgrow
+ * kMaxRequestLength, and a client that stops reading its responses is
+ * dropped once a write has been stuck for kSendTimeout.
+ */
+static const size_t kNumServerWorkers = 32;
+static const size_t kMaxRequestLength = 8 << 10;
+static const long kSendTimeout = 5000; // in milliseconds
+void NewsAggregator::serveQueries() const {
+  int server = createServerSocket(options.serveEndpoint);
+  int wakeup[2];
+  if (server < 0 || fcntl(server, F_SETFL, O_NONBLOCK) < 0 || pipe2(wakeup, O_CLOEXEC | O_NONBLOCK) < 0) {
+    log.noteQueryServerFailureAndExit(options.serveEndpoint);
+  }
+  log.noteQueryServerListening(options.serveEndpoint);
+  ThreadPool connectionPool(kNumServerWorkers);
+  map<int, unique_ptr<SocketLineReader>> connections; // every open connection, by descriptor
+  set<int> idle; // the connections this thread is polling
+  mutex returnedLock;
+  vector<pair<int, bool>> returned; // connections workers are done with, and whether they're still open
+  vector<struct pollfd> polled;
+  while (true) {
+    polled.clear();
+    polled.push_back({server, POLLIN, 0});
+    polled.push_back({wakeup[0], POLLIN, 0});
+    for (int client : idle) polled.push_back({client, POLLIN, 0});
+    if (poll(polled.data(), polled.size(), -1) < 0) {
+      if (errno == EINTR) continue;
+      break;
+    }
+
+    if (polled[1].revents != 0) {
+      char drained[64];
+      while (read(wakeup[0], drained, sizeof(drained)) > 0) {}
+      lock_guard<mutex> lg(returnedLock);
+      for (const pair<int, bool>& connection : returned) {
+        if (connection.second) {
+          idle.insert(connection.first);
+        } else {
+          connections.erase(connection.first);
+          close(connection.first);
+        }
+      }
+      returned.clear();
+    }
+
+    for (size_t i = 2; i < polled.size(); i++) {
+      if (polled[i].revents == 0) continue;
+      int client = polled[i].fd;
+      idle.erase(client);
+      SocketLineReader *reader = connections[client].get();
+      connectionPool.schedule([this, client, reader, &returnedLock, &returned, &wakeup] {
+        bool open = serveRequests(client, *reader);
+        {
+          lock_guard<mutex> lg(returnedLock);
+          returned.push_back(make_pair(client, open));
+        }
+        char byte = 0;
+        if (write(wakeup[1], &byte, 1) < 0) {} // a full pipe already has the poll's attention
+      });
+    }
+
+    if (polled[0].revents != 0) {
+      int client = accept4(server, NULL, NULL, SOCK_CLOEXEC);
+      if (client >= 0 && !setSendTimeout(client, kSendTimeout)) {
+        close(client);
+      } else if (client >= 0) {
+        connections[client].reset(new SocketLineReader(client, kMaxRequestLength));
+        idle.insert(client);
+      } else if (errno != EINTR && errno != ECONNABORTED && errno != EAGAIN && errno != EWOULDBLOCK) {
+        break;
+      }
+    }
+  }
+  connectionPool.wait();
+  for (const auto& connection : connections) close(connection.first);
+  close(wakeup[0]);
+  close(wakeup[1]);
+  close(server);
+}
+
+bool NewsAggregator::serveRequests(int client, SocketLineReader& reader) const {
+  if (!reader.fill()) return false;
+  string query;
+  string response;
+  while (reader.takeLine(query)) {
+    shared_ptr<const QueryResult> result = runQuery(QueryCache::normalize(query));
+    response.clear();
+    response += to_string(result->numMatches) + " " + to_string(result->matches.size()) + "\n";
+    for (const pair<Article, int>& match: result->matches) {
+      response += to_string(match.second) + "\t" + sanitizeField(match.first.url) + "\t" +
+        sanitizeField(match.first.title) + "\n";
+    }
+    if (!writeFully(client, response)) return false;
+  }
+  return true;
+}
+
+/**
+ * Estimates the memory one raw map entry occupies: the map node, the strings
+ * in the key and article, and the bag.
+ */
+static const size_t kMapNodeOverhead = 4 * sizeof(void *); // parent, children and color
+static size_t getRawMapEntryBytes(const ArticleMap::value_type& entry) {
+    return kMapNodeOverhead + sizeof(entry) + entry.first.first.capacity() + entry.first.second.capacity() +
+           entry.second.first.url.capacity() + entry.second.first.title.capacity() + entry.second.second.bytes() -
+           sizeof(entry.second.second);
+}
+
+void NewsAggregator::updateRawMap(ArenaVector<token_view>& tokens, const pair<server, title>& key, const Article& article) {
+    // Sort and collapse the tokens before taking the lock, so the critical
+    // section is just the lookup and (at most) one bag intersection
+    TokenBag bag;
+    {
+        TraceSpan span("sort tokens");
         sort(tokens.begin(), tokens.end());
-        vector<string> tokens_intersect;
-        set_intersection(currTokens.begin(), currTokens.end(), tokens.begin(), tokens.end(),
-                         back_inserter(tokens_intersect));
+        bag.assign(tokens.data(), tokens.size());
+    }
+    if (checkpoint) checkpoint->recordArticle(article, bag); // lock-free, and the writer does the I/O
+    mergeIntoRawMap(bag, key, article);
+}
 
-	// Save the URL that comes first lexicographically
-	if (article.url > curr.first.url) {
-            articleMap[key] = pair<Article, vector<string>>(curr.first, tokens_intersect);
+void NewsAggregator::mergeIntoRawMap(TokenBag& bag, const pair<server, title>& key, const Article& article) {
+    // The smallest key in a near-duplicate cluster represents it, however the
+    // downloads happened to finish.  Another copy under the representative's
+    // own key still goes through the usual intersection below.
+    NearDuplicateDetector::key_t canonical;
+    bool displacing = false;
+    if (!options.keepNearDuplicates && bag.size() >= NearDuplicateDetector::kMinDistinctTokens) {
+        TraceSpan span("find near-duplicates");
+        if (nearDuplicates.findOrInsert(NearDuplicateDetector::fingerprint(bag), key, canonical)) {
+            if (canonical < key) {
+                log.noteSingleArticleNearDuplicateSkipped(article);
+                if (options.retainCrawls > 0) {
+                    lock_guard<mutex> lg(seenLock);
+                    nearDuplicateOf[article.url] = canonical;
+                }
+                return;
+            }
+            displacing = canonical != key;
+        }
+    }
+
+    ArticleMap full; // the whole raw map, if this update pushes it over the memory budget
+    url displacedURL; // the old representative's, if it was still in memory
+    {
+        unique_lock<mutex> ul(mapLock, defer_lock); // Only one thread should be modifying the map at a time
+        {
+            TraceSpan span("wait mapLock");
+            ul.lock();
+        }
+        TraceSpan span("update raw map");
+        numRawMapUpdates++;
+        if (displacing) {
+            // The old representative may already be in a spilled run, so its
+            // key is remembered and filtered out when the runs are merged
+            displacedKeys.insert(canonical);
+            auto displaced = articleMap.find(canonical);
+            if (displaced != articleMap.end()) {
+                log.noteSingleArticleNearDuplicateSkipped(displaced->second.first);
+                displacedURL = displaced->second.first.url;
+                rawMapBytes -= getRawMapEntryBytes(*displaced);
+                articleMap.erase(displaced);
+            }
+        }
+        if (displacedKeys.count(key) > 0) return; // displaced while we were waiting for the lock
+        if (!displacedURL.empty() && options.retainCrawls > 0) {
+            // Tied to its own key, so the next eviction forgets it, just as it
+            // forgets displaced representatives that were spilled
+            lock_guard<mutex> lg(seenLock); // seenLock may be taken inside mapLock, never the other way around
+            nearDuplicateOf[displacedURL] = canonical;
+        }
+        auto found = articleMap.find(key);
+        if (found == articleMap.end()) {
+            // If we haven't seen this server/title pair before, add it to the raw map
+            found = articleMap.emplace(key, make_pair(article, move(bag))).first;
         } else {
-            articleMap[key] = pair<Article, vector<string>>(article, tokens_intersect);
+            // Otherwise, taken the set intersection of the sorted tokens of the current article
+            // and what we already have in the map for this article
+            pair<Article, TokenBag>& curr = found->second;
+            rawMapBytes -= getRawMapEntryBytes(*found);
+            curr.second = curr.second.intersect(bag);
+
+            // Save the URL that comes first lexicographically
+            if (article.url <= curr.first.url) curr.first = article;
         }
+        rawMapBytes += getRawMapEntryBytes(*found);
+        if (!spill || rawMapBytes <= options.memoryBudget * kBytesPerMegabyte) return;
+        full.swap(articleMap);
+        rawMapBytes = 0;
     }
-    mapLock.unlock();
+
+    // This thread writes the old map out as a sorted run while the others carry on with a fresh one
+    TraceSpan span("spill raw map");
+    if (!spill->spill(full)) log.noteRawMapSpillFailureAndExit(spill->getDirectory());
+}
+
+void NewsAggregator::forgetURL(const url& articleUrl) {
+    lock_guard<mutex> lg(seenLock);
+    failedURLs.insert(articleUrl);
 }
 
 void NewsAggregator::runArticleThread(const Article& article) {
-    // Make sure this isn't a duplicate URL
-    seenLock.lock();
-    if (seenURLs.find(article.url) != seenURLs.end()) {
+    // Make sure this isn't a duplicate URL, noting that it's still listed either way
+    pair<server, title> key;
+    if (options.retainCrawls > 0) key = make_pair(getURLServer(article.url), article.title);
+    {
+        TraceSpan span("wait seenLock");
+        seenLock.lock();
+    }
+    if (options.retainCrawls > 0) lastListed[key] = crawlNumber;
+    auto seen = seenURLs.find(article.url);
+    if (seen != seenURLs.end()) {
+        seen->second = crawlNumber;
         seenLock.unlock();
         log.noteSingleArticleDownloadSkipped(article);
         return;
     }
-    seenURLs.insert(article.url);
+    seenURLs.emplace(article.url, crawlNumber);
     seenLock.unlock();
+    if (crawlToken.isCancelled()) {
+        forgetURL(article.url);
+        return;
+    }
 
-    const string& articleTitle = article.title;
-    const server& articleServer = getURLServer(article.url);
-
-    HTMLDocument document(article.url);
+    // Replaying involves no I/O, so the whole article is left to analysisPool
+    if (corpus && corpus->isReplaying()) {
+        analysisPool.schedule([this, article] { runAnalysisThread(article, nullptr); });
+        return;
+    }
 
+    shared_ptr<HTMLDocument> document;
     log.noteSingleArticleDownloadBeginning(article);
-    try {
-        document.parse();
-    } catch (const HTMLDocumentException& hde) {
+    ArticleFetcher::Outcome outcome;
+    {
+        // The permit times the download (and parse, and any retries) to steer articleConcurrency.
+        // Attempts the fetcher abandoned keep it until they actually finish
+        shared_ptr<ConcurrencyPermit> permit = make_shared<ConcurrencyPermit>(articleConcurrency);
+        if (crawlToken.isCancelled()) { // the crawl may have been cancelled while we waited for the permit
+            forgetURL(article.url);
+            return;
+        }
+        TraceSpan span("download and parse article");
+        outcome = fetcher.fetch(article.url, document, permit);
+        if (outcome == ArticleFetcher::kSucceeded) permit->markSucceeded();
+    }
+    if (outcome == ArticleFetcher::kPastDeadline) {
+        forgetURL(article.url);
+        log.noteSingleArticleDownloadDropped(article);
+        return;
+    }
+    if (outcome == ArticleFetcher::kFailed) {
+        forgetURL(article.url);
+        if (corpus) corpus->recordFailure(article.url);
         log.noteSingleArticleDownloadFailure(article);
         return;
     }
+    if (corpus) corpus->recordDocument(article.url, document->getTokens());
+
+    // The task takes over the document.  analysisPool's queue is bounded, so
+    // when analysis falls behind, downloads stall here rather than piling up
+    TraceSpan span("hand off article");
+    analysisPool.schedule([this, article, document] { runAnalysisThread(article, document); });
+}
+
+void NewsAggregator::runAnalysisThread(const Article& article, const shared_ptr<HTMLDocument>& document) {
+    const string& articleTitle = article.title;
+    const server& articleServer = getURLServer(article.url);
+
+    // Tokens are case folded, filtered and stemmed on the way in.  Those that
+    // come through unchanged are viewed in place (in the document, or in the
+    // corpus being replayed); rewritten copies are carved out of this worker's
+    // arena, which is rewound for every article
+    static thread_local Arena arena;
+    arena.reset();
+    ArenaVector<token_view> replayedTokens((ArenaAllocator<token_view>(&arena)));
+    if (!document) {
+        log.noteSingleArticleDownloadBeginning(article);
+        TraceSpan span("replay article");
+        if (!corpus->replayDocument(article.url, replayedTokens)) {
+            log.noteSingleArticleDownloadFailure(article);
+            return;
+        }
+    }
+
+    ArenaVector<token_view> tokens((ArenaAllocator<token_view>(&arena)));
+    AnalysisStats stats;
+    auto analyzeAll = [&](const auto& documentTokens) {
+        TraceSpan span("analyze tokens");
+        tokens.reserve(documentTokens.size());
+        for (const auto& token : documentTokens) {
+            token_view analyzed = analyzer.analyze(normalizer.normalize(token_view(token), arena), arena, stats);
+            if (!analyzed.empty()) tokens.push_back(analyzed);
+        }
+    };
+    if (document) analyzeAll(document->getTokens());
+    else analyzeAll(replayedTokens);
+    analyzer.record(stats);
 
     // Most of the legwork goes here
-    updateRawMap(document.getTokens(), pair<server, title>(articleServer, articleTitle), article);
+    updateRawMap(tokens, pair<server, title>(articleServer, articleTitle), article);
 }
 
 void NewsAggregator::runFeedThread(const pair<url, string>& f) {
     const url& feedUrl = f.first;
     // Check that we haven't seen this feed URI before, returning if we have
-    seenLock.lock();
-    if (seenURLs.find(feedUrl) != seenURLs.end()) {
+    {
+        TraceSpan span("wait seenLock");
+        seenLock.lock();
+    }
+    if (seenFeeds.find(feedUrl) != seenFeeds.end()) {
         seenLock.unlock();
         log.noteSingleFeedDownloadSkipped(feedUrl);
         return;
     }
-    seenURLs.insert(feedUrl);
+    seenFeeds.insert(feedUrl);
     seenLock.unlock();
+    if (crawlToken.isCancelled()) {
+        log.noteSingleFeedDownloadSkipped(feedUrl);
+        return;
+    }
+    if (fetcher.isPastDeadline()) {
+        numFeedsPastDeadline++; // reported alongside the articles dropped at the deadline
+        return;
+    }
 
-    RSSFeed feed(feedUrl);
+    // Each article task owns its Article, so this feed's worker can move on
+    // to the next feed as soon as the last article is queued.  articlePool's
+    // queue is bounded, so this blocks whenever the article workers fall
+    // behind, and only a few feeds' articles are ever queued.  Articles are
+    // queued by feed, so the feeds take turns rather than the biggest one
+    // holding up the rest
+    auto scheduleArticle = [this, &feedUrl](const Article& article) {
+        if (crawlToken.isCancelled()) return;
+        TraceSpan span("wait articlePool");
+        articlePool.schedule([this, article] {
+            runArticleThread(article); // Schedule a thread for this article
+        }, crawlToken, feedUrl);
+    };
 
     log.noteSingleFeedDownloadBeginning(feedUrl);
+    if (corpus && corpus->isReplaying()) {
+        vector<Article> articles;
+        if (!corpus->replayFeed(feedUrl, articles)) {
+            log.noteSingleFeedDownloadFailure(feedUrl);
+            return;
+        }
+        for (const Article& article : articles) scheduleArticle(article);
+        log.noteAllArticlesHaveBeenScheduledForFeed(feedUrl);
+        return;
+    }
+
+    if (canStreamRSS(feedUrl)) {
+        // Articles are scheduled as the parser reaches them, not after the whole feed is in
+        vector<Article> recorded;
+        size_t numArticles = 0;
+        bool parsed;
+        {
+            PausableTraceSpan span("download and parse feed");
+            parsed = streamRSSItems(feedUrl, [&](const url& articleUrl, const string& articleTitle) {
+                span.pause(); // a full articlePool is its own span
+                Article article{articleUrl, articleTitle};
+                if (corpus) recorded.push_back(article);
+                scheduleArticle(article);
+                numArticles++;
+                span.resume();
+            });
+        }
+        if (parsed || numArticles > 0) {
+            if (corpus) corpus->recordFeed(feedUrl, recorded);
+            log.noteAllArticlesHaveBeenScheduledForFeed(feedUrl);
+            return;
+        }
+        // Nothing came through, so let the library parser have a go, since it reads what libxml2 can't
+    }
+
+    RSSFeed feed(feedUrl);
     try {
+        TraceSpan span("download and parse feed");
         feed.parse();
     } catch (const RSSFeedException& rfe) {
+        if (corpus) corpus->recordFailure(feedUrl);
         log.noteSingleFeedDownloadFailure(feedUrl);
         return;
     }
-    const vector<Article>& articles = feed.getArticles();
-
-    semaphore completed(1 - articles.size());
-    for (const Article& article : articles) {
-        articlePool.schedule([this, &article, &completed] {
-            runArticleThread(article); // Schedule a thread for this article
-	    completed.signal();
-        });
-    }
+    if (corpus) corpus->recordFeed(feedUrl, feed.getArticles());
+    for (const Article& article : feed.getArticles()) scheduleArticle(article);
     log.noteAllArticlesHaveBeenScheduledForFeed(feedUrl);
-    completed.wait(); // wait for this feed to have downloaded all articles
 }
 
 /**
@@ -224,12 +858,139 @@ void NewsAggregator::runFeedThread(const pair<url, string>& f) {
  * -----------------------------------
  * Self-explanatory.
  */
-static const size_t kNumFeedWorkers = 8;
-static const size_t kNumArticleWorkers = 64;
-NewsAggregator::NewsAggregator(const string& rssFeedListURI, bool verbose): 
-    log(verbose), rssFeedListURI(rssFeedListURI), built(false), feedPool(kNumFeedWorkers),
-    articlePool(kNumArticleWorkers), seenURLs(), seenLock(),
-    articleMap(), mapLock() {}
+static const size_t kQueryCacheCapacity = 1024;
+static size_t getNumAnalysisWorkers(const NewsAggregatorOptions& options) {
+    if (options.numAnalysisWorkers > 0) return options.numAnalysisWorkers;
+    return max<size_t>(thread::hardware_concurrency(), 1);
+}
+
+static const size_t kQueuedTasksPerWorker = 2; // how far scheduling may run ahead of each pool's workers
+NewsAggregator::NewsAggregator(const NewsAggregatorOptions& options): 
+    log(options.verbose), options(options), rssFeedListURI(options.rssFeedListURI),
+    normalizer(options.stripAccents), analyzer(options.removeStopWords, options.stem, options.minTokenLength),
+    queryCache(kQueryCacheCapacity), built(false), feedPool(options.numFeedWorkers, options.numFeedWorkers * kQueuedTasksPerWorker),
+    articlePool(options.maxArticleWorkers, options.maxArticleWorkers * kQueuedTasksPerWorker),
+    analysisPool(getNumAnalysisWorkers(options), getNumAnalysisWorkers(options) * kQueuedTasksPerWorker),
+    articleConcurrency(options.minArticleWorkers, options.maxArticleWorkers), fetcher(options.fetchPolicy),
+    numFeedsPastDeadline(0), checkpoint(), seenURLs(), seenFeeds(), failedURLs(), lastListed(), crawlNumber(0), seenLock(), articleMap(), mapLock(), numRawMapUpdates(0),
+    numPublishedUpdates(0), rawMapBytes(0), spill(), displacedKeys(), nearDuplicates(), corpus(), stopRecrawling(false) {
+  if (!options.traceFile.empty()) Tracer::enable();
+  if (!options.recordDirectory.empty()) corpus.reset(new CrawlCorpus(options.recordDirectory, CrawlCorpus::kRecord));
+  if (!options.replayDirectory.empty()) corpus.reset(new CrawlCorpus(options.replayDirectory, CrawlCorpus::kReplay));
+  if (corpus && !corpus->open()) log.noteCorpusFailureAndExit(corpus->isReplaying() ? options.replayDirectory : options.recordDirectory);
+  if (!options.stopWordsFile.empty()) {
+    ifstream infile(options.stopWordsFile);
+    if (!infile) log.noteStopWordsFileFailureAndExit(options.stopWordsFile);
+    vector<string> stopWords;
+    string word;
+    while (infile >> word) stopWords.push_back(normalizer.normalize(word));
+    analyzer.setStopWords(stopWords);
+  }
+  if (!options.feedWeightsFile.empty()) loadFeedWeights(options.feedWeightsFile);
+  if (options.memoryBudget > 0) spill.reset(new RawMapSpill());
+  if (!options.checkpointFile.empty()) openCheckpoint();
+}
+
+/**
+ * Private Method: openCheckpoint
+ * ------------------------------
+ * Starts checkpointing every article analyzed into the checkpoint file.
+ * When resuming, first merges the articles already in it into the raw map
+ * and marks their URLs as seen, so the crawl only downloads what's left.
+ */
+void NewsAggregator::openCheckpoint() {
+  checkpoint.reset(new CrawlCheckpoint(options.checkpointFile));
+  auto resume = [this](const Article& article, TokenBag& bag) {
+    pair<server, title> key(getURLServer(article.url), article.title);
+    seenURLs.emplace(article.url, crawlNumber);
+    if (options.retainCrawls > 0) lastListed[key] = crawlNumber;
+    mergeIntoRawMap(bag, key, article);
+  };
+  if (!checkpoint->open(options.resume, resume)) log.noteCheckpointFailureAndExit(options.checkpointFile);
+  if (options.resume) log.noteCheckpointResumed(options.checkpointFile, checkpoint->getNumResumed());
+}
+
+/**
+ * Destructor: ~NewsAggregator
+ * ---------------------------
+ * Stops the recrawler, if there is one, cancelling whatever crawl it's in
+ * the middle of.
+ */
+NewsAggregator::~NewsAggregator() {
+  if (!recrawler.joinable()) return;
+  {
+    lock_guard<mutex> lg(recrawlLock);
+    stopRecrawling = true;
+    crawlToken.cancel();
+  }
+  recrawlStopped.notify_all();
+  feedPool.discardBacklog();
+  articlePool.discardBacklog();
+  recrawler.join();
+}
+
+/**
+ * Private Method: loadFeedWeights
+ * -------------------------------
+ * Reads lines of the form "<feed-url> [<weight>]" and gives each listed
+ * feed's articles that many turns in articlePool for every turn an
+ * unlisted feed gets.  A feed listed without a weight is taken to be a
+ * breaking news feed and gets kBreakingFeedWeight.
+ */
+static const size_t kBreakingFeedWeight = 4;
+void NewsAggregator::loadFeedWeights(const string& filename) {
+  ifstream infile(filename);
+  if (!infile) log.noteFeedWeightsFileFailureAndExit(filename);
+  string line;
+  while (getline(infile, line)) {
+    istringstream iss(line);
+    url feedUrl;
+    if (!(iss >> feedUrl) || feedUrl[0] == '#') continue;
+    size_t weight = kBreakingFeedWeight;
+    if (!(iss >> ws).eof() && (!(iss >> weight) || weight == 0)) log.noteFeedWeightsFileFailureAndExit(filename);
+    articlePool.setWeight(feedUrl, weight);
+  }
+}
+
+/**
+ * Private Method: cancelCrawl
+ * ---------------------------
+ * Cancels every feed and article download that hasn't started yet and
+ * waits for the ones that have to finish (or to notice the cancellation).
+ */
+void NewsAggregator::cancelCrawl() {
+    crawlToken.cancel();
+    feedPool.discardBacklog();
+    articlePool.discardBacklog();
+    feedPool.wait();
+    articlePool.wait();
+    analysisPool.wait();
+}
+
+/**
+ * While one of these is in scope, the first Ctrl-C cancels the supplied
+ * token rather than killing the process; a second one kills it as usual.
+ */
+namespace {
+class InterruptCancels {
+ public:
+  InterruptCancels(const CancellationToken& token) {
+    interruptible = &token;
+    struct sigaction interrupt;
+    memset(&interrupt, 0, sizeof(interrupt));
+    interrupt.sa_handler = cancelOnInterrupt;
+    interrupt.sa_flags = SA_RESETHAND;
+    sigaction(SIGINT, &interrupt, &previous);
+  }
+  ~InterruptCancels() { sigaction(SIGINT, &previous, NULL); }
+
+ private:
+  static const CancellationToken *interruptible;
+  static void cancelOnInterrupt(int) { interruptible->cancel(); }
+  struct sigaction previous;
+};
+const CancellationToken *InterruptCancels::interruptible = NULL;
+}
 
 /**
  * Private Method: processAllFeeds
@@ -241,29 +1002,335 @@ NewsAggregator::NewsAggregator(const string& rssFeedListURI, bool verbose):
  * You'll want to erase much of the code below and ultimately replace it with
  * your multithreaded aggregator.
  */
-void NewsAggregator::processAllFeeds() {
-    RSSFeedList feedList(rssFeedListURI);
-    try {
-        feedList.parse();
-    } catch (const RSSFeedListException& rfle) {
-        log.noteFullRSSFeedListDownloadFailureAndExit(rssFeedListURI);
+bool NewsAggregator::processAllFeeds() {
+    // Whatever has been downloaded by the time of a Ctrl-C is still indexed
+    InterruptCancels interruptCancels(crawlToken);
+    {
+        // Feeds are fetched afresh every crawl, and articles that failed last time get another chance
+        lock_guard<mutex> lg(seenLock);
+        seenFeeds.clear();
+        for (const url& failed : failedURLs) seenURLs.erase(failed);
+        failedURLs.clear();
+        crawlNumber++;
     }
-    log.noteFullRSSFeedListDownloadEnd();
+    numFeedsPastDeadline = 0;
 
-    const map<url, string>& feeds = feedList.getFeeds();
-
-    for (const pair<url, string>& f : feeds) {
-        feedPool.schedule([this, f] {
+    if (options.crawlDeadline > 0) {
+        fetcher.setDeadline(chrono::steady_clock::now() +
+                            chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(options.crawlDeadline)));
+    }
+    // Each feed task owns its copy of the feed's URL and title.  feedPool's
+    // queue is bounded, so a long feed list is read only as fast as the feed
+    // workers take feeds off it
+    size_t numFeeds = 0, numFeedsInShard = 0;
+    auto scheduleFeed = [this, &numFeeds, &numFeedsInShard](const url& feedUrl, const string& feedTitle) {
+        // Every shard reads the whole feed list, and crawls the feeds that hash to it
+        numFeeds++;
+        if (getShard(feedUrl, options.numShards) != options.shardIndex) return;
+        numFeedsInShard++;
+        TraceSpan span("wait feedPool");
+        feedPool.schedule([this, f = pair<url, string>(feedUrl, feedTitle)] {
             runFeedThread(f); // Schedule this feed
-        });
+        }, crawlToken);
+    };
+
+    if (corpus && corpus->isReplaying()) {
+        map<url, string> feeds;
+        if (!corpus->replayFeedList(rssFeedListURI, feeds)) return abandonCrawl();
+        log.noteFullRSSFeedListDownloadEnd();
+        for (const pair<const url, string>& f : feeds) scheduleFeed(f.first, f.second);
+    } else {
+        bool streamed = false;
+        if (canStreamRSS(rssFeedListURI)) {
+            // Feeds start downloading while the rest of the list is still being read
+            map<url, string> recorded;
+            size_t numStreamed = 0;
+            bool parsed;
+            {
+                PausableTraceSpan span("download and parse feed list");
+                parsed = streamRSSItems(rssFeedListURI, [&](const url& feedUrl, const string& feedTitle) {
+                    span.pause(); // a full feedPool is its own span
+                    if (corpus) recorded[feedUrl] = feedTitle;
+                    scheduleFeed(feedUrl, feedTitle);
+                    numStreamed++;
+                    span.resume();
+                });
+            }
+            if (!parsed && numStreamed > 0) {
+                // Some feeds may already be underway, so cancel them and let the workers wind down first
+                cancelCrawl();
+                if (corpus) corpus->recordFailure(rssFeedListURI);
+                return abandonCrawl();
+            }
+            if (parsed) {
+                if (corpus) corpus->recordFeedList(rssFeedListURI, recorded);
+                log.noteFullRSSFeedListDownloadEnd();
+                streamed = true;
+            }
+        }
+        if (!streamed) {
+            // Nothing came through, so let the library parser have a go, since it reads what libxml2 can't
+            RSSFeedList feedList(rssFeedListURI);
+            try {
+                TraceSpan span("download and parse feed list");
+                feedList.parse();
+            } catch (const RSSFeedListException& rfle) {
+                if (corpus) corpus->recordFailure(rssFeedListURI);
+                return abandonCrawl();
+            }
+            if (corpus) corpus->recordFeedList(rssFeedListURI, feedList.getFeeds());
+            log.noteFullRSSFeedListDownloadEnd();
+            for (const pair<const url, string>& f : feedList.getFeeds()) scheduleFeed(f.first, f.second);
+        }
     }
     log.noteAllFeedsHaveBeenScheduledForFeedList(rssFeedListURI);
+    if (options.numShards > 1) log.noteShardFeeds(options.shardIndex, options.numShards, numFeedsInShard, numFeeds);
 
     // Wait for all the threads to be idle, then add our final article objects to the real index.
-    feedPool.wait();
-    articlePool.wait();
+    {
+        TraceSpan span("wait for all downloads");
+        feedPool.wait();
+        articlePool.wait();
+        analysisPool.wait();
+    }
+    if (crawlToken.isCancelled()) log.noteCrawlCancelled(feedPool.getNumDropped(), articlePool.getNumDropped());
     log.noteAllRSSFeedsDownloadEnd();
-    for (auto& pair : articleMap) {
-	index.add(pair.second.first, pair.second.second);
+    if (!corpus || !corpus->isReplaying()) {
+        ConcurrencyStats concurrency = articleConcurrency.getStats();
+        log.noteConcurrencySummary(options.numFeedWorkers, getNumAnalysisWorkers(options), concurrency.finalLimit,
+                                   concurrency.lowestLimit, concurrency.highestLimit, concurrency.numDecreases,
+                                   concurrency.meanLatency);
+        FetchStats fetches = fetcher.getStats();
+        log.noteFetchSummary(fetches.numRetries, fetches.numTimeouts, fetches.numRefused, fetches.numHedges,
+                             fetches.numHedgeWins, numFeedsPastDeadline, fetches.numPastDeadline);
+    }
+    AnalysisStats totals = analyzer.getTotals();
+    log.noteAnalysisSummary(totals.numTokens, totals.numTooShort, totals.numStopWords, totals.numStemmed);
+    if (!options.keepNearDuplicates) {
+        log.noteNearDuplicateSummary(nearDuplicates.getNumClusters(), nearDuplicates.getNumDuplicates());
+    }
+    if (spill) log.noteRawMapSpillSummary(spill->getNumRuns(), spill->getNumSpilled(), spill->getSpilledBytes());
+    if (checkpoint && checkpoint->getWriteError() != 0) {
+        log.noteCheckpointWriteFailure(options.checkpointFile, checkpoint->getNumRecorded(), checkpoint->getWriteError());
+    }
+    // A cancelled crawl didn't get to list everything that's still current
+    if (options.retainCrawls > 0 && !crawlToken.isCancelled()) evictStaleArticles();
+    publishIndex();
+    log.noteIndexSummary(atomic_load(&index)->getPostingBytes());
+    if (!options.segmentFile.empty()) writeSegment();
+    return true;
+}
+
+/**
+ * Private Method: abandonCrawl
+ * ----------------------------
+ * Called when the feed list can't be read.  Without an index to fall back
+ * on there's nothing to do but exit; a recrawl just leaves the current
+ * index in place until the next one.
+ */
+bool NewsAggregator::abandonCrawl() {
+    if (!atomic_load(&index)) log.noteFullRSSFeedListDownloadFailureAndExit(rssFeedListURI);
+    log.noteRecrawlFeedListFailure(rssFeedListURI);
+    return false;
+}
+
+/**
+ * Private Method: evictStaleArticles
+ * ----------------------------------
+ * An article is stale once no crawl among the last retainCrawls has listed
+ * it (so a feed that's down for fewer crawls than that doesn't lose its
+ * articles).  Its key leaves the raw map, and with it the spilled runs,
+ * which are compacted into one, and its URLs leave seenURLs, so it's
+ * downloaded afresh if it's ever listed again.
+ *
+ * The near-duplicate clusters are rebuilt from the articles that remain,
+ * in key order.  Displaced representatives are dropped for good rather
+ * than filtered, and they and every near-duplicate skipped for an article
+ * that's now gone are forgotten too, so the next crawl downloads them
+ * again and clusters them against what's left.
+ */
+void NewsAggregator::evictStaleArticles() {
+    TraceSpan span("evict stale articles");
+    set<pair<server, title>> gone; // evicted, or displaced as near-duplicates
+    size_t numURLsEvicted = 0;
+    {
+        lock_guard<mutex> lg(seenLock);
+        auto isStale = [this](size_t lastCrawl) { return lastCrawl + options.retainCrawls <= crawlNumber; };
+        for (auto curr = seenURLs.begin(); curr != seenURLs.end();) {
+            if (!isStale(curr->second)) {
+                ++curr;
+                continue;
+            }
+            nearDuplicateOf.erase(curr->first);
+            curr = seenURLs.erase(curr);
+            numURLsEvicted++;
+        }
+        for (auto curr = lastListed.begin(); curr != lastListed.end();) {
+            if (!isStale(curr->second)) {
+                ++curr;
+                continue;
+            }
+            gone.insert(curr->first);
+            curr = lastListed.erase(curr);
+        }
+    }
+    if (gone.empty()) return;
+
+    size_t numEvicted = 0;
+    vector<url> forgotten; // the URLs of displaced representatives that were spilled
+    {
+        lock_guard<mutex> lg(mapLock);
+        nearDuplicates.clear();
+        auto keep = [this, &gone, &numEvicted, &forgotten](const ArticleKey& key, const Article& article, const TokenBag& bag) {
+            if (displacedKeys.count(key) > 0) {
+                forgotten.push_back(article.url);
+                return false;
+            }
+            if (gone.count(key) > 0) {
+                numEvicted++;
+                return false;
+            }
+            if (!options.keepNearDuplicates && bag.size() >= NearDuplicateDetector::kMinDistinctTokens) {
+                NearDuplicateDetector::key_t canonical;
+                nearDuplicates.findOrInsert(NearDuplicateDetector::fingerprint(bag), key, canonical);
+            }
+            return true;
+        };
+        if (spill) {
+            if (!spill->compact(articleMap, keep)) log.noteRawMapSpillFailureAndExit(spill->getDirectory());
+            articleMap.clear();
+            rawMapBytes = 0;
+        } else {
+            for (auto curr = articleMap.begin(); curr != articleMap.end();) {
+                if (keep(curr->first, curr->second.first, curr->second.second)) {
+                    ++curr;
+                    continue;
+                }
+                rawMapBytes -= getRawMapEntryBytes(*curr);
+                curr = articleMap.erase(curr);
+            }
+        }
+        gone.insert(displacedKeys.begin(), displacedKeys.end());
+        displacedKeys.clear();
+        numRawMapUpdates += numEvicted;
+    }
+
+    {
+        lock_guard<mutex> lg(seenLock);
+        for (const url& articleUrl : forgotten) seenURLs.erase(articleUrl);
+        for (auto curr = nearDuplicateOf.begin(); curr != nearDuplicateOf.end();) {
+            if (gone.count(curr->second) == 0) {
+                ++curr;
+                continue;
+            }
+            seenURLs.erase(curr->first);
+            curr = nearDuplicateOf.erase(curr);
+        }
+    }
+    log.noteStaleArticlesEvicted(numEvicted, numURLsEvicted, options.retainCrawls);
+}
+
+/**
+ * Private Method: publishIndex
+ * ----------------------------
+ * Builds a new index generation from the raw map and swaps it in for the
+ * current one.  Queries already running finish against the generation they
+ * started with, which is freed once the last of them lets go of it.  If
+ * the raw map hasn't changed since the last generation was built, the
+ * current one stays.
+ */
+void NewsAggregator::publishIndex() {
+    TraceSpan span("build index");
+    shared_ptr<RSSIndex> next;
+    {
+        lock_guard<mutex> lg(mapLock);
+        if (atomic_load(&index) && numRawMapUpdates == numPublishedUpdates) return;
+        numPublishedUpdates = numRawMapUpdates;
+        next = make_shared<RSSIndex>();
+        auto add = [this, &next](const ArticleKey& key, const Article& article, const TokenBag& bag) {
+            if (displacedKeys.count(key) == 0) next->add(article, bag);
+        };
+        if (spill) {
+            // Every entry goes straight from the merge into the index, so the
+            // runs are never all in memory at once
+            spill->merge(articleMap, add);
+        } else {
+            for (auto& pair : articleMap) add(pair.first, pair.second.first, pair.second.second);
+        }
+    }
+    next->freeze();
+    atomic_store(&index, shared_ptr<const RSSIndex>(move(next)));
+}
+
+/**
+ * Private Method: writeSegment
+ * ----------------------------
+ * Streams the raw map, merged with anything spilled from it, out to the
+ * segment file in key order.  A recrawl replaces the segment wholesale.
+ */
+void NewsAggregator::writeSegment() {
+    TraceSpan span("write segment");
+    IndexSegmentWriter writer(options.segmentFile);
+    bool written = writer.open();
+    auto append = [this, &writer, &written](const ArticleKey& key, const Article& article, const TokenBag& bag) {
+        if (displacedKeys.count(key) == 0) written = written && writer.append(key, article, bag);
+    };
+    {
+        lock_guard<mutex> lg(mapLock);
+        if (written && spill) {
+            spill->merge(articleMap, append);
+        } else if (written) {
+            for (const auto& entry : articleMap) append(entry.first, entry.second.first, entry.second.second);
+        }
+    }
+    if (!written || !writer.commit()) log.noteSegmentFailureAndExit(options.segmentFile);
+    log.noteSegmentWritten(options.segmentFile, writer.getNumArticles());
+}
+
+/**
+ * Private Method: loadIndex
+ * -------------------------
+ * Adds every article in the index file (typically merged from several
+ * shards' segments by merge-index) to a fresh index.  The articles were
+ * analyzed when they were crawled, so queries only match as they should
+ * if the same analysis options (--strip-accents, --no-stemming and so on)
+ * are passed now as were passed then.
+ */
+void NewsAggregator::loadIndex() {
+    TraceSpan span("load index");
+    IndexSegmentReader reader(options.indexFile);
+    if (!reader.open()) log.noteIndexFileFailureAndExit(options.indexFile);
+    shared_ptr<RSSIndex> loaded = make_shared<RSSIndex>();
+    size_t numArticles = 0;
+    while (reader.next()) {
+        loaded->add(reader.article(), reader.bag());
+        numArticles++;
+    }
+    loaded->freeze();
+    atomic_store(&index, shared_ptr<const RSSIndex>(move(loaded)));
+    log.noteIndexLoaded(options.indexFile, numArticles);
+}
+
+/**
+ * Private Method: recrawlPeriodically
+ * -----------------------------------
+ * Run by the recrawler thread in daemon mode.  Every recrawl interval, it
+ * fetches every feed again and downloads whichever of their articles
+ * haven't been seen before, then publishes a new index generation if
+ * anything changed.  Returns once the destructor asks it to.
+ */
+void NewsAggregator::recrawlPeriodically() {
+    chrono::steady_clock::duration interval =
+        chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(options.recrawlInterval));
+    unique_lock<mutex> ul(recrawlLock);
+    while (!recrawlStopped.wait_for(ul, interval, [this] { return stopRecrawling; })) {
+        crawlToken = CancellationToken(); // a fresh one, in case the last crawl was cancelled
+        ul.unlock();
+        auto start = chrono::steady_clock::now();
+        size_t numUpdatesBefore = numPublishedUpdates;
+        bool crawled = processAllFeeds();
+        double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        if (crawled) log.noteRecrawlEnd(numPublishedUpdates - numUpdatesBefore, elapsed);
+        ul.lock();
     }
 }
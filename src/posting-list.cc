@@ -0,0 +1,76 @@
+/**
+ * File: posting-list.cc
+ * ---------------------
+ * Presents the implementation of the PostingList class and its Cursor.
+ */
+
+#include "posting-list.h"
+#include <algorithm>
+using namespace std;
+
+const size_t PostingList::kBlockSize;
+
+static inline void encodeVarint(string& out, uint32_t value) {
+  while (value >= 0x80) {
+    out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+    value >>= 7;
+  }
+  out.push_back(static_cast<char>(value));
+}
+
+static inline uint32_t decodeVarint(const unsigned char *& in) {
+  uint32_t value = *in & 0x7f;
+  for (int shift = 7; *in++ & 0x80; shift += 7) value |= uint32_t(*in & 0x7f) << shift;
+  return value;
+}
+
+void PostingList::append(uint32_t docId, uint32_t frequency) {
+  if (numPostings % kBlockSize == 0) {
+    // Each block's deltas are relative to the last document of the
+    // previous block, so a block can be decoded without its predecessors.
+    Skip skip = {lastDocId, static_cast<uint32_t>(data.size()), 0};
+    skips.push_back(skip);
+  }
+  encodeVarint(data, docId - lastDocId);
+  encodeVarint(data, frequency - 1);
+  Skip& skip = skips.back();
+  skip.lastDocId = docId;
+  if (frequency > skip.maxFrequency) skip.maxFrequency = frequency;
+  lastDocId = docId;
+  numPostings++;
+}
+
+void PostingList::Cursor::decode() const {
+  decoded = true;
+  blockLength = min(kBlockSize, list->numPostings - block * kBlockSize);
+  const unsigned char *in = reinterpret_cast<const unsigned char *>(list->data.data()) + list->skips[block].offset;
+  uint32_t docId = block == 0 ? 0 : list->skips[block - 1].lastDocId;
+  for (size_t i = 0; i < blockLength; i++) {
+    docId += decodeVarint(in);
+    docIds[i] = docId;
+    frequencies[i] = decodeVarint(in) + 1;
+  }
+}
+
+void PostingList::Cursor::next() {
+  load();
+  if (++pos == blockLength) moveToBlock(block + 1);
+}
+
+void PostingList::Cursor::advanceTo(uint32_t target) {
+  if (done()) return;
+  const vector<Skip>& skips = list->skips;
+  if (skips[block].lastDocId < target) {
+    // Binary search the skip entries for the first block that could hold target
+    size_t low = block + 1, high = skips.size();
+    while (low < high) {
+      size_t mid = low + (high - low) / 2;
+      if (skips[mid].lastDocId < target) low = mid + 1;
+      else high = mid;
+    }
+    moveToBlock(low);
+    if (done()) return;
+  }
+  load();
+  while (docIds[pos] < target) pos++;
+}
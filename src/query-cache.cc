@@ -0,0 +1,68 @@
+/**
+ * File: query-cache.cc
+ * --------------------
+ * Presents the implementation of the QueryCache class.
+ */
+
+#include "query-cache.h"
+#include <cctype>
+using namespace std;
+
+QueryCache::QueryCache(size_t capacity):
+  shardCapacity((capacity + kNumShards - 1) / kNumShards), hits(0), misses(0) {}
+
+string QueryCache::normalize(const string& query) {
+  string normalized;
+  normalized.reserve(query.size());
+  bool pendingSpace = false;
+  for (char ch: query) {
+    if (isspace(static_cast<unsigned char>(ch))) {
+      pendingSpace = !normalized.empty();
+      continue;
+    }
+    if (pendingSpace) normalized.push_back(' ');
+    pendingSpace = false;
+    normalized.push_back(ch);
+  }
+  return normalized;
+}
+
+shared_ptr<const QueryResult> QueryCache::lookup(const string& query, uint64_t generation) {
+  Shard& shard = shardFor(query);
+  lock_guard<mutex> lg(shard.lock);
+  auto found = shard.lookup.find(query);
+  if (found == shard.lookup.end()) {
+    misses++;
+    return NULL;
+  }
+  if (found->second->generation != generation) {
+    // Computed against an older index, so it's of no use to anyone
+    shard.entries.erase(found->second);
+    shard.lookup.erase(found);
+    misses++;
+    return NULL;
+  }
+  shard.entries.splice(shard.entries.begin(), shard.entries, found->second);
+  hits++;
+  return found->second->result;
+}
+
+void QueryCache::insert(const string& query, uint64_t generation, const shared_ptr<const QueryResult>& result) {
+  if (shardCapacity == 0) return;
+  Shard& shard = shardFor(query);
+  lock_guard<mutex> lg(shard.lock);
+  auto found = shard.lookup.find(query);
+  if (found != shard.lookup.end()) {
+    found->second->generation = generation;
+    found->second->result = result;
+    shard.entries.splice(shard.entries.begin(), shard.entries, found->second);
+    return;
+  }
+  Entry entry = {query, generation, result};
+  shard.entries.push_front(entry);
+  shard.lookup[query] = shard.entries.begin();
+  if (shard.entries.size() > shardCapacity) {
+    shard.lookup.erase(shard.entries.back().query);
+    shard.entries.pop_back();
+  }
+}
@@ -0,0 +1,118 @@
+/**
+ * File: query-load.cc
+ * -------------------
+ * Load generator for aggregate's --serve mode.  Opens a number of concurrent
+ * connections to the query server, has each of them cycle through the queries
+ * in a file as fast as the server will answer them for a fixed duration, and
+ * then reports sustained throughput and latency percentiles.
+ *
+ *   ./query-load --connect <port|socket-path> --queries <file>
+ *                [--connections <n>] [--duration <seconds>]
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+#include "socket-utils.h"
+using namespace std;
+
+static const size_t kDefaultConnections = 8;
+static const double kDefaultDuration = 10;
+
+static void usage(const char *executable) {
+  cerr << "Usage: " << executable << " --connect <port|socket-path> --queries <file>"
+       << " [--connections <n>] [--duration <seconds>]" << endl;
+  exit(1);
+}
+
+/**
+ * Sends queries round-robin (starting at an offset, so connections don't all
+ * ask the same thing at once) until the deadline, recording each round trip
+ * in microseconds.  Returns false if the connection fails.
+ */
+static bool runConnection(const string& endpoint, const vector<string>& queries, size_t offset,
+                          chrono::steady_clock::time_point deadline, vector<double>& latencies) {
+  int fd = createClientSocket(endpoint);
+  if (fd < 0) return false;
+  SocketLineReader reader(fd);
+  string line;
+  bool ok = true;
+  for (size_t i = offset; chrono::steady_clock::now() < deadline; i++) {
+    const string& query = queries[i % queries.size()];
+    auto start = chrono::steady_clock::now();
+    if (!writeFully(fd, query + "\n") || !reader.readLine(line)) {
+      ok = false;
+      break;
+    }
+    size_t numShown = strtoul(line.c_str() + line.find(' ') + 1, NULL, 10);
+    for (size_t j = 0; j < numShown && ok; j++) ok = reader.readLine(line);
+    if (!ok) break;
+    latencies.push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - start).count());
+  }
+  close(fd);
+  return ok;
+}
+
+int main(int argc, char *argv[]) {
+  string endpoint, queriesFile;
+  size_t numConnections = kDefaultConnections;
+  double duration = kDefaultDuration;
+  for (int i = 1; i < argc; i++) {
+    if (i + 1 == argc) usage(argv[0]);
+    if (strcmp(argv[i], "--connect") == 0) endpoint = argv[++i];
+    else if (strcmp(argv[i], "--queries") == 0) queriesFile = argv[++i];
+    else if (strcmp(argv[i], "--connections") == 0) numConnections = strtoul(argv[++i], NULL, 10);
+    else if (strcmp(argv[i], "--duration") == 0) duration = strtod(argv[++i], NULL);
+    else usage(argv[0]);
+  }
+  if (endpoint.empty() || queriesFile.empty() || numConnections == 0) usage(argv[0]);
+
+  ifstream infile(queriesFile);
+  vector<string> queries;
+  string query;
+  while (getline(infile, query)) {
+    if (!query.empty()) queries.push_back(query);
+  }
+  if (queries.empty()) {
+    cerr << "No queries found in \"" << queriesFile << "\"." << endl;
+    return 1;
+  }
+
+  vector<vector<double>> latencies(numConnections);
+  vector<thread> connections;
+  atomic<size_t> numFailures(0);
+  auto start = chrono::steady_clock::now();
+  auto deadline = start + chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(duration));
+  for (size_t i = 0; i < numConnections; i++) {
+    connections.push_back(thread([&, i] {
+      if (!runConnection(endpoint, queries, i * queries.size() / numConnections, deadline, latencies[i])) numFailures++;
+    }));
+  }
+  for (thread& connection: connections) connection.join();
+  double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+  vector<double> all;
+  for (const vector<double>& perConnection: latencies) all.insert(all.end(), perConnection.begin(), perConnection.end());
+  sort(all.begin(), all.end());
+  auto percentile = [&all](double p) { return all.empty() ? 0.0 : all[min(all.size() - 1, size_t(p * all.size()))]; };
+  cout << numConnections << " connection" << (numConnections == 1 ? "" : "s") << ", " << all.size()
+       << " queries in " << fixed << setprecision(2) << elapsed << "s: "
+       << setprecision(0) << all.size() / elapsed << " queries/sec" << endl;
+  cout << "Latency (us): p50 " << setprecision(1) << percentile(0.50) << ", p90 " << percentile(0.90)
+       << ", p99 " << percentile(0.99) << ", max " << (all.empty() ? 0.0 : all.back()) << endl;
+  if (numFailures > 0) {
+    cerr << numFailures << " connection" << (numFailures == 1 ? "" : "s") << " failed." << endl;
+    return 1;
+  }
+  return 0;
+}
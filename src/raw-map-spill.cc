@@ -0,0 +1,102 @@
+/**
+ * File: raw-map-spill.cc
+ * ----------------------
+ * Presents the implementation of the RawMapSpill class.
+ */
+
+#include "raw-map-spill.h"
+#include <cstdlib>
+#include <memory>
+#include <fcntl.h>
+#include <unistd.h>
+using namespace std;
+
+RawMapSpill::RawMapSpill() {
+  const char *tmpdir = getenv("TMPDIR");
+  directory = tmpdir != NULL && *tmpdir != '\0' ? tmpdir : "/tmp";
+}
+
+RawMapSpill::~RawMapSpill() {
+  for (const Run& run : runs) close(run.fd);
+}
+
+/**
+ * Creates an anonymous temporary file: it's unlinked right away, so only
+ * the returned descriptor keeps it alive.
+ */
+static int createRunFile(const string& directory) {
+  string path = directory + "/aggregate-run-XXXXXX";
+  int fd = mkostemp(&path[0], O_CLOEXEC);
+  if (fd >= 0) unlink(path.c_str());
+  return fd;
+}
+
+bool RawMapSpill::spill(const ArticleMap& articles) {
+  int fd = createRunFile(directory);
+  if (fd < 0) return false;
+  SortedRunWriter writer(fd);
+  bool written = true;
+  for (auto curr = articles.begin(); curr != articles.end() && written; ++curr) {
+    written = writer.append(curr->first, curr->second.first, curr->second.second);
+  }
+  if (!written || !writer.finish()) {
+    close(fd);
+    return false;
+  }
+
+  lock_guard<mutex> lg(runsLock);
+  runs.push_back({fd, writer.getSize(), writer.getNumEntries()});
+  return true;
+}
+
+void RawMapSpill::merge(const ArticleMap& inMemory,
+                        const function<void(const ArticleKey&, const Article&, const TokenBag&)>& handler) const {
+  vector<unique_ptr<SortedRunReader>> readers;
+  vector<SortedSource *> sources;
+  for (const Run& run : runs) {
+    readers.emplace_back(new SortedRunReader(run.fd, 0, run.size));
+    sources.push_back(readers.back().get());
+  }
+  ArticleMapSource memory(inMemory);
+  sources.push_back(&memory);
+  mergeSortedSources(sources, handler);
+}
+
+bool RawMapSpill::compact(const ArticleMap& inMemory,
+                          const function<bool(const ArticleKey&, const Article&, const TokenBag&)>& keep) {
+  int fd = createRunFile(directory);
+  if (fd < 0) return false;
+  SortedRunWriter writer(fd);
+  bool written = true;
+  merge(inMemory, [&](const ArticleKey& key, const Article& article, const TokenBag& bag) {
+    if (keep(key, article, bag)) written = written && writer.append(key, article, bag);
+  });
+  if (!written || !writer.finish()) {
+    close(fd);
+    return false;
+  }
+
+  lock_guard<mutex> lg(runsLock);
+  for (const Run& run : runs) close(run.fd);
+  runs.assign(1, {fd, writer.getSize(), writer.getNumEntries()});
+  return true;
+}
+
+size_t RawMapSpill::getNumRuns() const {
+  lock_guard<mutex> lg(runsLock);
+  return runs.size();
+}
+
+size_t RawMapSpill::getNumSpilled() const {
+  lock_guard<mutex> lg(runsLock);
+  size_t numSpilled = 0;
+  for (const Run& run : runs) numSpilled += run.numEntries;
+  return numSpilled;
+}
+
+size_t RawMapSpill::getSpilledBytes() const {
+  lock_guard<mutex> lg(runsLock);
+  size_t numBytes = 0;
+  for (const Run& run : runs) numBytes += run.size;
+  return numBytes;
+}
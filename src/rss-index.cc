@@ -2,31 +2,315 @@
  * File: rss-index.cc
  * ------------------
  * Presents the implementation of the RSSIndex class, which is
- * little more than a glorified map.
+ * little more than a glorified map from words to compressed posting lists.
  */
 
 #include "rss-index.h"
 
 #include <algorithm>
+#include <atomic>
+#include <limits>
 
 using namespace std;
 
+static atomic<uint64_t> nextGeneration(0);
+RSSIndex::RSSIndex(): frozen(false), generation(nextGeneration++) {}
+
 void RSSIndex::add(const Article& article, const vector<string>& words) {
-  for (const string& word : words) { // iteration via for keyword, yay C++11
-    index[word][article]++;
+  vector<token_view> sorted(words.begin(), words.end());
+  sort(sorted.begin(), sorted.end());
+  TokenBag bag;
+  bag.assign(sorted.data(), sorted.size());
+  add(article, bag);
+}
+
+void RSSIndex::add(const Article& article, const TokenBag& words) {
+  if (frozen) thaw();
+  uint32_t docId = articles.size();
+  articles.push_back(article);
+  generation = nextGeneration++;
+  for (size_t i = 0; i < words.size(); i++) {
+    token_view word = words.term(i);
+    auto found = index.find(word);
+    if (found == index.end()) found = index.emplace(word.to_string(), PostingList()).first;
+    found->second.append(docId, words.count(i));
+  }
+}
+
+const PostingList *RSSIndex::find(const string& word) const {
+  if (frozen) {
+    size_t position = dictionary.find(word);
+    return position == TermDictionary::npos ? NULL : &postings[position];
   }
+  auto found = index.find(word);
+  return found == index.end() ? NULL : &found->second;
+}
+
+void RSSIndex::expand(const string& word, vector<const PostingList *>& lists) const {
+  if (!TermDictionary::isPattern(word)) {
+    const PostingList *list = find(word);
+    if (list != NULL) lists.push_back(list);
+  } else if (frozen) {
+    vector<size_t> positions;
+    dictionary.match(word, positions);
+    for (size_t position: positions) lists.push_back(&postings[position]);
+  } else {
+    string prefix = word.substr(0, word.find_first_of("*?"));
+    for (auto entry = index.lower_bound(prefix);
+         entry != index.end() && entry->first.compare(0, prefix.size(), prefix) == 0; ++entry) {
+      if (TermDictionary::matches(word, entry->first)) lists.push_back(&entry->second);
+    }
+  }
+}
+
+/**
+ * Keeps the best k (docId, frequency) candidates offered to it, ranked by
+ * frequency from high to low and then by Article.  The heap's front is the
+ * worst of the retained candidates, which makes it the bar to clear.
+ */
+namespace {
+class TopK {
+ public:
+  TopK(const vector<Article>& articles, size_t k): articles(articles), k(k) {}
+
+  bool full() const { return heap.size() == k; }
+  int threshold() const { return heap.front().second; }
+
+  void offer(uint32_t docId, int frequency) {
+    if (k == 0) return;
+    pair<uint32_t, int> candidate(docId, frequency);
+    if (heap.size() < k) {
+      heap.push_back(candidate);
+      push_heap(heap.begin(), heap.end(), Better(articles));
+    } else if (Better(articles)(candidate, heap.front())) {
+      pop_heap(heap.begin(), heap.end(), Better(articles));
+      heap.back() = candidate;
+      push_heap(heap.begin(), heap.end(), Better(articles));
+    }
+  }
+
+  vector<pair<Article, int> > results() {
+    sort_heap(heap.begin(), heap.end(), Better(articles));
+    vector<pair<Article, int> > v;
+    v.reserve(heap.size());
+    for (const pair<uint32_t, int>& match: heap) v.push_back(make_pair(articles[match.first], match.second));
+    return v;
+  }
+
+ private:
+  struct Better {
+    const vector<Article>& articles;
+    Better(const vector<Article>& articles): articles(articles) {}
+    bool operator()(const pair<uint32_t, int>& one, const pair<uint32_t, int>& two) const {
+      return one.second > two.second ||
+        (one.second == two.second && articles[one.first] < articles[two.first]);
+    }
+  };
+
+  const vector<Article>& articles;
+  size_t k;
+  vector<pair<uint32_t, int> > heap;
+};
+
+/**
+ * Walks the union of several posting lists in document id order, visiting
+ * each document once with its frequencies summed across the lists.  Cursors
+ * wait in a min-heap keyed on their current document id; the ones positioned
+ * on the current document are parked outside the heap until the union moves on.
+ */
+class UnionCursor {
+ public:
+  UnionCursor(const vector<const PostingList *>& lists) {
+    cursors.reserve(lists.size());
+    for (const PostingList *list: lists) cursors.emplace_back(*list);
+    for (size_t i = 0; i < cursors.size(); i++) push(i);
+    settle();
+  }
+
+  bool done() const { return current.empty(); }
+  uint32_t docId() const { return currentDocId; }
+  int frequency() const { return currentFrequency; }
+
+  void next() {
+    for (size_t i: current) {
+      cursors[i].next();
+      push(i);
+    }
+    settle();
+  }
+
+  void advanceTo(uint32_t target) {
+    if (done() || currentDocId >= target) return;
+    for (size_t i: current) {
+      cursors[i].advanceTo(target);
+      push(i);
+    }
+    while (!heap.empty() && cursors[heap.front()].docId() < target) {
+      size_t i = pop();
+      cursors[i].advanceTo(target);
+      push(i);
+    }
+    settle();
+  }
+
+ private:
+  vector<PostingList::Cursor> cursors;
+  vector<size_t> heap;
+  vector<size_t> current;
+  uint32_t currentDocId;
+  int currentFrequency;
+
+  struct Later {
+    const vector<PostingList::Cursor>& cursors;
+    Later(const vector<PostingList::Cursor>& cursors): cursors(cursors) {}
+    bool operator()(size_t one, size_t two) const { return cursors[one].docId() > cursors[two].docId(); }
+  };
+
+  void push(size_t i) {
+    if (cursors[i].done()) return;
+    heap.push_back(i);
+    push_heap(heap.begin(), heap.end(), Later(cursors));
+  }
+
+  size_t pop() {
+    pop_heap(heap.begin(), heap.end(), Later(cursors));
+    size_t i = heap.back();
+    heap.pop_back();
+    return i;
+  }
+
+  void settle() {
+    current.clear();
+    currentFrequency = 0;
+    if (heap.empty()) return;
+    currentDocId = cursors[heap.front()].docId();
+    while (!heap.empty() && cursors[heap.front()].docId() == currentDocId) {
+      size_t i = pop();
+      currentFrequency += cursors[i].frequency();
+      current.push_back(i);
+    }
+  }
+};
 }
 
-static const vector<pair<Article, int> > emptyResult;
 vector<pair<Article, int> > RSSIndex::getMatchingArticles(const string& word) const {
-  auto indexFound = index.find(word);
-  if (indexFound == index.end()) return emptyResult;
-  const map<Article, int>& matches = indexFound->second;
-  vector<pair<Article, int> > v;
-  for (const pair<const Article, int>& match: matches) v.push_back(match);
-  sort(v.begin(), v.end(), [](const pair<Article, int>& one, 
-                              const pair<Article, int>& two) {
-    return one.second > two.second || (one.second == two.second && one.first < two.first);
+  return getMatchingArticles(word, numeric_limits<size_t>::max()); // every match, in a single pass
+}
+
+vector<pair<Article, int> > RSSIndex::getMatchingArticles(const string& word, size_t k, size_t *numMatches) const {
+  TopK best(articles, k);
+  vector<const PostingList *> lists;
+  expand(word, lists);
+  if (numMatches != NULL) *numMatches = 0;
+  if (lists.empty()) return best.results();
+  if (lists.size() == 1) {
+    if (numMatches != NULL) *numMatches = lists[0]->size();
+    if (k == 0) return best.results();
+    PostingList::Cursor cursor(*lists[0]);
+    while (!cursor.done()) {
+      if (best.full() && int(cursor.blockMaxFrequency()) < best.threshold()) {
+        cursor.nextBlock();
+        continue;
+      }
+      best.offer(cursor.docId(), cursor.frequency());
+      cursor.next();
+    }
+    return best.results();
+  }
+
+  size_t count = 0;
+  for (UnionCursor cursor(lists); !cursor.done(); cursor.next()) {
+    count++;
+    best.offer(cursor.docId(), cursor.frequency());
+  }
+  if (numMatches != NULL) *numMatches = count;
+  return best.results();
+}
+
+vector<pair<Article, int> > RSSIndex::getArticlesContainingAll(const vector<string>& words, size_t k,
+                                                              size_t *numMatches) const {
+  TopK best(articles, k);
+  size_t count = 0;
+  if (numMatches != NULL) *numMatches = 0;
+  vector<string> distinct(words);
+  sort(distinct.begin(), distinct.end());
+  distinct.erase(unique(distinct.begin(), distinct.end()), distinct.end());
+  vector<pair<size_t, vector<const PostingList *> > > expansions;
+  for (const string& word: distinct) {
+    vector<const PostingList *> lists;
+    expand(word, lists);
+    if (lists.empty()) return best.results();
+    size_t size = 0;
+    for (const PostingList *list: lists) size += list->size();
+    expansions.push_back(make_pair(size, lists));
+  }
+  if (expansions.empty()) return best.results();
+  sort(expansions.begin(), expansions.end(), [](const pair<size_t, vector<const PostingList *> >& one,
+                                                const pair<size_t, vector<const PostingList *> >& two) {
+    return one.first < two.first;
   });
-  return v;
+
+  vector<UnionCursor> cursors;
+  cursors.reserve(expansions.size());
+  for (const auto& expansion: expansions) cursors.emplace_back(expansion.second);
+  UnionCursor& lead = cursors[0];
+  while (!lead.done()) {
+    uint32_t candidate = lead.docId();
+    int frequency = lead.frequency();
+    bool matchedAll = true;
+    for (size_t i = 1; i < cursors.size(); i++) {
+      cursors[i].advanceTo(candidate);
+      if (cursors[i].done()) goto exhausted;
+      if (cursors[i].docId() != candidate) {
+        candidate = cursors[i].docId();
+        matchedAll = false;
+        break;
+      }
+      frequency += cursors[i].frequency();
+    }
+    if (matchedAll) {
+      count++;
+      best.offer(candidate, frequency);
+      lead.next();
+    } else {
+      lead.advanceTo(candidate);
+    }
+  }
+
+exhausted:
+  if (numMatches != NULL) *numMatches = count;
+  return best.results();
+}
+
+void RSSIndex::freeze() {
+  if (frozen) return;
+  postings.reserve(index.size());
+  for (auto& entry: index) {
+    dictionary.append(entry.first);
+    entry.second.shrinkToFit();
+    postings.push_back(move(entry.second));
+  }
+  index.clear();
+  dictionary.shrinkToFit();
+  articles.shrink_to_fit();
+  frozen = true;
+}
+
+void RSSIndex::thaw() {
+  for (size_t i = 0; i < dictionary.size(); i++) {
+    index.emplace_hint(index.end(), dictionary.word(i).to_string(), move(postings[i]));
+  }
+  dictionary = TermDictionary();
+  postings.clear();
+  postings.shrink_to_fit();
+  frozen = false;
+}
+
+size_t RSSIndex::getPostingBytes() const {
+  size_t bytes = articles.capacity() * sizeof(Article);
+  for (const auto& entry: index) bytes += entry.first.capacity() + entry.second.bytes();
+  for (size_t i = 0; i < postings.size(); i++) {
+    bytes += dictionary.word(i).size() + sizeof(uint32_t) + postings[i].bytes();
+  }
+  return bytes;
 }
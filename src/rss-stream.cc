@@ -0,0 +1,81 @@
+/**
+ * File: rss-stream.cc
+ * -------------------
+ * Presents the implementation of the streaming RSS reader.
+ */
+
+#include "rss-stream.h"
+#include <cstring>
+#include <libxml/xmlreader.h>
+
+using namespace std;
+
+bool canStreamRSS(const string& uri) {
+  if (uri.compare(0, 7, "http://") == 0 || uri.compare(0, 7, "file://") == 0) return true;
+  return uri.find("://") == string::npos;
+}
+
+static string trim(const string& str) {
+  size_t start = str.find_first_not_of(" \t\r\n");
+  if (start == string::npos) return "";
+  size_t end = str.find_last_not_of(" \t\r\n");
+  return str.substr(start, end - start + 1);
+}
+
+static bool isNamed(xmlTextReaderPtr reader, const char *name) {
+  const xmlChar *localName = xmlTextReaderConstLocalName(reader);
+  return localName != NULL && strcmp(reinterpret_cast<const char *>(localName), name) == 0;
+}
+
+static const int kReaderOptions = XML_PARSE_RECOVER | XML_PARSE_NOERROR | XML_PARSE_NOWARNING | XML_PARSE_NOCDATA;
+bool streamRSSItems(const string& uri, const function<void(const string& link, const string& title)>& handler) {
+  xmlTextReaderPtr reader = xmlReaderForFile(uri.c_str(), NULL, kReaderOptions);
+  if (reader == NULL) return false;
+
+  enum { kNone, kLink, kTitle } field = kNone; // which of the entry's children we're reading the text of
+  bool inEntry = false;
+  int entryDepth = 0;
+  string link, title, text;
+  int status;
+  while ((status = xmlTextReaderRead(reader)) == 1) {
+    int type = xmlTextReaderNodeType(reader);
+    int depth = xmlTextReaderDepth(reader);
+    if (type == XML_READER_TYPE_ELEMENT) {
+      bool isEmpty = xmlTextReaderIsEmptyElement(reader);
+      if (!inEntry && (isNamed(reader, "item") || isNamed(reader, "entry"))) {
+        inEntry = !isEmpty;
+        entryDepth = depth;
+        link.clear();
+        title.clear();
+      } else if (inEntry && depth == entryDepth + 1) {
+        if (isNamed(reader, "link")) {
+          // Atom puts the URL in an attribute, and may list several links
+          xmlChar *href = xmlTextReaderGetAttribute(reader, BAD_CAST "href");
+          xmlChar *rel = xmlTextReaderGetAttribute(reader, BAD_CAST "rel");
+          if (href != NULL && (rel == NULL || xmlStrEqual(rel, BAD_CAST "alternate"))) {
+            link = trim(reinterpret_cast<const char *>(href));
+          }
+          xmlFree(href);
+          xmlFree(rel);
+          if (href == NULL && !isEmpty) field = kLink;
+        } else if (isNamed(reader, "title") && !isEmpty) {
+          field = kTitle;
+        }
+        text.clear();
+      }
+    } else if (field != kNone && (type == XML_READER_TYPE_TEXT || type == XML_READER_TYPE_CDATA)) {
+      const xmlChar *value = xmlTextReaderConstValue(reader);
+      if (value != NULL) text += reinterpret_cast<const char *>(value);
+    } else if (type == XML_READER_TYPE_END_ELEMENT && inEntry) {
+      if (depth == entryDepth + 1 && field != kNone) {
+        (field == kLink ? link : title) = trim(text);
+        field = kNone;
+      } else if (depth == entryDepth) {
+        inEntry = false;
+        if (!link.empty()) handler(link, title);
+      }
+    }
+  }
+  xmlFreeTextReader(reader);
+  return status == 0;
+}
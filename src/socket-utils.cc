@@ -0,0 +1,144 @@
+/**
+ * File: socket-utils.cc
+ * ---------------------
+ * Presents the implementation of the socket helpers.
+ */
+
+#include "socket-utils.h"
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+using namespace std;
+
+static bool isPort(const string& endpoint) {
+  return !endpoint.empty() && all_of(endpoint.begin(), endpoint.end(), [](char ch) { return ch >= '0' && ch <= '9'; });
+}
+
+static bool fillUnixAddress(const string& path, struct sockaddr_un& address) {
+  if (path.size() >= sizeof(address.sun_path)) return false;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, path.c_str());
+  return true;
+}
+
+static const long kMaxPort = 65535;
+static bool fillLoopbackAddress(const string& port, long minPort, struct sockaddr_in& address) {
+  errno = 0;
+  char *end;
+  long number = strtol(port.c_str(), &end, 10);
+  if (errno != 0 || *end != '\0' || number < minPort || number > kMaxPort) return false;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = htons(number);
+  return true;
+}
+
+int createServerSocket(const string& endpoint, int backlog) {
+  int fd = -1;
+  if (isPort(endpoint)) {
+    struct sockaddr_in address;
+    if (!fillLoopbackAddress(endpoint, 0, address)) return -1; // port 0 asks for any free port
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    int reuse = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (::bind(fd, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) < 0) goto failed;
+  } else {
+    struct sockaddr_un address;
+    if (!fillUnixAddress(endpoint, address)) return -1;
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    unlink(endpoint.c_str());
+    if (::bind(fd, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) < 0) goto failed;
+  }
+  if (listen(fd, backlog) < 0) goto failed;
+  return fd;
+
+failed:
+  close(fd);
+  return -1;
+}
+
+int createClientSocket(const string& endpoint) {
+  int fd;
+  if (isPort(endpoint)) {
+    struct sockaddr_in address;
+    if (!fillLoopbackAddress(endpoint, 1, address)) return -1;
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    int noDelay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    if (connect(fd, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) == 0) return fd;
+  } else {
+    struct sockaddr_un address;
+    if (!fillUnixAddress(endpoint, address)) return -1;
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) == 0) return fd;
+  }
+  close(fd);
+  return -1;
+}
+
+bool writeFully(int fd, const char *data, size_t length) {
+  while (length > 0) {
+    ssize_t written = send(fd, data, length, MSG_NOSIGNAL);
+    if (written < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    data += written;
+    length -= written;
+  }
+  return true;
+}
+
+bool setSendTimeout(int fd, long milliseconds) {
+  struct timeval timeout;
+  timeout.tv_sec = milliseconds / 1000;
+  timeout.tv_usec = (milliseconds % 1000) * 1000;
+  return setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) == 0;
+}
+
+static const size_t kReadChunkSize = 4096;
+bool SocketLineReader::readLine(string& line) {
+  while (!takeLine(line)) {
+    if (!fill()) return false;
+  }
+  return true;
+}
+
+bool SocketLineReader::fill() {
+  buffer.erase(0, start);
+  start = 0;
+  char chunk[kReadChunkSize];
+  ssize_t numRead;
+  do {
+    numRead = read(fd, chunk, sizeof(chunk));
+  } while (numRead < 0 && errno == EINTR);
+  if (numRead <= 0) return false;
+  buffer.append(chunk, numRead);
+  size_t newline = buffer.rfind('\n');
+  size_t unterminated = newline == string::npos ? buffer.size() : buffer.size() - newline - 1;
+  return unterminated <= maxLineLength;
+}
+
+bool SocketLineReader::takeLine(string& line) {
+  size_t newline = buffer.find('\n', start);
+  if (newline == string::npos) return false;
+  size_t end = newline;
+  if (end > start && buffer[end - 1] == '\r') end--;
+  line.assign(buffer, start, end - start);
+  start = newline + 1;
+  return true;
+}
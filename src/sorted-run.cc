@@ -0,0 +1,133 @@
+/**
+ * File: sorted-run.cc
+ * -------------------
+ * Presents the implementation of sorted run reading, writing and merging.
+ */
+
+#include "sorted-run.h"
+#include "article-record.h"
+#include <algorithm>
+#include <unistd.h>
+using namespace std;
+
+static const size_t kLengthSize = 4;
+static const size_t kChunkSize = 1 << 20; // runs are written, and read back, a megabyte at a time
+
+bool ArticleMapSource::next() {
+  if (started) ++curr;
+  else curr = articles.begin();
+  started = true;
+  return curr != articles.end();
+}
+
+SortedRunReader::SortedRunReader(int fd, size_t start, size_t end):
+  fd(fd), offset(start), end(end), position(0) {}
+
+bool SortedRunReader::next() {
+  if (!fill(kLengthSize)) return false;
+  size_t length = readUint32(buffer.data() + position);
+  if (!fill(kLengthSize + length)) return false;
+  const char *data = buffer.data() + position + kLengthSize, *recordEnd = data + length;
+  token_view server;
+  if (!readString(data, recordEnd, server) || !readArticleRecord(data, recordEnd, currArticle, currBag, scratch))
+    return false;
+  currKey.first = server.to_string();
+  currKey.second = currArticle.title;
+  position += kLengthSize + length;
+  return true;
+}
+
+void SortedRunReader::take(Article& article, TokenBag& bag) {
+  article = move(currArticle);
+  bag = move(currBag);
+}
+
+bool SortedRunReader::fill(size_t needed) {
+  if (buffer.size() - position >= needed) return true;
+  buffer.erase(0, position);
+  position = 0;
+  while (buffer.size() < needed && offset < end) {
+    size_t count = min(max(kChunkSize, needed - buffer.size()), end - offset);
+    size_t start = buffer.size();
+    buffer.resize(start + count);
+    ssize_t numRead = pread(fd, &buffer[start], count, offset);
+    if (numRead <= 0) {
+      buffer.resize(start);
+      return false;
+    }
+    buffer.resize(start + numRead);
+    offset += numRead;
+  }
+  return buffer.size() >= needed;
+}
+
+static bool appendFully(int fd, const string& data) {
+  size_t written = 0;
+  while (written < data.size()) {
+    ssize_t count = write(fd, data.data() + written, data.size() - written);
+    if (count < 0) return false;
+    written += count;
+  }
+  return true;
+}
+
+bool SortedRunWriter::append(const ArticleKey& key, const Article& article, const TokenBag& bag) {
+  if (failed) return false;
+  record.clear();
+  appendString(record, key.first);
+  appendArticleRecord(record, article, bag);
+  appendUint32(chunk, record.size());
+  chunk += record;
+  numEntries++;
+  return chunk.size() < kChunkSize || flush();
+}
+
+bool SortedRunWriter::finish() {
+  return !failed && flush();
+}
+
+bool SortedRunWriter::flush() {
+  failed = !appendFully(fd, chunk);
+  size += chunk.size();
+  chunk.clear();
+  return !failed;
+}
+
+void mergeSortedSources(const vector<SortedSource *>& sources,
+                        const function<void(const ArticleKey&, const Article&, const TokenBag&)>& handler) {
+  auto laterKey = [](SortedSource *one, SortedSource *two) { return two->key() < one->key(); }; // a min-heap
+  vector<SortedSource *> heap;
+  for (SortedSource *source : sources) {
+    if (source->next()) heap.push_back(source);
+  }
+  make_heap(heap.begin(), heap.end(), laterKey);
+  auto pop = [&] {
+    pop_heap(heap.begin(), heap.end(), laterKey);
+    SortedSource *source = heap.back();
+    heap.pop_back();
+    return source;
+  };
+  auto advance = [&](SortedSource *source) {
+    if (!source->next()) return;
+    heap.push_back(source);
+    push_heap(heap.begin(), heap.end(), laterKey);
+  };
+
+  ArticleKey key;
+  Article article;
+  TokenBag bag;
+  while (!heap.empty()) {
+    SortedSource *source = pop();
+    key = source->key();
+    source->take(article, bag);
+    advance(source);
+    while (!heap.empty() && heap.front()->key() == key) {
+      // Combine versions of the same article just as the raw map does
+      source = pop();
+      bag = bag.intersect(source->bag());
+      if (source->article().url <= article.url) article = source->article();
+      advance(source);
+    }
+    handler(key, article, bag);
+  }
+}
@@ -0,0 +1,77 @@
+/**
+ * File: term-dictionary.cc
+ * ------------------------
+ * Presents the implementation of the TermDictionary class.
+ */
+
+#include "term-dictionary.h"
+using namespace std;
+
+const size_t TermDictionary::npos;
+
+void TermDictionary::append(token_view word) {
+  offsets.push_back(words.size());
+  words.append(word.data(), word.size());
+}
+
+size_t TermDictionary::lowerBound(token_view word) const {
+  size_t low = 0, high = size();
+  while (low < high) {
+    size_t mid = low + (high - low) / 2;
+    if (this->word(mid) < word) low = mid + 1;
+    else high = mid;
+  }
+  return low;
+}
+
+size_t TermDictionary::find(token_view word) const {
+  size_t position = lowerBound(word);
+  return position < size() && this->word(position) == word ? position : npos;
+}
+
+pair<size_t, size_t> TermDictionary::prefixRange(token_view prefix) const {
+  size_t first = lowerBound(prefix);
+  size_t low = first, high = size();
+  while (low < high) {
+    size_t mid = low + (high - low) / 2;
+    if (word(mid).substr(0, prefix.size()) == prefix) low = mid + 1;
+    else high = mid;
+  }
+  return make_pair(first, low);
+}
+
+bool TermDictionary::matches(token_view pattern, token_view word) {
+  // Classic greedy glob match: on a mismatch, retry from just past the most
+  // recent '*', letting it absorb one more character.
+  size_t p = 0, w = 0, star = token_view::npos, resume = 0;
+  while (w < word.size()) {
+    if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == word[w])) {
+      p++;
+      w++;
+    } else if (p < pattern.size() && pattern[p] == '*') {
+      star = p++;
+      resume = w;
+    } else if (star != token_view::npos) {
+      p = star + 1;
+      w = ++resume;
+    } else {
+      return false;
+    }
+  }
+  while (p < pattern.size() && pattern[p] == '*') p++;
+  return p == pattern.size();
+}
+
+void TermDictionary::match(const string& pattern, vector<size_t>& positions) const {
+  size_t literal = pattern.find_first_of("*?");
+  if (literal == string::npos) {
+    size_t position = find(pattern);
+    if (position != npos) positions.push_back(position);
+    return;
+  }
+  pair<size_t, size_t> range = prefixRange(token_view(pattern).substr(0, literal));
+  bool prefixOnly = literal + 1 == pattern.size() && pattern[literal] == '*';
+  for (size_t position = range.first; position < range.second; position++) {
+    if (prefixOnly || matches(pattern, word(position))) positions.push_back(position);
+  }
+}
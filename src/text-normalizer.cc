@@ -0,0 +1,255 @@
+/**
+ * File: text-normalizer.cc
+ * ------------------------
+ * Presents the implementation of the TextNormalizer class.  The SSE2 path
+ * handles runs of ASCII 16 bytes at a time; anything else is decoded one
+ * code point at a time and folded through the small tables below, which
+ * cover the scripts our feeds are actually written in.
+ */
+
+#include "text-normalizer.h"
+#include <cstring>
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+#if defined(__SSE2__)
+// Lanes holding 'A' through 'Z' come back as 0xFF, all others as 0x00.
+static inline __m128i uppercaseLanes(__m128i v) {
+  return _mm_cmpeq_epi8(_mm_subs_epu8(_mm_sub_epi8(v, _mm_set1_epi8('A')), _mm_set1_epi8('Z' - 'A')),
+                        _mm_setzero_si128());
+}
+#endif
+
+static inline bool needsFolding(unsigned char ch) {
+  return ch >= 0x80 || (ch >= 'A' && ch <= 'Z');
+}
+
+static bool isNormalized(const char *text, size_t length) {
+  size_t i = 0;
+#if defined(__SSE2__)
+  for (; i + 16 <= length; i += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(text + i));
+    if (_mm_movemask_epi8(_mm_or_si128(v, uppercaseLanes(v))) != 0) return false;
+  }
+#endif
+  for (; i < length; i++) {
+    if (needsFolding(text[i])) return false;
+  }
+  return true;
+}
+
+/**
+ * Decodes the UTF-8 sequence at the front of text, returning its length in
+ * bytes, or 0 if it's malformed (overlong, truncated, a surrogate, or out
+ * of range).
+ */
+static size_t decode(const unsigned char *text, size_t length, uint32_t& cp) {
+  unsigned char lead = text[0];
+  size_t numBytes;
+  uint32_t smallest;
+  if (lead >= 0xC2 && lead <= 0xDF) {
+    numBytes = 2;
+    cp = lead & 0x1F;
+    smallest = 0x80;
+  } else if (lead >= 0xE0 && lead <= 0xEF) {
+    numBytes = 3;
+    cp = lead & 0x0F;
+    smallest = 0x800;
+  } else if (lead >= 0xF0 && lead <= 0xF4) {
+    numBytes = 4;
+    cp = lead & 0x07;
+    smallest = 0x10000;
+  } else {
+    return 0;
+  }
+  if (numBytes > length) return 0;
+  for (size_t i = 1; i < numBytes; i++) {
+    if ((text[i] & 0xC0) != 0x80) return 0;
+    cp = (cp << 6) | (text[i] & 0x3F);
+  }
+  if (cp < smallest || cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF)) return 0;
+  return numBytes;
+}
+
+static size_t encode(uint32_t cp, char *out) {
+  if (cp < 0x80) {
+    out[0] = cp;
+    return 1;
+  }
+  if (cp < 0x800) {
+    out[0] = 0xC0 | (cp >> 6);
+    out[1] = 0x80 | (cp & 0x3F);
+    return 2;
+  }
+  if (cp < 0x10000) {
+    out[0] = 0xE0 | (cp >> 12);
+    out[1] = 0x80 | ((cp >> 6) & 0x3F);
+    out[2] = 0x80 | (cp & 0x3F);
+    return 3;
+  }
+  out[0] = 0xF0 | (cp >> 18);
+  out[1] = 0x80 | ((cp >> 12) & 0x3F);
+  out[2] = 0x80 | ((cp >> 6) & 0x3F);
+  out[3] = 0x80 | (cp & 0x3F);
+  return 4;
+}
+
+// Greek letters whose folding doesn't follow from their position in the
+// alphabet: accented capitals, letter-like symbols, and archaic letters.
+static const pair<uint16_t, uint16_t> kGreekFoldings[] = {
+  {0x37F, 0x3F3}, {0x386, 0x3AC}, {0x388, 0x3AD}, {0x389, 0x3AE}, {0x38A, 0x3AF}, {0x38C, 0x3CC},
+  {0x38E, 0x3CD}, {0x38F, 0x3CE}, {0x3C2, 0x3C3}, {0x3CF, 0x3D7}, {0x3D0, 0x3B2}, {0x3D1, 0x3B8},
+  {0x3D5, 0x3C6}, {0x3D6, 0x3C0}, {0x3F0, 0x3BA}, {0x3F1, 0x3C1}, {0x3F4, 0x3B8}, {0x3F5, 0x3B5},
+  {0x3F7, 0x3F8}, {0x3F9, 0x3F2}, {0x3FA, 0x3FB}, {0x3FD, 0x37B}, {0x3FE, 0x37C}, {0x3FF, 0x37D}
+};
+
+/**
+ * Unicode simple case folding (CaseFolding.txt, status C and S) for Latin-1,
+ * Latin Extended-A, Greek and Coptic, and Cyrillic, plus the capital sharp s and the
+ * Kelvin and Angstrom signs.  Every mapping here encodes in no more bytes
+ * than the code point it replaces.
+ */
+static uint32_t foldCase(uint32_t cp) {
+  if (cp < 0x80) return (cp >= 'A' && cp <= 'Z') ? cp + ('a' - 'A') : cp;
+  if (cp < 0x100) {
+    if (cp == 0xB5) return 0x3BC; // micro sign folds to mu
+    return (cp >= 0xC0 && cp <= 0xDE && cp != 0xD7) ? cp + 0x20 : cp;
+  }
+  if (cp < 0x180) {
+    if (cp == 0x130 || cp == 0x138 || cp == 0x149) return cp; // no simple folding
+    if (cp == 0x178) return 0xFF;
+    if (cp == 0x17F) return 's';
+    // Capitals sit on even code points up through U+0137 and again from
+    // U+014A to U+0177, and on odd ones elsewhere
+    bool evenIsUpper = cp < 0x138 || (cp > 0x149 && cp < 0x178);
+    return (cp % 2 == 0) == evenIsUpper ? cp + 1 : cp;
+  }
+  if (cp >= 0x370 && cp < 0x400) {
+    if (cp >= 0x391 && cp <= 0x3AB && cp != 0x3A2) return cp + 32;
+    if ((cp >= 0x370 && cp <= 0x377 && cp != 0x374) || (cp >= 0x3D8 && cp <= 0x3EF)) {
+      return cp % 2 == 0 ? cp + 1 : cp;
+    }
+    const pair<uint16_t, uint16_t> *end = kGreekFoldings + sizeof(kGreekFoldings) / sizeof(kGreekFoldings[0]);
+    const pair<uint16_t, uint16_t> *found = lower_bound(kGreekFoldings, end, make_pair(uint16_t(cp), uint16_t(0)));
+    return found != end && found->first == cp ? found->second : cp;
+  }
+  if (cp >= 0x400 && cp < 0x530) {
+    if (cp < 0x410) return cp + 80;
+    if (cp < 0x430) return cp + 32;
+    if (cp == 0x4C0) return 0x4CF;
+    if ((cp >= 0x460 && cp <= 0x481) || (cp >= 0x48A && cp <= 0x4BF) || cp >= 0x4D0) {
+      return cp % 2 == 0 ? cp + 1 : cp;
+    }
+    if (cp >= 0x4C1 && cp <= 0x4CE) return cp % 2 == 1 ? cp + 1 : cp;
+    return cp;
+  }
+  if (cp == 0x1E9E) return 0xDF;
+  if (cp == 0x212A) return 'k';
+  if (cp == 0x212B) return 0xE5;
+  return cp;
+}
+
+/**
+ * Base letters for the (already folded) accented letters of Latin-1 and
+ * Latin Extended-A.  Each entry covers the code points after the previous
+ * entry's up through last; a NULL base means the code point is kept.
+ */
+struct AccentRange {
+  uint32_t last;
+  const char *base;
+};
+
+static const uint32_t kFirstAccented = 0xDF;
+static const uint32_t kLastAccented = 0x17F;
+static const AccentRange kAccentRanges[] = {
+  {0xDF, "ss"}, {0xE5, "a"}, {0xE6, "ae"}, {0xE7, "c"}, {0xEB, "e"}, {0xEF, "i"}, {0xF0, "d"},
+  {0xF1, "n"}, {0xF6, "o"}, {0xF7, NULL}, {0xF8, "o"}, {0xFC, "u"}, {0xFD, "y"}, {0xFE, "th"},
+  {0xFF, "y"}, {0x105, "a"}, {0x10D, "c"}, {0x111, "d"}, {0x11B, "e"}, {0x123, "g"}, {0x127, "h"},
+  {0x131, "i"}, {0x133, "ij"}, {0x135, "j"}, {0x138, "k"}, {0x142, "l"}, {0x14B, "n"}, {0x151, "o"},
+  {0x153, "oe"}, {0x159, "r"}, {0x161, "s"}, {0x167, "t"}, {0x173, "u"}, {0x175, "w"}, {0x178, "y"},
+  {0x17E, "z"}, {0x17F, "s"}
+};
+
+static const char *accentBase(uint32_t cp) {
+  if (cp < kFirstAccented || cp > kLastAccented) return NULL;
+  const AccentRange *end = kAccentRanges + sizeof(kAccentRanges) / sizeof(kAccentRanges[0]);
+  const AccentRange *found = lower_bound(kAccentRanges, end, cp, [](const AccentRange& range, uint32_t cp) {
+    return range.last < cp;
+  });
+  return found->base;
+}
+
+static inline bool isCombiningMark(uint32_t cp) {
+  return cp >= 0x300 && cp <= 0x36F;
+}
+
+size_t TextNormalizer::fold(const char *text, size_t length, char *out) const {
+  const unsigned char *bytes = reinterpret_cast<const unsigned char *>(text);
+  size_t i = 0, j = 0; // j never passes i, which is what makes the 16-byte stores safe
+  while (i < length) {
+#if defined(__SSE2__)
+    if (i + 16 <= length) {
+      __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(text + i));
+      if (_mm_movemask_epi8(v) == 0) {
+        v = _mm_or_si128(v, _mm_and_si128(uppercaseLanes(v), _mm_set1_epi8(0x20)));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + j), v);
+        i += 16;
+        j += 16;
+        continue;
+      }
+    }
+#endif
+    unsigned char ch = bytes[i];
+    if (ch < 0x80) {
+      out[j++] = (ch >= 'A' && ch <= 'Z') ? ch + ('a' - 'A') : ch;
+      i++;
+      continue;
+    }
+
+    uint32_t cp;
+    size_t numBytes = decode(bytes + i, length - i, cp);
+    if (numBytes == 0) {
+      out[j++] = text[i++];
+      continue;
+    }
+    uint32_t folded = foldCase(cp);
+    if (stripAccents) {
+      if (isCombiningMark(folded)) {
+        i += numBytes;
+        continue;
+      }
+      const char *base = accentBase(folded);
+      if (base != NULL) {
+        while (*base != '\0') out[j++] = *base++;
+        i += numBytes;
+        continue;
+      }
+    }
+    if (folded == cp) {
+      memcpy(out + j, text + i, numBytes);
+      j += numBytes;
+    } else {
+      j += encode(folded, out + j);
+    }
+    i += numBytes;
+  }
+  return j;
+}
+
+token_view TextNormalizer::normalize(token_view token, Arena& arena) const {
+  if (isNormalized(token.data(), token.size())) return token;
+  char *out = static_cast<char *>(arena.allocate(token.size(), 1));
+  return token_view(out, fold(token.data(), token.size(), out));
+}
+
+string TextNormalizer::normalize(const string& text) const {
+  if (isNormalized(text.data(), text.size())) return text;
+  string normalized(text.size(), '\0');
+  normalized.resize(fold(text.data(), text.size(), &normalized[0]));
+  return normalized;
+}
@@ -12,8 +12,9 @@
 using namespace std;
 using develop::ThreadPool;
 
-ThreadPool::ThreadPool(size_t numThreads):
-    wts(numThreads), workers(numThreads), num_workers(0), num_available_workers(0), done(false)
+ThreadPool::ThreadPool(size_t numThreads, size_t capacity):
+    wts(numThreads), workers(numThreads), num_workers(0), num_available_workers(0), done(false),
+    num_scheduled(0), num_dropped(0), capacity(capacity)
 {
     // Spawn dispatcher thread
     dt = thread([this]() { dispatcher(); });
@@ -25,12 +26,113 @@ ThreadPool::ThreadPool(size_t numThreads):
         wts[i] = thread([this, i]() { worker(workers[i]); });
     }
 }
-void ThreadPool::schedule(const thunk_t& thunk) {
-    // Lock around the queue when we modify it
-    q_lock.lock();
-    scheduled.push(thunk);
-    q_lock.unlock();
+void ThreadPool::schedule(const thunk_t& thunk, const string& source) {
+    // Lock around the queue when we modify it, waiting for room if it's bounded
+    unique_lock<mutex> ul(q_lock);
+    not_full.wait(ul, [this, &source] { return hasRoom(source); });
+    enqueue(thunk, never_cancelled, source, ul);
+}
+
+void ThreadPool::schedule(const thunk_t& thunk, const CancellationToken& token, const string& source) {
+    unique_lock<mutex> ul(q_lock);
+    not_full.wait(ul, [this, &source] { return hasRoom(source); });
+    enqueue(thunk, token, source, ul);
+}
+
+bool ThreadPool::trySchedule(const thunk_t& thunk, const string& source) {
+    unique_lock<mutex> ul(q_lock);
+    if (!hasRoom(source)) return false;
+    return enqueue(thunk, never_cancelled, source, ul);
+}
+
+bool ThreadPool::trySchedule(const thunk_t& thunk, chrono::steady_clock::duration timeout, const string& source) {
+    unique_lock<mutex> ul(q_lock);
+    if (!not_full.wait_for(ul, timeout, [this, &source] { return hasRoom(source); })) {
+        return false;
+    }
+    return enqueue(thunk, never_cancelled, source, ul);
+}
+
+void ThreadPool::setWeight(const string& source, size_t weight) {
+    lock_guard<mutex> lg(q_lock);
+    if (weight <= 1) weights.erase(source);
+    else weights[source] = weight;
+}
+
+size_t ThreadPool::getWeight(const string& source) const {
+    auto found = weights.find(source);
+    return found == weights.end() ? 1 : found->second;
+}
+
+bool ThreadPool::hasRoom(const string& source) const {
+    // Caller holds q_lock.  Even a full queue has room for a source's first few thunks
+    if (capacity == 0 || num_scheduled < capacity) return true;
+    auto found = sources.find(source);
+    size_t queued = found == sources.end() ? 0 : found->second.scheduled.size();
+    return queued < getWeight(source);
+}
+
+bool ThreadPool::enqueue(const thunk_t& thunk, const CancellationToken& token, const string& source,
+                         unique_lock<mutex>& ul) {
+    source_t& queue = sources[source];
+    if (queue.scheduled.empty()) turns.push_back(source); // Join the back of the line
+    queue.scheduled.push({thunk, token});
+    num_scheduled++;
+    ul.unlock();
     queue_not_empty.signal(); // Signal that we have something in the queue
+    return true;
+}
+
+bool ThreadPool::dequeue(thunk_t& thunk) {
+    // Caller holds q_lock.  The queue is empty if its backlog was discarded
+    if (turns.empty()) return false;
+
+    // The source at the front of the line keeps it until its turn is up
+    const string& source = turns.front();
+    source_t& queue = sources[source];
+    if (queue.turns_left == 0) queue.turns_left = getWeight(source);
+    task_t task = move(queue.scheduled.front());
+    queue.scheduled.pop();
+    num_scheduled--;
+    if (queue.scheduled.empty()) {
+        sources.erase(source);
+        turns.pop_front();
+    } else if (--queue.turns_left == 0) {
+        turns.push_back(move(turns.front()));
+        turns.pop_front();
+    }
+    if (task.token.isCancelled()) {
+        num_dropped++;
+        return false;
+    }
+    thunk = move(task.thunk);
+    return true;
+}
+
+size_t ThreadPool::discardBacklog() {
+    unique_lock<mutex> ul(q_lock);
+    size_t num_discarded = num_scheduled;
+    sources.clear();
+    turns.clear();
+    num_scheduled = 0;
+    num_dropped += num_discarded;
+    ul.unlock();
+    // The dispatcher still has a queue_not_empty signal for each discarded
+    // thunk, and finds nothing to dequeue for each of them
+    not_full.notify_all();
+    notifyAllAvailable();
+    return num_discarded;
+}
+
+size_t ThreadPool::getNumDropped() const {
+    lock_guard<mutex> lg(q_lock);
+    return num_dropped;
+}
+
+void ThreadPool::notifyAllAvailable() {
+    cv_lock.lock();
+    all_available.notify_all();
+    cv_lock.unlock();
 }
 
 void ThreadPool::dispatcher() {
@@ -42,7 +144,7 @@ void ThreadPool::dispatcher() {
 	if (done) {
 	    break;
 	}
-        size_t worker_id;
+        size_t worker_id = 0;
         for (worker_t& w : workers) {
 	    // Find an available worker, mark it unvailable
             if (w.available) {
@@ -54,14 +156,23 @@ void ThreadPool::dispatcher() {
         }
         worker_t& worker = workers[worker_id];
         
-	// Lock around the queue before retrieving the first thunk
+	// Lock around the queue before retrieving the next thunk
         q_lock.lock();
-        const thunk_t thunk = scheduled.front();
-        scheduled.pop();
+        thunk_t thunk;
+        bool found = dequeue(thunk);
         q_lock.unlock();
+        not_full.notify_all(); // Room for one more if we're bounded, though maybe only for some sources
+        if (!found) {
+	    // The thunk was cancelled or discarded, so hand the worker back
+            worker.available = true;
+            num_available_workers++;
+            available_workers.signal();
+            notifyAllAvailable(); // wait() may have been waiting on this thunk alone
+            continue;
+        }
         
 	// Put the thunk in the worker's struct and tell it it has a job waiting
-	worker.job = thunk;
+	worker.job = move(thunk);
         worker.job_waiting.signal();
     }
 }
@@ -80,9 +191,7 @@ void ThreadPool::worker(worker_t& worker) {
         worker.job(); // Run the job, signal the wait() cv if it's the last to finish something
 	num_available_workers++;
 	if (num_available_workers == num_workers) {
-	    cv_lock.lock();
-	    all_available.notify_all();
-	    cv_lock.unlock();
+	    notifyAllAvailable();
 	}
     }
 }
@@ -90,7 +199,10 @@ void ThreadPool::worker(worker_t& worker) {
 void ThreadPool::wait() {
     // Wait for all workers to be available with nothing in the queue
     lock_guard<mutex> lg(cv_lock);
-    all_available.wait(cv_lock, [this] { return (num_available_workers == num_workers) && (scheduled.size() == 0); }); 
+    all_available.wait(cv_lock, [this] {
+        lock_guard<mutex> qlg(q_lock);
+        return (num_available_workers == num_workers) && (num_scheduled == 0);
+    });
 }
 
 ThreadPool::~ThreadPool() {
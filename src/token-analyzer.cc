@@ -0,0 +1,320 @@
+/**
+ * File: token-analyzer.cc
+ * -----------------------
+ * Presents the implementation of the TokenAnalyzer class, including a
+ * straightforward port of Martin Porter's reference stemmer.
+ */
+
+#include "token-analyzer.h"
+#include "term-dictionary.h"
+#include <cstring>
+#include <sstream>
+
+using namespace std;
+
+static const char *kDefaultStopWords[] = {
+  "a", "about", "above", "after", "again", "against", "all", "am", "an", "and", "any", "are", "as",
+  "at", "be", "because", "been", "before", "being", "below", "between", "both", "but", "by", "can",
+  "could", "did", "do", "does", "doing", "down", "during", "each", "few", "for", "from", "further",
+  "had", "has", "have", "having", "he", "her", "here", "hers", "herself", "him", "himself", "his",
+  "how", "i", "if", "in", "into", "is", "it", "its", "itself", "just", "me", "more", "most", "my",
+  "myself", "no", "nor", "not", "now", "of", "off", "on", "once", "only", "or", "other", "our",
+  "ours", "ourselves", "out", "over", "own", "same", "she", "should", "so", "some", "such", "than",
+  "that", "the", "their", "theirs", "them", "themselves", "then", "there", "these", "they", "this",
+  "those", "through", "to", "too", "under", "until", "up", "very", "was", "we", "were", "what",
+  "when", "where", "which", "while", "who", "whom", "why", "will", "with", "would", "you", "your",
+  "yours", "yourself", "yourselves"
+};
+
+namespace {
+/**
+ * Stems the lowercase ASCII word in b[0..k] in place, per M.F. Porter, "An
+ * algorithm for suffix stripping" (1980), as in his reference C version.
+ * The stem is never longer than the word, so no extra room is needed.
+ */
+class PorterStemmer {
+ public:
+  PorterStemmer(char *b, int k): b(b), k(k), j(0) {}
+
+  // Returns the index of the stem's last character
+  int stem() {
+    if (k <= 1) return k;
+    step1ab();
+    if (k > 0) {
+      step1c();
+      step2();
+      step3();
+      step4();
+      step5();
+    }
+    return k;
+  }
+
+ private:
+  char *b;
+  int k, j;
+
+  bool cons(int i) const {
+    switch (b[i]) {
+    case 'a': case 'e': case 'i': case 'o': case 'u': return false;
+    case 'y': return i == 0 ? true : !cons(i - 1);
+    default: return true;
+    }
+  }
+
+  // Measures the number of consonant sequences in b[0..j]
+  int m() const {
+    int n = 0, i = 0;
+    while (true) {
+      if (i > j) return n;
+      if (!cons(i)) break;
+      i++;
+    }
+    i++;
+    while (true) {
+      while (true) {
+        if (i > j) return n;
+        if (cons(i)) break;
+        i++;
+      }
+      i++;
+      n++;
+      while (true) {
+        if (i > j) return n;
+        if (!cons(i)) break;
+        i++;
+      }
+      i++;
+    }
+  }
+
+  bool vowelInStem() const {
+    for (int i = 0; i <= j; i++) {
+      if (!cons(i)) return true;
+    }
+    return false;
+  }
+
+  bool doubleConsonant(int i) const {
+    return i >= 1 && b[i] == b[i - 1] && cons(i);
+  }
+
+  // True if b[i - 2..i] is consonant-vowel-consonant and the last isn't w, x or y
+  bool cvc(int i) const {
+    if (i < 2 || !cons(i) || cons(i - 1) || !cons(i - 2)) return false;
+    return b[i] != 'w' && b[i] != 'x' && b[i] != 'y';
+  }
+
+  bool ends(const char *s) {
+    int length = strlen(s);
+    if (length > k + 1 || memcmp(b + k - length + 1, s, length) != 0) return false;
+    j = k - length;
+    return true;
+  }
+
+  void setTo(const char *s) {
+    int length = strlen(s);
+    memcpy(b + j + 1, s, length);
+    k = j + length;
+  }
+
+  void replace(const char *s) {
+    if (m() > 0) setTo(s);
+  }
+
+  // Plurals and -ed or -ing
+  void step1ab() {
+    if (b[k] == 's') {
+      if (ends("sses")) k -= 2;
+      else if (ends("ies")) setTo("i");
+      else if (b[k - 1] != 's') k--;
+    }
+    if (ends("eed")) {
+      if (m() > 0) k--;
+    } else if ((ends("ed") || ends("ing")) && vowelInStem()) {
+      k = j;
+      if (ends("at")) setTo("ate");
+      else if (ends("bl")) setTo("ble");
+      else if (ends("iz")) setTo("ize");
+      else if (doubleConsonant(k)) {
+        k--;
+        if (b[k] == 'l' || b[k] == 's' || b[k] == 'z') k++;
+      } else if (m() == 1 && cvc(k)) setTo("e");
+    }
+  }
+
+  // Terminal y to i when there's another vowel in the stem
+  void step1c() {
+    if (ends("y") && vowelInStem()) b[k] = 'i';
+  }
+
+  // Double suffixes to single ones
+  void step2() {
+    switch (b[k - 1]) {
+    case 'a':
+      if (ends("ational")) replace("ate");
+      else if (ends("tional")) replace("tion");
+      break;
+    case 'c':
+      if (ends("enci")) replace("ence");
+      else if (ends("anci")) replace("ance");
+      break;
+    case 'e':
+      if (ends("izer")) replace("ize");
+      break;
+    case 'l':
+      if (ends("bli")) replace("ble");
+      else if (ends("alli")) replace("al");
+      else if (ends("entli")) replace("ent");
+      else if (ends("eli")) replace("e");
+      else if (ends("ousli")) replace("ous");
+      break;
+    case 'o':
+      if (ends("ization")) replace("ize");
+      else if (ends("ation")) replace("ate");
+      else if (ends("ator")) replace("ate");
+      break;
+    case 's':
+      if (ends("alism")) replace("al");
+      else if (ends("iveness")) replace("ive");
+      else if (ends("fulness")) replace("ful");
+      else if (ends("ousness")) replace("ous");
+      break;
+    case 't':
+      if (ends("aliti")) replace("al");
+      else if (ends("iviti")) replace("ive");
+      else if (ends("biliti")) replace("ble");
+      break;
+    case 'g':
+      if (ends("logi")) replace("log");
+      break;
+    }
+  }
+
+  // -ic-, -full, -ness and the like
+  void step3() {
+    switch (b[k]) {
+    case 'e':
+      if (ends("icate")) replace("ic");
+      else if (ends("ative")) replace("");
+      else if (ends("alize")) replace("al");
+      break;
+    case 'i':
+      if (ends("iciti")) replace("ic");
+      break;
+    case 'l':
+      if (ends("ical")) replace("ic");
+      else if (ends("ful")) replace("");
+      break;
+    case 's':
+      if (ends("ness")) replace("");
+      break;
+    }
+  }
+
+  // -ant, -ence and the like, in context <c>vcvc<v>
+  void step4() {
+    switch (b[k - 1]) {
+    case 'a': if (ends("al")) break; return;
+    case 'c': if (ends("ance") || ends("ence")) break; return;
+    case 'e': if (ends("er")) break; return;
+    case 'i': if (ends("ic")) break; return;
+    case 'l': if (ends("able") || ends("ible")) break; return;
+    case 'n': if (ends("ant") || ends("ement") || ends("ment") || ends("ent")) break; return;
+    case 'o':
+      if (ends("ion") && j >= 0 && (b[j] == 's' || b[j] == 't')) break;
+      if (ends("ou")) break;
+      return;
+    case 's': if (ends("ism")) break; return;
+    case 't': if (ends("ate") || ends("iti")) break; return;
+    case 'u': if (ends("ous")) break; return;
+    case 'v': if (ends("ive")) break; return;
+    case 'z': if (ends("ize")) break; return;
+    default: return;
+    }
+    if (m() > 1) k = j;
+  }
+
+  // A final -e, and -ll to -l, when m() > 1
+  void step5() {
+    j = k;
+    if (b[k] == 'e') {
+      int a = m();
+      if (a > 1 || (a == 1 && !cvc(k - 1))) k--;
+    }
+    if (b[k] == 'l' && doubleConsonant(k) && m() > 1) k--;
+  }
+};
+}
+
+static bool isStemmable(token_view token) {
+  if (token.size() <= 2) return false;
+  for (char ch: token) {
+    if (ch < 'a' || ch > 'z') return false;
+  }
+  return true;
+}
+
+TokenAnalyzer::TokenAnalyzer(bool removeStopWords, bool stem, size_t minLength):
+  removeStopWords(removeStopWords), stem(stem), minLength(minLength),
+  stopWords(begin(kDefaultStopWords), end(kDefaultStopWords)),
+  numTokens(0), numTooShort(0), numStopWords(0), numStemmed(0) {}
+
+void TokenAnalyzer::setStopWords(const vector<string>& words) {
+  stopWords.clear();
+  stopWords.insert(words.begin(), words.end());
+}
+
+bool TokenAnalyzer::isStopWord(token_view token) const {
+  return removeStopWords && stopWords.find(token) != stopWords.end();
+}
+
+token_view TokenAnalyzer::analyze(token_view token, Arena& arena, AnalysisStats& stats) const {
+  stats.numTokens++;
+  if (token.size() < minLength) {
+    stats.numTooShort++;
+    return token_view();
+  }
+  if (isStopWord(token)) {
+    stats.numStopWords++;
+    return token_view();
+  }
+  if (!stem || !isStemmable(token)) return token;
+
+  char *stemmed = static_cast<char *>(arena.allocate(token.size(), 1));
+  memcpy(stemmed, token.data(), token.size());
+  size_t length = PorterStemmer(stemmed, token.size() - 1).stem() + 1;
+  if (length == token.size() && memcmp(stemmed, token.data(), length) == 0) return token;
+  stats.numStemmed++;
+  return token_view(stemmed, length);
+}
+
+string TokenAnalyzer::analyzeQuery(const string& query) const {
+  istringstream iss(query);
+  string word, analyzed;
+  while (iss >> word) {
+    if (!TermDictionary::isPattern(word)) {
+      if (word.size() < minLength || isStopWord(word)) continue;
+      if (stem && isStemmable(word)) word.resize(PorterStemmer(&word[0], word.size() - 1).stem() + 1);
+    }
+    if (!analyzed.empty()) analyzed += ' ';
+    analyzed += word;
+  }
+  return analyzed;
+}
+
+void TokenAnalyzer::record(const AnalysisStats& stats) {
+  numTokens += stats.numTokens;
+  numTooShort += stats.numTooShort;
+  numStopWords += stats.numStopWords;
+  numStemmed += stats.numStemmed;
+}
+
+AnalysisStats TokenAnalyzer::getTotals() const {
+  AnalysisStats totals;
+  totals.numTokens = numTokens;
+  totals.numTooShort = numTooShort;
+  totals.numStopWords = numStopWords;
+  totals.numStemmed = numStemmed;
+  return totals;
+}
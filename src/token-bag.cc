@@ -0,0 +1,57 @@
+/**
+ * File: token-bag.cc
+ * ------------------
+ * Presents the implementation of the TokenBag class.
+ */
+
+#include "token-bag.h"
+#include <algorithm>
+using namespace std;
+
+void TokenBag::append(token_view term, uint32_t count) {
+  Entry entry = {static_cast<uint32_t>(terms.size()), static_cast<uint32_t>(term.size()), count};
+  terms.append(term.data(), term.size());
+  entries.push_back(entry);
+}
+
+void TokenBag::assign(const token_view *sorted, size_t count) {
+  terms.clear();
+  entries.clear();
+  size_t numDistinct = 0, numBytes = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (i == 0 || sorted[i] != sorted[i - 1]) {
+      numDistinct++;
+      numBytes += sorted[i].size();
+    }
+  }
+  terms.reserve(numBytes);
+  entries.reserve(numDistinct);
+
+  size_t i = 0;
+  while (i < count) {
+    size_t j = i + 1;
+    while (j < count && sorted[j] == sorted[i]) j++;
+    append(sorted[i], j - i);
+    i = j;
+  }
+}
+
+TokenBag TokenBag::intersect(const TokenBag& other) const {
+  TokenBag result;
+  size_t i = 0, j = 0;
+  while (i < size() && j < other.size()) {
+    int cmp = term(i).compare(other.term(j));
+    if (cmp < 0) {
+      i++;
+    } else if (cmp > 0) {
+      j++;
+    } else {
+      result.append(term(i), min(count(i), other.count(j)));
+      i++;
+      j++;
+    }
+  }
+  result.terms.shrink_to_fit();
+  result.entries.shrink_to_fit();
+  return result;
+}
@@ -0,0 +1,132 @@
+/**
+ * File: tokenizer-bench.cc
+ * ------------------------
+ * Microbenchmark comparing the char-at-a-time StreamTokenizer against the
+ * vectorized WordTokenizer.  Both tokenize and lowercase the same pages
+ * (saved HTML or XML documents named on the command line) and report
+ * throughput in bytes per second.  On x86 it fails unless the WordTokenizer
+ * actually took one of its vector paths for the default delimiters.
+ *
+ *   ./tokenizer-bench [--iterations <n>] page.html [page.html ...]
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+#include "stream-tokenizer.h"
+#include "word-tokenizer.h"
+#include "string-utils.h"
+using namespace std;
+
+static const size_t kDefaultIterations = 20;
+static const char *kDefaultPages[] = {"small-feed.xml", "medium-feed.xml", "static-alphabet-feed.xml"};
+
+static bool readFile(const string& path, string& contents) {
+  ifstream infile(path, ios::binary);
+  if (!infile) return false;
+  ostringstream oss;
+  oss << infile.rdbuf();
+  contents = oss.str();
+  return true;
+}
+
+static size_t runStreamTokenizer(const vector<string>& pages) {
+  size_t numTokens = 0;
+  for (const string& page: pages) {
+    istringstream iss(page);
+    StreamTokenizer st(iss, kDefaultWordDelimiters);
+    while (st.hasMoreTokens()) {
+      string token = toLowerCase(st.nextToken());
+      if (!token.empty()) numTokens++;
+    }
+  }
+  return numTokens;
+}
+
+static size_t runWordTokenizer(const vector<string>& pages) {
+  size_t numTokens = 0;
+  WordTokenizer wt;
+  for (const string& page: pages) {
+    wt.reset(page);
+    while (wt.hasMoreTokens()) {
+      if (!wt.nextToken().empty()) numTokens++;
+    }
+  }
+  return numTokens;
+}
+
+static const char *getClassifierName(WordTokenizer::Classifier classifier) {
+  switch (classifier) {
+  case WordTokenizer::kAVX2Lookup: return "AVX2 nibble lookup";
+  case WordTokenizer::kSSSE3Lookup: return "SSSE3 nibble lookup";
+  case WordTokenizer::kSSE2Ranges: return "SSE2 range compares";
+  case WordTokenizer::kScalar: break;
+  }
+  return "scalar";
+}
+
+template <typename Runner>
+static double measure(const string& name, Runner runner, const vector<string>& pages,
+                      size_t totalBytes, size_t iterations, size_t& numTokens) {
+  numTokens = runner(pages); // warm up caches and the allocator
+  auto start = chrono::steady_clock::now();
+  for (size_t i = 0; i < iterations; i++) numTokens = runner(pages);
+  chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+  double bytesPerSecond = totalBytes * iterations / elapsed.count();
+  cout << "  " << left << setw(16) << name << right << fixed << setprecision(1)
+       << setw(10) << bytesPerSecond / (1 << 20) << " MiB/s  (" << numTokens << " tokens)" << endl;
+  return bytesPerSecond;
+}
+
+int main(int argc, char *argv[]) {
+  size_t iterations = kDefaultIterations;
+  vector<string> paths;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+      iterations = strtoul(argv[++i], NULL, 10);
+    } else {
+      paths.push_back(argv[i]);
+    }
+  }
+  if (paths.empty()) paths.assign(kDefaultPages, kDefaultPages + sizeof(kDefaultPages) / sizeof(kDefaultPages[0]));
+
+  vector<string> pages;
+  size_t totalBytes = 0;
+  for (const string& path: paths) {
+    string contents;
+    if (!readFile(path, contents)) {
+      cerr << "Could not read \"" << path << "\"." << endl;
+      return 1;
+    }
+    totalBytes += contents.size();
+    pages.push_back(contents);
+  }
+
+  WordTokenizer::Classifier classifier = WordTokenizer().getClassifier();
+  cout << "WordTokenizer classifier: " << getClassifierName(classifier) << endl;
+#if defined(__AVX2__) || defined(__SSE2__)
+  if (classifier == WordTokenizer::kScalar) {
+    cerr << "WordTokenizer fell back to its scalar path for the default delimiters." << endl;
+    return 1;
+  }
+#endif
+
+  cout << "Tokenizing " << pages.size() << " page" << (pages.size() == 1 ? "" : "s") << " ("
+       << totalBytes << " bytes) " << iterations << " times:" << endl;
+  size_t streamTokens, wordTokens;
+  double streamRate = measure("StreamTokenizer", runStreamTokenizer, pages, totalBytes, iterations, streamTokens);
+  double wordRate = measure("WordTokenizer", runWordTokenizer, pages, totalBytes, iterations, wordTokens);
+  cout << "  speedup: " << setprecision(2) << wordRate / streamRate << "x" << endl;
+  if (streamTokens != wordTokens) {
+    cerr << "Token counts differ (" << streamTokens << " vs. " << wordTokens << ")." << endl;
+    return 1;
+  }
+  return 0;
+}
@@ -11,6 +11,7 @@
 #include <string>
 #include <functional>
 #include <cstring>
+#include <chrono>
 
 #include <sys/types.h> // used to count the number of threads
 #include <unistd.h>    // used to count the number of threads
@@ -88,6 +89,60 @@ static void stressPoolTest() {
  }
 }
 
+static void boundedQueueTest() {
+  ThreadPool pool(2, 4);
+  for (size_t i = 0; i < 6; i++) { // two running, four queued
+    pool.schedule([i] {
+      sleep_for(500);
+      cout << oslock << "Bounded thread " << i << " done." << endl << osunlock;
+    });
+  }
+  sleep_for(100);
+  cout << "trySchedule on a full queue " << (pool.trySchedule([] {}) ? "succeeded (wrong)" : "failed") << "." << endl;
+  bool scheduled = pool.trySchedule([] {}, chrono::milliseconds(1000));
+  cout << "trySchedule with a timeout " << (scheduled ? "succeeded" : "failed (wrong)") << "." << endl;
+  pool.schedule([] { cout << "Blocking schedule went through." << endl; });
+  pool.wait();
+}
+
+static void fairQueuingTest() {
+  ThreadPool pool(1);
+  pool.setWeight("heavy", 2);
+  pool.schedule([] { sleep_for(200); }); // hold the only worker while the queue fills up
+  sleep_for(50);
+  for (size_t i = 0; i < 3; i++) {
+    pool.schedule([i] { cout << oslock << "light " << i << endl << osunlock; }, "light");
+  }
+  for (size_t i = 0; i < 3; i++) {
+    pool.schedule([i] { cout << oslock << "heavy " << i << endl << osunlock; }, "heavy");
+  }
+  pool.wait(); // expect light 0, heavy 0, heavy 1, light 1, heavy 2, light 2
+}
+
+static void cancellationTest() {
+  ThreadPool pool(1);
+  CancellationToken token;
+  pool.schedule([] { sleep_for(200); }); // hold the only worker while the queue fills up
+  for (size_t i = 0; i < 3; i++) {
+    pool.schedule([i] { cout << oslock << "cancelled " << i << " ran (wrong)" << endl << osunlock; }, token);
+    pool.schedule([i] { cout << oslock << "uncancelled " << i << " ran" << endl << osunlock; });
+  }
+  token.cancel();
+  pool.wait();
+  cout << pool.getNumDropped() << " thunks dropped (expect 3)." << endl;
+}
+
+static void discardBacklogTest() {
+  ThreadPool pool(2);
+  for (size_t i = 0; i < 100; i++) pool.schedule([] { sleep_for(100); });
+  sleep_for(50);
+  auto start = chrono::steady_clock::now();
+  size_t discarded = pool.discardBacklog();
+  pool.wait();
+  size_t elapsed = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count();
+  cout << "Discarded " << discarded << " thunks (expect 98), then waited " << elapsed << "ms (expect about 50)." << endl;
+}
+
 struct testEntry {
   string flag;
   function<void(void)> testfn;
@@ -101,6 +156,10 @@ static void buildMap(map<string, function<void(void)>>& testFunctionMap) {
     {"--reuse-thread-pool", reuseThreadPoolTest},
     {"--stress-pool", stressPoolTest},
     {"--pre-wait", preWaitTest},
+    {"--bounded-queue", boundedQueueTest},
+    {"--fair-queuing", fairQueuingTest},
+    {"--cancellation", cancellationTest},
+    {"--discard-backlog", discardBacklogTest},
   };
 
   for (const testEntry& entry: entries) {
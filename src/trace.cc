@@ -0,0 +1,128 @@
+/**
+ * File: trace.cc
+ * --------------
+ * Presents the implementation of the Tracer.  Each thread that records a span
+ * gets its own chain of fixed-size chunks.  Only the owning thread ever
+ * writes to a chain; it publishes each event by bumping the chunk's count
+ * with a release store, so dump can walk every chain without stopping the
+ * threads that own them.  Chains are never freed, since a pool thread may
+ * exit before the dump.
+ */
+
+#include "trace.h"
+#include <chrono>
+#include <mutex>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <iomanip>
+
+using namespace std;
+
+atomic<bool> Tracer::enabled(false);
+
+namespace {
+struct Event {
+  const char *name;
+  uint64_t start;
+  uint64_t end;
+};
+
+static const size_t kChunkSize = 4096;
+struct Chunk {
+  Event events[kChunkSize];
+  atomic<size_t> count;
+  atomic<Chunk *> next;
+  Chunk(): count(0), next(NULL) {}
+};
+
+struct ThreadBuffer {
+  size_t threadId;
+  Chunk *head;
+  Chunk *tail;
+};
+}
+
+static atomic<uint64_t> origin(0);
+static mutex registryLock;
+static vector<ThreadBuffer *> registry;
+static thread_local ThreadBuffer *localBuffer = NULL;
+
+static ThreadBuffer *registerThread() {
+  ThreadBuffer *buffer = new ThreadBuffer;
+  buffer->head = buffer->tail = new Chunk;
+  lock_guard<mutex> lg(registryLock);
+  buffer->threadId = registry.size() + 1;
+  registry.push_back(buffer);
+  return buffer;
+}
+
+void Tracer::enable() {
+  origin = now();
+  enabled = true;
+}
+
+void Tracer::disable() {
+  enabled = false;
+}
+
+uint64_t Tracer::now() {
+  return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Tracer::record(const char *name, uint64_t start, uint64_t end) {
+  if (localBuffer == NULL) localBuffer = registerThread();
+  Chunk *tail = localBuffer->tail;
+  size_t count = tail->count.load(memory_order_relaxed);
+  if (count == kChunkSize) {
+    Chunk *fresh = new Chunk;
+    tail->next.store(fresh, memory_order_release);
+    localBuffer->tail = tail = fresh;
+    count = 0;
+  }
+  Event& event = tail->events[count];
+  event.name = name;
+  event.start = start;
+  event.end = end;
+  tail->count.store(count + 1, memory_order_release);
+}
+
+template <typename Visitor>
+static void forEachEvent(Visitor visit) {
+  lock_guard<mutex> lg(registryLock);
+  for (const ThreadBuffer *buffer: registry) {
+    for (const Chunk *chunk = buffer->head; chunk != NULL; chunk = chunk->next.load(memory_order_acquire)) {
+      size_t count = chunk->count.load(memory_order_acquire);
+      for (size_t i = 0; i < count; i++) visit(buffer->threadId, chunk->events[i]);
+    }
+  }
+}
+
+long Tracer::dump(const string& filename) {
+  ofstream outfile(filename);
+  if (!outfile) return -1;
+  uint64_t base = origin;
+  long numEvents = 0;
+  outfile << "{\"traceEvents\":[" << fixed << setprecision(3);
+  forEachEvent([&](size_t threadId, const Event& event) {
+    if (numEvents > 0) outfile << ",";
+    outfile << "\n{\"name\":\"" << event.name << "\",\"cat\":\"aggregate\",\"ph\":\"X\",\"pid\":1,\"tid\":"
+            << threadId << ",\"ts\":" << (event.start - base) / 1000.0
+            << ",\"dur\":" << (event.end - event.start) / 1000.0 << "}";
+    numEvents++;
+  });
+  outfile << "\n],\"displayTimeUnit\":\"ms\"}" << endl;
+  return outfile ? numEvents : -1;
+}
+
+vector<TraceTotal> Tracer::summarize() {
+  map<string, TraceTotal> totals;
+  forEachEvent([&totals](size_t, const Event& event) {
+    TraceTotal& total = totals.emplace(event.name, TraceTotal{event.name, 0, 0}).first->second;
+    total.count++;
+    total.nanoseconds += event.end - event.start;
+  });
+  vector<TraceTotal> summary;
+  for (const auto& entry: totals) summary.push_back(entry.second);
+  return summary;
+}
@@ -2,14 +2,13 @@
  * File: utils.cc
  * --------------
  * Provides the implementation of those functions exported
- * by utils.h. (Note that the implementation
- * isn't 100% perfect, because it makes the assumption that
- * all characters are one-byte UTF8 characters.  Consider the
- * work needed to make it fully UTF8 compliant a nice to-do
- * list item).
+ * by utils.h.  Lengths are still measured in bytes rather than
+ * characters, but truncate never cuts a multibyte UTF-8
+ * character in half.
  */
 
 #include "utils.h"
+#include <cstdint>
 using namespace std;
 
 static const string kHTTPPrefix = "http://";
@@ -31,10 +30,36 @@ bool shouldTruncate(const string& str) {
   return str.size() > kMaxLength;
 }
 
+static inline bool isContinuationByte(char ch) {
+  return (static_cast<unsigned char>(ch) & 0xC0) == 0x80;
+}
+
 string truncate(const string& str) {
   if (!shouldTruncate(str)) return str;
-  string front = str.substr(0, kRetainedPrefixLength);
+  size_t prefixEnd = kRetainedPrefixLength;
+  while (prefixEnd > 0 && isContinuationByte(str[prefixEnd])) prefixEnd--;
+  size_t suffixStart = str.size() - kRetainedSuffixLength;
+  while (suffixStart < str.size() && isContinuationByte(str[suffixStart])) suffixStart++;
+  string front = str.substr(0, prefixEnd);
   string middle = string(kInternalPaddingLength, '.');
-  string end = str.substr(str.size() - kRetainedSuffixLength);
+  string end = str.substr(suffixStart);
   return front + middle + end;
 }
+
+uint64_t hash64(const char *data, size_t length) {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < length; i++) {
+    hash ^= static_cast<unsigned char>(data[i]);
+    hash *= 0x100000001b3ULL;
+  }
+  hash ^= hash >> 30;
+  hash *= 0xbf58476d1ce4e5b9ULL;
+  hash ^= hash >> 27;
+  hash *= 0x94d049bb133111ebULL;
+  hash ^= hash >> 31;
+  return hash;
+}
+
+size_t getShard(const string& url, size_t numShards) {
+  return hash64(url) % numShards;
+}
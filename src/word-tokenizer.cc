@@ -0,0 +1,212 @@
+/**
+ * File: word-tokenizer.cc
+ * -----------------------
+ * Presents the implementation of the WordTokenizer class.  The vector
+ * classifiers are compiled for their own instruction sets and chosen at
+ * run time, so a plain x86-64 build still uses AVX2 or SSSE3 when the CPU
+ * has them.  SSE2 (which every x86-64 target has) falls back to range
+ * compares, and everything else to a scalar bitmap walk.
+ */
+
+#include "word-tokenizer.h"
+#include <cstring>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+const string kDefaultWordDelimiters = " \t\r\n\f\v!\"#$%&'()*+,-./:;<=>?@[\\]^_`{|}~";
+
+static inline unsigned char foldByte(unsigned char ch) {
+  return (ch >= 'A' && ch <= 'Z') ? ch + ('a' - 'A') : ch;
+}
+
+WordTokenizer::WordTokenizer(const string& delimiters):
+  classifier(kScalar), numRanges(0), text(NULL), length(0), pos(0) {
+  memset(bitmap, 0, sizeof(bitmap));
+  for (char ch: delimiters) {
+    unsigned char folded = foldByte(ch);
+    bitmap[folded >> 6] |= uint64_t(1) << (folded & 63);
+  }
+  memset(lowNibbles, 0, sizeof(lowNibbles));
+  for (int ch = 0; ch < 128; ch++) {
+    if (isDelimiter(ch)) lowNibbles[ch & 15] |= 1 << (ch >> 4);
+  }
+
+  // Collect the runs of word bytes; uppercase letters never survive the
+  // lowercasing pass, so they're free to merge with whatever surrounds them.
+  size_t runs = 0;
+  int low = -1;
+  for (int ch = 0; ch <= 256; ch++) {
+    bool word = ch < 256 && (!isDelimiter(ch) || (ch >= 'A' && ch <= 'Z'));
+    if (word && low == -1) {
+      low = ch;
+    } else if (!word && low != -1) {
+      if (runs < kMaxVectorRanges) {
+        rangeLow[runs] = low;
+        rangeSpan[runs] = ch - 1 - low;
+      }
+      runs++;
+      low = -1;
+    }
+  }
+  numRanges = runs <= kMaxVectorRanges ? runs : 0;
+
+#if defined(__AVX2__) || defined(__SSE2__)
+  bool asciiDelimiters = (bitmap[2] | bitmap[3]) == 0; // the nibble lookup only covers bytes below 0x80
+  if (asciiDelimiters && __builtin_cpu_supports("avx2")) classifier = kAVX2Lookup;
+  else if (asciiDelimiters && __builtin_cpu_supports("ssse3")) classifier = kSSSE3Lookup;
+  else if (numRanges > 0) classifier = kSSE2Ranges;
+#endif
+}
+
+#if defined(__AVX2__) || defined(__SSE2__)
+static inline void lowercase(char *dst, const char *src, size_t length) {
+  size_t i = 0;
+#if defined(__AVX2__)
+  const __m256i upperA = _mm256_set1_epi8('A');
+  const __m256i span = _mm256_set1_epi8('Z' - 'A');
+  const __m256i caseBit = _mm256_set1_epi8(0x20);
+  for (; i + 32 <= length; i += 32) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+    __m256i isUpper = _mm256_cmpeq_epi8(_mm256_subs_epu8(_mm256_sub_epi8(v, upperA), span),
+                                        _mm256_setzero_si256());
+    v = _mm256_or_si256(v, _mm256_and_si256(isUpper, caseBit));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), v);
+  }
+#endif
+  const __m128i upperA128 = _mm_set1_epi8('A');
+  const __m128i span128 = _mm_set1_epi8('Z' - 'A');
+  const __m128i caseBit128 = _mm_set1_epi8(0x20);
+  for (; i + 16 <= length; i += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+    __m128i isUpper = _mm_cmpeq_epi8(_mm_subs_epu8(_mm_sub_epi8(v, upperA128), span128),
+                                     _mm_setzero_si128());
+    v = _mm_or_si128(v, _mm_and_si128(isUpper, caseBit128));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), v);
+  }
+  for (; i < length; i++) dst[i] = foldByte(src[i]);
+}
+#else
+static inline void lowercase(char *dst, const char *src, size_t length) {
+  for (size_t i = 0; i < length; i++) dst[i] = foldByte(src[i]);
+}
+#endif
+
+void WordTokenizer::reset(const char *text, size_t length) {
+  ownedBuffer.resize(length);
+  lowercase(&ownedBuffer[0], text, length);
+  this->text = ownedBuffer.data();
+  this->length = length;
+  pos = find(0, true);
+}
+
+void WordTokenizer::reset(const char *text, size_t length, Arena& arena) {
+  char *copy = static_cast<char *>(arena.allocate(length, 1));
+  lowercase(copy, text, length);
+  this->text = copy;
+  this->length = length;
+  pos = find(0, true);
+}
+
+token_view WordTokenizer::nextToken() {
+  if (!hasMoreTokens()) return token_view();
+  size_t end = find(pos, false);
+  token_view token(text + pos, end - pos);
+  pos = find(end, true);
+  return token;
+}
+
+void WordTokenizer::appendTokens(ArenaVector<token_view>& tokens) {
+  while (hasMoreTokens()) tokens.push_back(nextToken());
+}
+
+size_t WordTokenizer::findScalar(size_t from, bool wordByte) const {
+  const unsigned char *bytes = reinterpret_cast<const unsigned char *>(text);
+  while (from < length && isDelimiter(bytes[from]) == wordByte) from++;
+  return from;
+}
+
+#if defined(__AVX2__) || defined(__SSE2__)
+/**
+ * The lookup classifiers split each byte into nibbles and look both up with
+ * pshufb: lowNibbles[lo] holds a bit per high nibble, and highBits[hi] picks
+ * out bit hi (or nothing, for bytes 0x80 and above, which are never
+ * delimiters).  A byte is a delimiter when the two lookups share a bit.
+ * Each returns the first match at or after from, or where its last full
+ * vector ended if there isn't one; findScalar finishes the job either way.
+ */
+alignas(16) static const unsigned char kHighBits[16] = {
+  0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0, 0, 0, 0, 0, 0, 0, 0
+};
+
+__attribute__((target("ssse3")))
+static inline __m128i classifyDelimiters(__m128i v, __m128i lowNibbles, __m128i highBits) {
+  const __m128i nibble = _mm_set1_epi8(0x0f);
+  __m128i low = _mm_shuffle_epi8(lowNibbles, _mm_and_si128(v, nibble));
+  __m128i high = _mm_shuffle_epi8(highBits, _mm_and_si128(_mm_srli_epi16(v, 4), nibble));
+  return _mm_cmpeq_epi8(_mm_and_si128(low, high), _mm_setzero_si128()); // 0xff for word bytes
+}
+
+__attribute__((target("ssse3")))
+static size_t findSSSE3(const char *bytes, size_t length, size_t from, bool wordByte,
+                        const unsigned char *lowNibbles) {
+  const __m128i lowTable = _mm_loadu_si128(reinterpret_cast<const __m128i *>(lowNibbles));
+  const __m128i highTable = _mm_load_si128(reinterpret_cast<const __m128i *>(kHighBits));
+  for (; from + 16 <= length; from += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(bytes + from));
+    uint32_t mask = _mm_movemask_epi8(classifyDelimiters(v, lowTable, highTable));
+    if (!wordByte) mask = ~mask & 0xffff;
+    if (mask != 0) return from + __builtin_ctz(mask);
+  }
+  return from;
+}
+
+__attribute__((target("avx2")))
+static size_t findAVX2(const char *bytes, size_t length, size_t from, bool wordByte,
+                       const unsigned char *lowNibbles) {
+  const __m256i lowTable = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(lowNibbles)));
+  const __m256i highTable = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i *>(kHighBits)));
+  const __m256i nibble = _mm256_set1_epi8(0x0f);
+  for (; from + 32 <= length; from += 32) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(bytes + from));
+    __m256i low = _mm256_shuffle_epi8(lowTable, _mm256_and_si256(v, nibble));
+    __m256i high = _mm256_shuffle_epi8(highTable, _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble));
+    uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(low, high), _mm256_setzero_si256()));
+    if (!wordByte) mask = ~mask;
+    if (mask != 0) return from + __builtin_ctz(mask);
+  }
+  return findSSSE3(bytes, length, from, wordByte, lowNibbles);
+}
+
+static size_t findSSE2(const char *bytes, size_t length, size_t from, bool wordByte, size_t numRanges,
+                       const unsigned char *rangeLow, const unsigned char *rangeSpan) {
+  for (; from + 16 <= length; from += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(bytes + from));
+    __m128i word = _mm_setzero_si128();
+    for (size_t r = 0; r < numRanges; r++) {
+      __m128i offset = _mm_sub_epi8(v, _mm_set1_epi8(rangeLow[r]));
+      word = _mm_or_si128(word, _mm_cmpeq_epi8(_mm_subs_epu8(offset, _mm_set1_epi8(rangeSpan[r])),
+                                               _mm_setzero_si128()));
+    }
+    uint32_t mask = _mm_movemask_epi8(word);
+    if (!wordByte) mask = ~mask & 0xffff;
+    if (mask != 0) return from + __builtin_ctz(mask);
+  }
+  return from;
+}
+#endif
+
+size_t WordTokenizer::find(size_t from, bool wordByte) const {
+#if defined(__AVX2__) || defined(__SSE2__)
+  switch (classifier) {
+  case kAVX2Lookup: from = findAVX2(text, length, from, wordByte, lowNibbles); break;
+  case kSSSE3Lookup: from = findSSSE3(text, length, from, wordByte, lowNibbles); break;
+  case kSSE2Ranges: from = findSSE2(text, length, from, wordByte, numRanges, rangeLow, rangeSpan); break;
+  case kScalar: break;
+  }
+#endif
+  return findScalar(from, wordByte);
+}